@@ -0,0 +1,362 @@
+#ifndef ADDRESSABLE_HEAP_H
+#define ADDRESSABLE_HEAP_H
+
+#include "heap.h"
+#include <assert.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Thrown when an AddressableHeap is given a handle which does not refer to one of its elements.
+ */
+class InvalidHandleException : public std::exception {
+	virtual const char* what() const throw() {
+		return "AddressableHeap handle does not refer to an element";
+	}
+};
+
+/**
+ * A priority queue, like Heap, whose elements can be found again after they are pushed: push returns a handle, through
+ * which the element can be read, given a new value or erased, each in O(log n). A position map from handle to slot is
+ * kept up to date as elements move during sifting.
+ *
+ * A handle stays valid until its element is popped or erased. After that it may be handed out again by a later push.
+ * @tparam T type of the elements
+ * @tparam ARITY number of children of each element; 2 gives a binary heap
+ * @tparam Compare functor called with two elements by const reference, which returns true if the first should be popped
+ *                 before the second
+ */
+template <class T, int ARITY = 2, class Compare = Heap_Comparator<T> >
+class AddressableHeap : private Heap_private::ComparatorStore<Compare> {
+	static_assert(ARITY >= 2, "a Heap needs at least two children per element");
+
+	typedef Heap_private::ComparatorStore<Compare> Store;
+	using Store::comparator;
+
+	struct Entry {
+		T value;
+		int handle;
+
+		template<class... Args>
+		Entry(int h, Args&&... args) : value(std::forward<Args>(args)...), handle(h) {}
+	};
+
+	/**
+	 * The elements, as an implicit ARITY-way tree.
+	 */
+	std::vector<Entry> entries_;
+
+	/**
+	 * The index into entries_ of the element of each handle, or -1 for a handle which is free.
+	 */
+	std::vector<int> positions_;
+
+	std::vector<int> freeHandles_;
+
+public:
+	typedef int Handle;
+
+	AddressableHeap() : Store(Compare()) {}
+
+	/**
+	 * With Heap_FunctionComparator<T> as Compare, comparator may be a plain bool(T, T) function.
+	 */
+	AddressableHeap(const Compare& comparator) : Store(comparator) {}
+
+	inline int size() const { return (int) entries_.size(); }
+
+	/**
+	 * @return true if the handle refers to an element of this heap
+	 */
+	bool contains(Handle handle) const {
+		return handle >= 0 && handle < (int) positions_.size() && positions_[handle] >= 0;
+	}
+
+	Handle push(const T& value) { return emplace(value); }
+
+	Handle push(T&& value) { return emplace(std::move(value)); }
+
+	/**
+	 * Construct an element from args and add it to the heap.
+	 * @return a handle to the new element
+	 */
+	template<class... Args>
+	Handle emplace(Args&&... args);
+
+	const T& peek() const { return entries_[0].value; }
+
+	/**
+	 * @return the handle of the element which peek() returns
+	 */
+	Handle peekHandle() const { return entries_[0].handle; }
+
+	/**
+	 * @return the element a handle refers to
+	 */
+	const T& get(Handle handle) const { return entries_[positionOf(handle)].value; }
+
+	T pop();
+
+	/**
+	 * Give an element a new value which is popped no later than its old one: a smaller key with a min-heap comparator,
+	 * as in Dijkstra's algorithm. The element only needs to be sifted up.
+	 */
+	void decreaseKey(Handle handle, T value);
+
+	/**
+	 * Give an element a new value which is popped no earlier than its old one. The element only needs to be sifted
+	 * down.
+	 */
+	void increaseKey(Handle handle, T value);
+
+	/**
+	 * Give an element any new value.
+	 */
+	void update(Handle handle, T value);
+
+	/**
+	 * Remove an element from anywhere in the heap.
+	 * @return the element removed
+	 */
+	T erase(Handle handle);
+
+private:
+	inline int computeParentIndex(int index) const { return (index - 1) / ARITY; }
+	inline int computeFirstChildIndex(int index) const { return index * ARITY + 1; }
+
+	int positionOf(Handle handle) const;
+
+	Handle acquireHandle();
+
+	void releaseHandle(Handle handle);
+
+	void place(int index, Entry&& entry);
+
+	void fill(int holeIndex, Entry&& entry);
+
+	void bubbleUp(int holeIndex, Entry&& entry);
+
+	void bubbleDown(int holeIndex, Entry&& entry);
+
+	int sinkHole(int holeIndex);
+
+	int topChild(int firstChildIndex, int endChildIndex) const;
+};
+
+template<class T, int ARITY, class Compare>
+template<class... Args>
+typename AddressableHeap<T, ARITY, Compare>::Handle AddressableHeap<T, ARITY, Compare>::emplace(Args&&... args)
+{
+	Handle handle = acquireHandle();
+	int index = size();
+	try {
+		entries_.emplace_back(handle, std::forward<Args>(args)...);
+	} catch (...) {
+		releaseHandle(handle);
+		throw;
+	}
+	positions_[handle] = index;
+
+	if (index > 0 && comparator()(entries_[index].value, entries_[computeParentIndex(index)].value)) {
+		Entry entry(std::move(entries_[index]));
+		bubbleUp(index, std::move(entry));
+	}
+	return handle;
+}
+
+template<class T, int ARITY, class Compare>
+T AddressableHeap<T, ARITY, Compare>::pop()
+{
+	if (entries_.empty()) {
+		throw the_EmptyHeapException;
+	}
+
+	T head(std::move(entries_[0].value));
+	releaseHandle(entries_[0].handle);
+	Entry last(std::move(entries_.back()));
+	entries_.pop_back();
+	if (!entries_.empty()) {
+		bubbleUp(sinkHole(0), std::move(last));
+	}
+	return head;
+}
+
+template<class T, int ARITY, class Compare>
+void AddressableHeap<T, ARITY, Compare>::decreaseKey(Handle handle, T value)
+{
+	int index = positionOf(handle);
+	assert(!comparator()(entries_[index].value, value));
+	entries_[index].value = std::move(value);
+	Entry entry(std::move(entries_[index]));
+	bubbleUp(index, std::move(entry));
+}
+
+template<class T, int ARITY, class Compare>
+void AddressableHeap<T, ARITY, Compare>::increaseKey(Handle handle, T value)
+{
+	int index = positionOf(handle);
+	assert(!comparator()(value, entries_[index].value));
+	entries_[index].value = std::move(value);
+	Entry entry(std::move(entries_[index]));
+	bubbleDown(index, std::move(entry));
+}
+
+template<class T, int ARITY, class Compare>
+void AddressableHeap<T, ARITY, Compare>::update(Handle handle, T value)
+{
+	int index = positionOf(handle);
+	entries_[index].value = std::move(value);
+	Entry entry(std::move(entries_[index]));
+	fill(index, std::move(entry));
+}
+
+template<class T, int ARITY, class Compare>
+T AddressableHeap<T, ARITY, Compare>::erase(Handle handle)
+{
+	int index = positionOf(handle);
+	T value(std::move(entries_[index].value));
+	releaseHandle(handle);
+	Entry last(std::move(entries_.back()));
+	entries_.pop_back();
+	if (index < size()) {
+		fill(index, std::move(last));
+	}
+	return value;
+}
+
+template<class T, int ARITY, class Compare>
+inline int AddressableHeap<T, ARITY, Compare>::positionOf(Handle handle) const
+{
+	if (!contains(handle)) {
+		throw InvalidHandleException();
+	}
+	return positions_[handle];
+}
+
+template<class T, int ARITY, class Compare>
+inline typename AddressableHeap<T, ARITY, Compare>::Handle AddressableHeap<T, ARITY, Compare>::acquireHandle()
+{
+	if (freeHandles_.empty()) {
+		positions_.push_back(-1);
+		return (Handle) positions_.size() - 1;
+	}
+	Handle handle = freeHandles_.back();
+	freeHandles_.pop_back();
+	return handle;
+}
+
+template<class T, int ARITY, class Compare>
+inline void AddressableHeap<T, ARITY, Compare>::releaseHandle(Handle handle)
+{
+	positions_[handle] = -1;
+	freeHandles_.push_back(handle);
+}
+
+template<class T, int ARITY, class Compare>
+inline void AddressableHeap<T, ARITY, Compare>::place(int index, Entry&& entry)
+{
+	positions_[entry.handle] = index;
+	entries_[index] = std::move(entry);
+}
+
+/**
+ * Fill a hole in the middle of the heap with an element which may belong either above or below it.
+ */
+template<class T, int ARITY, class Compare>
+void AddressableHeap<T, ARITY, Compare>::fill(int holeIndex, Entry&& entry)
+{
+	if (holeIndex > 0 && comparator()(entry.value, entries_[computeParentIndex(holeIndex)].value)) {
+		bubbleUp(holeIndex, std::move(entry));
+	} else {
+		bubbleDown(holeIndex, std::move(entry));
+	}
+}
+
+/**
+ * Move the parents of a hole down into it until entry can fill it.
+ */
+template<class T, int ARITY, class Compare>
+void AddressableHeap<T, ARITY, Compare>::bubbleUp(int holeIndex, Entry&& entry)
+{
+	while (holeIndex > 0) {
+		int parentIndex = computeParentIndex(holeIndex);
+		if (!comparator()(entry.value, entries_[parentIndex].value)) {
+			break;
+		}
+		place(holeIndex, std::move(entries_[parentIndex]));
+		holeIndex = parentIndex;
+	}
+	place(holeIndex, std::move(entry));
+}
+
+/**
+ * Move the top children of a hole up into it until entry can fill it.
+ */
+template<class T, int ARITY, class Compare>
+void AddressableHeap<T, ARITY, Compare>::bubbleDown(int holeIndex, Entry&& entry)
+{
+	int size = this->size();
+	while (true) {
+		int firstChildIndex = computeFirstChildIndex(holeIndex);
+		if (firstChildIndex >= size) {
+			break;
+		}
+		int firstGrandchildIndex = computeFirstChildIndex(firstChildIndex);
+		if (firstGrandchildIndex < size) {
+			Heap_private::prefetchGrandchildren<ARITY>(&entries_[firstGrandchildIndex]);
+		}
+		int topChildIndex = topChild(firstChildIndex, firstChildIndex + ARITY < size ? firstChildIndex + ARITY : size);
+		if (!comparator()(entries_[topChildIndex].value, entry.value)) {
+			break;
+		}
+		place(holeIndex, std::move(entries_[topChildIndex]));
+		holeIndex = topChildIndex;
+	}
+	place(holeIndex, std::move(entry));
+}
+
+/**
+ * Move the top child of a hole up into it, all the way down to a leaf, as Heap::sinkHole does.
+ * @return the leaf slot the hole ends up in
+ */
+template<class T, int ARITY, class Compare>
+int AddressableHeap<T, ARITY, Compare>::sinkHole(int holeIndex)
+{
+	int size = this->size();
+	int lastFullParentIndex = size > ARITY ? computeParentIndex(size - ARITY) : -1;
+	while (holeIndex <= lastFullParentIndex) {
+		int firstChildIndex = computeFirstChildIndex(holeIndex);
+		int firstGrandchildIndex = computeFirstChildIndex(firstChildIndex);
+		if (firstGrandchildIndex < size) {
+			Heap_private::prefetchGrandchildren<ARITY>(&entries_[firstGrandchildIndex]);
+		}
+		int topChildIndex = topChild(firstChildIndex, firstChildIndex + ARITY);
+		place(holeIndex, std::move(entries_[topChildIndex]));
+		holeIndex = topChildIndex;
+	}
+
+	int firstChildIndex = computeFirstChildIndex(holeIndex);
+	if (firstChildIndex < size) {
+		int topChildIndex = topChild(firstChildIndex, size);
+		place(holeIndex, std::move(entries_[topChildIndex]));
+		holeIndex = topChildIndex;
+	}
+	return holeIndex;
+}
+
+/**
+ * @return the index of the child with the highest priority, preferring the first of equals
+ */
+template<class T, int ARITY, class Compare>
+inline int AddressableHeap<T, ARITY, Compare>::topChild(int firstChildIndex, int endChildIndex) const
+{
+	int topChildIndex = firstChildIndex;
+	for (int i = firstChildIndex + 1; i < endChildIndex; i++) {
+		if (comparator()(entries_[i].value, entries_[topChildIndex].value)) {
+			topChildIndex = i;
+		}
+	}
+	return topChildIndex;
+}
+
+#endif
@@ -0,0 +1,191 @@
+#include "addressable_heap.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * A small deterministic generator, so that every run benchmarks the same graph.
+ */
+static unsigned long long nextRandom(unsigned long long& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+/**
+ * A directed graph in compressed sparse row form: the edges leaving node i are first[i] to first[i + 1] - 1.
+ */
+struct Graph
+{
+	std::vector<int> first;
+	std::vector<int> target;
+	std::vector<int> weight;
+
+	int nodes() const { return (int) first.size() - 1; }
+};
+
+/**
+ * A graph of n nodes with degree random edges leaving each. A cycle through every node keeps them all reachable.
+ */
+static Graph randomGraph(int n, int degree)
+{
+	Graph graph;
+	unsigned long long state = 88172645463325252ULL;
+	for (int i = 0; i < n; i++) {
+		graph.first.push_back((int) graph.target.size());
+		graph.target.push_back((i + 1) % n);
+		graph.weight.push_back(1000);
+		for (int e = 1; e < degree; e++) {
+			graph.target.push_back((int) (nextRandom(state) % n));
+			graph.weight.push_back((int) (nextRandom(state) % 1000) + 1);
+		}
+	}
+	graph.first.push_back((int) graph.target.size());
+	return graph;
+}
+
+struct Visit
+{
+	long distance;
+	int node;
+};
+
+struct Nearer
+{
+	bool operator()(const Visit& visit1, const Visit& visit2) const { return visit1.distance < visit2.distance; }
+};
+
+struct Counts
+{
+	long pushes;
+	long pops;
+	long decreases;
+	int peak;
+};
+
+/**
+ * Dijkstra's algorithm with a plain Heap: a shorter path pushes the node again, and the stale entries left behind are
+ * skipped when they are popped.
+ */
+template<int ARITY>
+static std::vector<long> lazyDijkstra(const Graph& graph, Counts& counts)
+{
+	std::vector<long> distances(graph.nodes(), -1);
+	std::vector<bool> settled(graph.nodes(), false);
+	Heap<Visit, ARITY, Nearer> heap;
+
+	Visit start = {0, 0};
+	distances[0] = 0;
+	heap.push(start);
+	counts.pushes++;
+	while (heap.size() > 0) {
+		if (heap.size() > counts.peak) {
+			counts.peak = heap.size();
+		}
+		Visit visit = heap.pop();
+		counts.pops++;
+		if (settled[visit.node]) {
+			continue;
+		}
+		settled[visit.node] = true;
+		for (int e = graph.first[visit.node]; e < graph.first[visit.node + 1]; e++) {
+			int target = graph.target[e];
+			long distance = visit.distance + graph.weight[e];
+			if (distances[target] < 0 || distance < distances[target]) {
+				distances[target] = distance;
+				Visit next = {distance, target};
+				heap.push(next);
+				counts.pushes++;
+			}
+		}
+	}
+	return distances;
+}
+
+/**
+ * Dijkstra's algorithm with an AddressableHeap: each node is queued at most once, and a shorter path decreases its key.
+ */
+template<int ARITY>
+static std::vector<long> addressableDijkstra(const Graph& graph, Counts& counts)
+{
+	typedef AddressableHeap<Visit, ARITY, Nearer> Queue;
+	const int UNSEEN = -1;
+	const int SETTLED = -2;
+
+	std::vector<long> distances(graph.nodes(), -1);
+	std::vector<typename Queue::Handle> handles(graph.nodes(), UNSEEN);
+	Queue heap;
+
+	Visit start = {0, 0};
+	distances[0] = 0;
+	handles[0] = heap.push(start);
+	counts.pushes++;
+	while (heap.size() > 0) {
+		if (heap.size() > counts.peak) {
+			counts.peak = heap.size();
+		}
+		Visit visit = heap.pop();
+		counts.pops++;
+		handles[visit.node] = SETTLED;
+		for (int e = graph.first[visit.node]; e < graph.first[visit.node + 1]; e++) {
+			int target = graph.target[e];
+			long distance = visit.distance + graph.weight[e];
+			if (handles[target] == UNSEEN) {
+				distances[target] = distance;
+				Visit next = {distance, target};
+				handles[target] = heap.push(next);
+				counts.pushes++;
+			} else if (handles[target] != SETTLED && distance < distances[target]) {
+				distances[target] = distance;
+				Visit next = {distance, target};
+				heap.decreaseKey(handles[target], next);
+				counts.decreases++;
+			}
+		}
+	}
+	return distances;
+}
+
+template<int ARITY>
+static void benchDijkstra(const Graph& graph)
+{
+	Counts lazy = {0, 0, 0, 0};
+	double start = now();
+	std::vector<long> lazyDistances = lazyDijkstra<ARITY>(graph, lazy);
+	double lazyDone = now();
+
+	Counts addressable = {0, 0, 0, 0};
+	std::vector<long> addressableDistances = addressableDijkstra<ARITY>(graph, addressable);
+	double addressableDone = now();
+
+	if (lazyDistances != addressableDistances) {
+		printf("arity %d: the two searches found different distances\n", ARITY);
+	}
+	printf("lazy,        arity %-2d %7.1f ms   pushes %9ld   pops %9ld   peak %9d\n", ARITY,
+		(lazyDone - start) * 1e3, lazy.pushes, lazy.pops, lazy.peak);
+	printf("addressable, arity %-2d %7.1f ms   pushes %9ld   pops %9ld   peak %9d   decreases %9ld\n", ARITY,
+		(addressableDone - lazyDone) * 1e3, addressable.pushes, addressable.pops, addressable.peak,
+		addressable.decreases);
+}
+
+int main(int argc, char** argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	for (int degree = 4; degree <= 16; degree *= 4) {
+		Graph graph = randomGraph(n, degree);
+		printf("n=%d, degree %d\n", n, degree);
+		benchDijkstra<2>(graph);
+		benchDijkstra<4>(graph);
+	}
+
+	return 0;
+}
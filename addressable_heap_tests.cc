@@ -0,0 +1,144 @@
+#include "addressable_heap.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct MinFunctor
+{
+	bool operator()(const int& value1, const int& value2) const
+	{
+		return value1 < value2;
+	}
+};
+
+TEST(AddressableHeapTest, PushAndPop)
+{
+	AddressableHeap<int> h;
+	const int data[] = {5, 8, 3, 2, 15, 1};
+	for (int i = 0; i < 6; i++) {
+		h.push(data[i]);
+	}
+	const int expected[] = {15, 8, 5, 3, 2, 1};
+	for (int i = 0; i < 6; i++) {
+		ASSERT_EQ(expected[i], h.pop());
+	}
+	ASSERT_EQ(0, h.size());
+	ASSERT_THROW(h.pop(), EmptyHeapException);
+}
+
+TEST(AddressableHeapTest, DecreaseAndIncreaseKey)
+{
+	AddressableHeap<int, 2, MinFunctor> h;
+	AddressableHeap<int, 2, MinFunctor>::Handle handles[10];
+	for (int i = 0; i < 10; i++) {
+		handles[i] = h.push(10 * (i + 1));
+	}
+
+	h.decreaseKey(handles[7], 5);
+	ASSERT_EQ(5, h.peek());
+	ASSERT_EQ(handles[7], h.peekHandle());
+	ASSERT_EQ(5, h.get(handles[7]));
+
+	h.increaseKey(handles[0], 55);
+	h.increaseKey(handles[7], 95);
+	const int expected[] = {20, 30, 40, 50, 55, 60, 70, 90, 95, 100};
+	for (int i = 0; i < 10; i++) {
+		ASSERT_EQ(expected[i], h.pop());
+	}
+}
+
+TEST(AddressableHeapTest, UpdateAndErase)
+{
+	AddressableHeap<int, 4> h;
+	std::vector<AddressableHeap<int, 4>::Handle> handles;
+	for (int i = 0; i < 20; i++) {
+		handles.push_back(h.push(i));
+	}
+
+	h.update(handles[3], 100);
+	h.update(handles[19], -1);
+	ASSERT_EQ(100, h.peek());
+
+	ASSERT_EQ(100, h.erase(handles[3]));
+	ASSERT_EQ(18, h.erase(handles[18]));
+	ASSERT_EQ(0, h.erase(handles[0]));
+	ASSERT_FALSE(h.contains(handles[0]));
+	ASSERT_THROW(h.erase(handles[0]), InvalidHandleException);
+	ASSERT_THROW(h.get(-1), InvalidHandleException);
+
+	const int expected[] = {17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 2, 1, -1};
+	ASSERT_EQ(17, h.size());
+	for (int i = 0; i < 17; i++) {
+		ASSERT_EQ(expected[i], h.pop());
+	}
+}
+
+TEST(AddressableHeapTest, HandlesAreReused)
+{
+	AddressableHeap<std::string> h;
+	AddressableHeap<std::string>::Handle apple = h.push("apple");
+	AddressableHeap<std::string>::Handle pear = h.push("pear");
+	ASSERT_EQ("pear", h.pop());
+	ASSERT_FALSE(h.contains(pear));
+
+	AddressableHeap<std::string>::Handle fig = h.push("fig");
+	ASSERT_EQ(pear, fig) << "Expected a freed handle to be handed out again";
+	ASSERT_EQ("fig", h.get(fig));
+	ASSERT_EQ("apple", h.get(apple));
+
+	ASSERT_THROW(h.emplace(std::string::npos, 'x'), std::length_error);
+	ASSERT_EQ(2, h.size());
+	AddressableHeap<std::string>::Handle kiwi = h.push("kiwi");
+	ASSERT_EQ(2, kiwi) << "Expected the handle taken by an element which failed to construct to be handed out again";
+}
+
+TEST(AddressableHeapTest, RandomOperations)
+{
+	// Check every operation against a map from handle to value, across arities and sizes.
+	AddressableHeap<int, 3, MinFunctor> h;
+	std::map<int, int> model;
+	unsigned int state = 12345;
+	for (int step = 0; step < 20000; step++) {
+		state = state * 1103515245 + 12345;
+		int r = (state >> 8) % 100;
+		int value = (state >> 16) % 1000;
+		if (model.empty() || r < 40) {
+			model[h.push(value)] = value;
+		} else {
+			std::map<int, int>::iterator it = model.begin();
+			std::advance(it, (state >> 4) % model.size());
+			if (r < 55) {
+				if (value <= it->second) {
+					h.decreaseKey(it->first, value);
+				} else {
+					h.increaseKey(it->first, value);
+				}
+				it->second = value;
+			} else if (r < 70) {
+				h.update(it->first, value);
+				it->second = value;
+			} else if (r < 85) {
+				ASSERT_EQ(it->second, h.erase(it->first));
+				model.erase(it);
+			} else {
+				int smallest = model.begin()->second;
+				for (it = model.begin(); it != model.end(); ++it) {
+					smallest = std::min(smallest, it->second);
+				}
+				int handle = h.peekHandle();
+				ASSERT_EQ(smallest, model[handle]);
+				ASSERT_EQ(smallest, h.pop());
+				model.erase(handle);
+			}
+		}
+		ASSERT_EQ((int) model.size(), h.size());
+	}
+
+	for (std::map<int, int>::iterator it = model.begin(); it != model.end(); ++it) {
+		ASSERT_EQ(it->second, h.get(it->first));
+	}
+}
@@ -1,11 +1,72 @@
+#ifndef BTREE_H
+#define BTREE_H
+
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 #include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if !defined(BTREE_NO_SIMD) && defined(__SSE2__)
+#define BTREE_SIMD_SEARCH
+#include <immintrin.h>
+#endif
 
 #define DEFAULT_PAGE_SIZE 16
 
+/**
+ * Marks the page types, whose accesses are then left out of type-based alias analysis. This works around a GCC 12
+ * miscompilation. A leaf and an index hold pages of different types at the same offset, and PRE merges the loads that
+ * the two sides of a leaf/index dispatch make from them, keeping the access path of only one page type. IPA modref
+ * then finds that the out-of-line functions of the other page type cannot write to it, so a value such as the page
+ * size read before a borrow is reused after it. -fno-ipa-modref, -fno-tree-pre and -fno-strict-aliasing avoid it as
+ * well. Seen with GCC 12.2; the commit adding this macro carries a reduced test case.
+ */
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ == 12
+#define BTREE_PAGE_ALIAS __attribute__((may_alias))
+#else
+#define BTREE_PAGE_ALIAS
+#endif
+
 namespace BTree_private
 {
+	/**
+	 * Slot returned by Page member functions when there is no element to refer to (e.g., past the last element).
+	 */
+	const int PAGE_END = -1;
+
+	/**
+	 * A marker slot retuned by Page member functions to indicate that the page is full.
+	 */
+	const int PAGE_FULL = -2;
+
+	/**
+	 * The most bytes of a node prefetched ahead of a batched lookup visiting it.
+	 */
+	const size_t PREFETCH_BYTES = 512;
+
+	/**
+	 * Ask for the first bytes of an object to be brought into cache, without waiting for them.
+	 */
+	inline void prefetch(const void* p, size_t bytes)
+	{
+		if (bytes > PREFETCH_BYTES) {
+			bytes = PREFETCH_BYTES;
+		}
+		const char* c = static_cast<const char*>(p);
+		for (size_t offset = 0; offset < bytes; offset += 64) {
+			__builtin_prefetch(c + offset);
+		}
+	}
+
 	/**
 	 * A basic doubly-linked storage element which holds a key and corresponding value. Page data is stored in Elements.
 	 * @tparam K type of the key
@@ -14,30 +75,24 @@ namespace BTree_private
 	template<class K, class V>
 	struct BTree_Element
 	{
-		static BTree_Element* const FULL;
-
 		BTree_Element* prev;
 		BTree_Element* next;
 		K key;
 		V value;
 	};
 
-	/**
-	 * A marker element retuned by Page member functions to indicate that the page is full.
-	 */
-	template<class K, class V>
-	BTree_Element<K, V>* const BTree_Element<K, V>::FULL = (BTree_Element<K, V>*) 1;
-
 	/**
 	 * A doubly-linked key-value store. The storage elements are statically allocated within the page. The elements are
 	 * stored in order of increasing key. Pages are used in the BTree to store both data (in Leaves) and pointers to
 	 * other pages (in Indexes).
+	 *
+	 * Elements are addressed by slot: an integer which stays valid until the element is removed or the page is split.
 	 * @tparam K the type of key the elements in the page will be associated with
 	 * @tparam V the type of value stored in the page
 	 * @tparam PAGE_SIZE the number of elements stored within the page
 	 */
 	template<class K, class V, int PAGE_SIZE>
-	class BTree_Page
+	class BTREE_PAGE_ALIAS BTree_Page
 	{
 	private:
 		typedef BTree_Element<K, V> Element;
@@ -59,6 +114,29 @@ namespace BTree_private
 		 */
 		Element data_[PAGE_SIZE];
 
+		int slot(const Element* e) const
+		{
+			return e == 0 ? PAGE_END : e - data_;
+		}
+
+		/**
+		 * Find the element after which the given key should be inserted. If the key is less than the smallest key in
+		 * the list, returns 0.
+		 * @param key the key to be inserted
+		 * @return the element after which given key should be inserted, or 0 if it should be inserted before the first
+		 */
+		Element* findInsertElement(const K& key) const
+		{
+			if (first_ == 0 || key < first_->key) {
+				return 0;
+			}
+			Element *i = first_;
+			while (i->next != 0 && i->next->key <= key) {
+				i = i->next;
+			}
+			return i;
+		}
+
 	public:
 		/**
 		 * Page constructor. Initialises the free list to contain all the elements.
@@ -77,38 +155,89 @@ namespace BTree_private
 		}
 
 		/**
-		 * @return the first data-holding element (the one with the lowest key)
+		 * @return the slot of the first data-holding element (the one with the lowest key), or PAGE_END
+		 */
+		int first() const
+		{
+			return slot(first_);
+		}
+
+		/**
+		 * @return the slot of the last data-holding element (the one with the highest key), or PAGE_END
+		 */
+		int last() const
+		{
+			Element* e = first_;
+			while (e != 0 && e->next != 0) {
+				e = e->next;
+			}
+			return slot(e);
+		}
+
+		/**
+		 * @return the slot of the element following the given one, or PAGE_END
+		 */
+		int next(int s) const
+		{
+			return slot(data_[s].next);
+		}
+
+		/**
+		 * @return the slot of the element preceding the given one, or PAGE_END
+		 */
+		int prev(int s) const
+		{
+			return slot(data_[s].prev);
+		}
+
+		const K& key(int s) const
+		{
+			return data_[s].key;
+		}
+
+		/**
+		 * Replace the key held in a slot. The new key must keep the page in order.
 		 */
-		Element* first() const
+		void setKey(int s, const K& key)
+		{
+			data_[s].key = key;
+		}
+
+		V& value(int s)
+		{
+			return data_[s].value;
+		}
+
+		const V& value(int s) const
 		{
-			return first_;
+			return data_[s].value;
 		}
 
 		/**
 		 * Locate an element with the given key.
 		 * @param key the key to search on
-		 * @return an element containing the key, or 0 if there is none
+		 * @return the slot of an element containing the key, or PAGE_END if there is none
 		 */
-		Element* find(const K& key) const
+		int find(const K& key) const
 		{
 			for (Element* e = first_; e != 0; e = e->next) {
 				if (e->key == key) {
-					return e;
+					return slot(e);
 				}
 			}
-			return 0;
+			return PAGE_END;
 		}
 
 		/**
 		 * Assign an element to hold a value associated with the given key, and insert it into the linked list at the
 		 * correct position.
 		 * @param key the key with which the value will be associated
-		 * @return the element which will hold the value
+		 * @return the slot of the element which will hold the value, or PAGE_FULL
 		 */
-		Element* insert(const K& key)
+		int insert(const K& key)
 		{
 			if (size_ == PAGE_SIZE) {
-				return Element::FULL;
+				return PAGE_FULL;
 			}
 			++size_;
 
@@ -117,7 +246,7 @@ namespace BTree_private
 
 			e->key = key;
 
-			Element* i = findInsertPos(key);
+			Element* i = findInsertElement(key);
 			if (i == 0) {
 				e->next = first_;
 				if (first_ != 0) {
@@ -125,7 +254,6 @@ namespace BTree_private
 				}
 				e->prev = 0;
 				first_ = e;
-				return e;
 			} else {
 				e->prev = i;
 				if (i->next != 0) {
@@ -133,41 +261,56 @@ namespace BTree_private
 				}
 				e->next = i->next;
 				i->next = e;
-				return e;
 			}
+			return slot(e);
 		}
 
 		/**
 		 * Find the element after which the given key should be inserted. If the key is less than the smallest key in
-		 * the list, returns 0.
+		 * the list, returns PAGE_END.
 		 * @param key the key to be inserted
-		 * @return the element after which given key should be inserted, or 0 if it should be inserted before the first
+		 * @return the slot after which given key should be inserted, or PAGE_END if it should be inserted first
 		 */
-		Element* findInsertPos(const K& key) const
+		int findInsertPos(const K& key) const
 		{
-			if (first_ == 0 || key < first_->key) {
-				return 0;
-			}
-			Element *i = first_;
-			while (i->next != 0 && i->next->key <= key) {
-				i = i->next;
-			}
-			return i;
+			return slot(findInsertElement(key));
 		}
 
 		/**
 		 * Search for an element with the given key; if found, return it, otherwise insert a new element, and return
 		 * that instead.
 		 * @param key the key to find or insert
-		 * @return an element associated with the key
+		 * @return the slot of an element associated with the key, or PAGE_FULL
 		 */
-		Element* findOrInsert(const K& key)
+		int findOrInsert(const K& key)
 		{
-			Element* e = find(key);
-			if (e == 0) {
-				e = insert(key);
+			int s = find(key);
+			if (s == PAGE_END) {
+				s = insert(key);
+			}
+			return s;
+		}
+
+		/**
+		 * Remove the element held in the given slot.
+		 */
+		void removeAt(int s)
+		{
+			Element* e = &data_[s];
+			if (e->prev == 0) {
+				first_ = e->next;
+				if (first_ != 0) {
+					first_->prev = 0;
+				}
+			} else {
+				e->prev->next = e->next;
+				if (e->next != 0) {
+					e->next->prev = e->prev;
+				}
 			}
-			return e;
+			e->next = free_;
+			free_ = e;
+			size_--;
 		}
 
 		/**
@@ -176,59 +319,45 @@ namespace BTree_private
 		 */
 		void remove(const K& key)
 		{
-			for (Element* e = first_; e != 0; e = e->next) {
-				if (e->key == key) {
-					if (e->prev == 0) {
-						first_ = e->next;
-						if (first_ != 0) {
-							first_->prev = 0;
-						}
-					} else {
-						e->prev->next = e->next;
-						if (e->next != 0) {
-							e->next->prev = e->prev;
-						}
-					}
-					e->next = free_;
-					free_ = e;
-					size_--;
-					return;
-				}
+			int s = find(key);
+			if (s != PAGE_END) {
+				removeAt(s);
 			}
 		}
 
 		/**
-		 * Remove PAGE_SIZE/2 elements from this page and insert them into the given page.
+		 * Remove the elements after the first keep elements from this page and insert them into the given page.
 		 * @param newPage the page into which the removed elements should be inserted
+		 * @param keep the number of elements to leave in this page, at least 1 and less than the number it holds
 		 */
-		void split(BTree_Page& newPage)
+		void split(BTree_Page& newPage, int keep)
 		{
-			assert(size_ == PAGE_SIZE);
+			assert(keep > 0 && keep < size_);
 
 			Element* firstToRemove = this->first_;
-			for (int i = 0; i < PAGE_SIZE/2; ++i) {
+			for (int i = 0; i < keep; ++i) {
 				firstToRemove = firstToRemove->next;
 			}
 			firstToRemove->prev->next = 0;
 
 			Element* lastToRemove;
 			for (Element *e = firstToRemove; e != 0; e = e->next) {
-				Element* newElement = newPage.insert(e->key);
-				newElement->value = e->value;
+				int s = newPage.insert(e->key);
+				newPage.value(s) = e->value;
 				lastToRemove = e;
 			}
 
 			lastToRemove->next = this->free_;
 			free_ = firstToRemove;
-			size_ = PAGE_SIZE/2;
+			size_ = keep;
 		}
 
 		void addAll(BTree_Page& page)
 		{
 			Element* e = page.first_;
 			while (e != 0) {
-				Element* newElement = insert(e->key);
-				newElement->value = e->value;
+				int s = insert(e->key);
+				value(s) = e->value;
 				e = e->next;
 			}
 		}
@@ -236,8 +365,8 @@ namespace BTree_private
 		void borrow(BTree_Page& page)
 		{
 			Element* e = page.first_;
-			Element* newElement = insert(e->key);
-			newElement->value = e->value;
+			int s = insert(e->key);
+			value(s) = e->value;
 			page.remove(e->key);
 		}
 
@@ -263,394 +392,3057 @@ namespace BTree_private
 		}
 	};
 
-	template<class K, class V, int PAGE_SIZE>
-	class BTree_Node
+	/**
+	 * Shift the objects between indexes 'to' and 'from' one place towards 'from'. The object at 'from' is overwritten,
+	 * and the one at 'to' is left moved-from, ready to be reused. Trivially copyable objects are shifted with memmove;
+	 * others by move assignment, so no objects are constructed or destroyed.
+	 */
+	template<class T>
+	void shiftElements(T* data, int from, int to)
 	{
-	private:
-		typedef BTree_Element<K, V> Element;
+		if (from == to) {
+			return;
+		}
+		if (std::is_trivially_copyable<T>::value) {
+			if (from < to) {
+				memmove((void*) &data[from], (void*) &data[from + 1], (to - from) * sizeof(T));
+			} else {
+				memmove((void*) &data[to + 1], (void*) &data[to], (from - to) * sizeof(T));
+			}
+		} else if (from < to) {
+			std::move(&data[from + 1], &data[to + 1], &data[from]);
+		} else {
+			std::move_backward(&data[to], &data[from], &data[from + 1]);
+		}
+	}
 
-	public:
-		virtual ~BTree_Node() {}
+	/**
+	 * Move a run of objects into another, non-overlapping run, leaving the source objects moved-from.
+	 */
+	template<class T>
+	void moveElements(T* from, T* to, int count)
+	{
+		if (std::is_trivially_copyable<T>::value) {
+			memcpy((void*) to, (void*) from, count * sizeof(T));
+		} else {
+			std::move(from, from + count, to);
+		}
+	}
+
+	/**
+	 * Search over a packed array of sorted keys. This generic version is a binary search; integral and floating-point
+	 * keys have vectorised specializations below, unless BTREE_NO_SIMD is defined.
+	 * @tparam K the type of the keys
+	 */
+	template<class K>
+	struct BTree_KeySearch
+	{
+		/**
+		 * @return the index of the first key which is greater than the given key
+		 */
+		static int upperBound(const K* keys, int size, const K& key)
+		{
+			int lo = 0;
+			int hi = size;
+			while (lo < hi) {
+				int mid = (lo + hi) / 2;
+				if (key < keys[mid]) {
+					hi = mid;
+				} else {
+					lo = mid + 1;
+				}
+			}
+			return lo;
+		}
+	};
 
-		virtual Element* find(const K& key) const = 0;
+#ifdef BTREE_SIMD_SEARCH
+	/**
+	 * Number of keys below which a vectorised search counts across the whole remaining range instead of halving it.
+	 */
+	const int SIMD_SCAN_WIDTH = 32;
 
-		virtual Element* findOrInsert(const K& key) = 0;
+	/**
+	 * Key search which narrows the range by binary search, then counts the keys not greater than the search key with
+	 * a branch-free vector kernel. Since the keys are sorted, that count is the upper bound.
+	 * @tparam K the type of the keys
+	 * @tparam Kernel provides countNotGreater(keys, n, key) for K
+	 */
+	template<class K, class Kernel>
+	struct BTree_VectorSearch
+	{
+		static int upperBound(const K* keys, int size, const K& key)
+		{
+			int lo = 0;
+			int hi = size;
+			while (hi - lo > SIMD_SCAN_WIDTH) {
+				int mid = (lo + hi) / 2;
+				if (key < keys[mid]) {
+					hi = mid;
+				} else {
+					lo = mid + 1;
+				}
+			}
+			return lo + Kernel::countNotGreater(keys + lo, hi - lo, key);
+		}
+	};
 
-		virtual void remove(const K& key) = 0;
+	/**
+	 * Counting kernel for 32-bit integers. Unsigned keys are compared as signed after flipping the top bit.
+	 */
+	template<class T>
+	struct BTree_Int32Kernel
+	{
+		static int countNotGreater(const T* keys, int n, T key)
+		{
+			const bool flip = (T) -1 > 0;
+			const int32_t bias = flip ? INT32_MIN : 0;
+			int greater = 0;
+			int i = 0;
+#ifdef __AVX2__
+			__m256i bias8 = _mm256_set1_epi32(bias);
+			__m256i key8 = _mm256_xor_si256(_mm256_set1_epi32((int32_t) key), bias8);
+			for (; i + 8 <= n; i += 8) {
+				__m256i v = _mm256_loadu_si256((const __m256i*) (keys + i));
+				if (flip) {
+					v = _mm256_xor_si256(v, bias8);
+				}
+				__m256i gt = _mm256_cmpgt_epi32(v, key8);
+				greater += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(gt)));
+			}
+#endif
+			__m128i bias4 = _mm_set1_epi32(bias);
+			__m128i key4 = _mm_xor_si128(_mm_set1_epi32((int32_t) key), bias4);
+			for (; i + 4 <= n; i += 4) {
+				__m128i v = _mm_loadu_si128((const __m128i*) (keys + i));
+				if (flip) {
+					v = _mm_xor_si128(v, bias4);
+				}
+				__m128i gt = _mm_cmpgt_epi32(v, key4);
+				greater += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(gt)));
+			}
+			for (; i < n; ++i) {
+				greater += keys[i] > key;
+			}
+			return n - greater;
+		}
+	};
 
-		virtual Element* first() const = 0;
+	/**
+	 * Counting kernel for 64-bit integers. Needs AVX2 or SSE4.2 for the 64-bit compare; scalar otherwise.
+	 */
+	template<class T>
+	struct BTree_Int64Kernel
+	{
+		static int countNotGreater(const T* keys, int n, T key)
+		{
+			const bool flip = (T) -1 > 0;
+			const int64_t bias = flip ? INT64_MIN : 0;
+			int greater = 0;
+			int i = 0;
+#ifdef __AVX2__
+			__m256i bias4 = _mm256_set1_epi64x(bias);
+			__m256i key4 = _mm256_xor_si256(_mm256_set1_epi64x((int64_t) key), bias4);
+			for (; i + 4 <= n; i += 4) {
+				__m256i v = _mm256_loadu_si256((const __m256i*) (keys + i));
+				if (flip) {
+					v = _mm256_xor_si256(v, bias4);
+				}
+				__m256i gt = _mm256_cmpgt_epi64(v, key4);
+				greater += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(gt)));
+			}
+#endif
+#ifdef __SSE4_2__
+			__m128i bias2 = _mm_set1_epi64x(bias);
+			__m128i key2 = _mm_xor_si128(_mm_set1_epi64x((int64_t) key), bias2);
+			for (; i + 2 <= n; i += 2) {
+				__m128i v = _mm_loadu_si128((const __m128i*) (keys + i));
+				if (flip) {
+					v = _mm_xor_si128(v, bias2);
+				}
+				__m128i gt = _mm_cmpgt_epi64(v, key2);
+				greater += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(gt)));
+			}
+#endif
+			(void) bias;
+			for (; i < n; ++i) {
+				greater += keys[i] > key;
+			}
+			return n - greater;
+		}
+	};
 
-		virtual BTree_Node* split() = 0;
+	struct BTree_FloatKernel
+	{
+		static int countNotGreater(const float* keys, int n, float key)
+		{
+			int greater = 0;
+			int i = 0;
+#ifdef __AVX__
+			__m256 key8 = _mm256_set1_ps(key);
+			for (; i + 8 <= n; i += 8) {
+				__m256 gt = _mm256_cmp_ps(_mm256_loadu_ps(keys + i), key8, _CMP_GT_OQ);
+				greater += __builtin_popcount(_mm256_movemask_ps(gt));
+			}
+#endif
+			__m128 key4 = _mm_set1_ps(key);
+			for (; i + 4 <= n; i += 4) {
+				__m128 gt = _mm_cmpgt_ps(_mm_loadu_ps(keys + i), key4);
+				greater += __builtin_popcount(_mm_movemask_ps(gt));
+			}
+			for (; i < n; ++i) {
+				greater += keys[i] > key;
+			}
+			return n - greater;
+		}
+	};
 
-		virtual void merge(BTree_Node* node) = 0;
+	struct BTree_DoubleKernel
+	{
+		static int countNotGreater(const double* keys, int n, double key)
+		{
+			int greater = 0;
+			int i = 0;
+#ifdef __AVX__
+			__m256d key4 = _mm256_set1_pd(key);
+			for (; i + 4 <= n; i += 4) {
+				__m256d gt = _mm256_cmp_pd(_mm256_loadu_pd(keys + i), key4, _CMP_GT_OQ);
+				greater += __builtin_popcount(_mm256_movemask_pd(gt));
+			}
+#endif
+			__m128d key2 = _mm_set1_pd(key);
+			for (; i + 2 <= n; i += 2) {
+				__m128d gt = _mm_cmpgt_pd(_mm_loadu_pd(keys + i), key2);
+				greater += __builtin_popcount(_mm_movemask_pd(gt));
+			}
+			for (; i < n; ++i) {
+				greater += keys[i] > key;
+			}
+			return n - greater;
+		}
+	};
 
-		virtual void borrow(BTree_Node* node) = 0;
+	template<>
+	struct BTree_KeySearch<int32_t> : BTree_VectorSearch<int32_t, BTree_Int32Kernel<int32_t> > {};
 
-		virtual void print(int indent) const = 0;
+	template<>
+	struct BTree_KeySearch<uint32_t> : BTree_VectorSearch<uint32_t, BTree_Int32Kernel<uint32_t> > {};
 
-		virtual int depth() const = 0;
+	template<>
+	struct BTree_KeySearch<int64_t> : BTree_VectorSearch<int64_t, BTree_Int64Kernel<int64_t> > {};
 
-		/**
-		 * The number of elements stored in *this* node. For indexes, this is the number of child nodes. For leaves,
-		 * the number of data elements.
-		 */
-		virtual int count() const = 0;
+	template<>
+	struct BTree_KeySearch<uint64_t> : BTree_VectorSearch<uint64_t, BTree_Int64Kernel<uint64_t> > {};
 
-		/**
-		 * Used to reduce the height of the tree when enough elements are removed from it. If this function returns a
-		 * value, it means that this node has a single child, which can be a replacement for the node itself.
-		 */
-		virtual BTree_Node* replaceChild() = 0;
+	template<>
+	struct BTree_KeySearch<float> : BTree_VectorSearch<float, BTree_FloatKernel> {};
 
-		virtual bool valid(int depth) const = 0;
-	};
+	template<>
+	struct BTree_KeySearch<double> : BTree_VectorSearch<double, BTree_DoubleKernel> {};
+#endif
 
+	/**
+	 * A key-value store which keeps its elements in a contiguous array sorted by key. Lookups use binary search, and
+	 * insertions and removals shift the tail of the array, with memmove when the keys and values are trivially
+	 * copyable and by move assignment otherwise. Elements carry no link pointers, so more of them fit in each cache
+	 * line than in a BTree_Page.
+	 *
+	 * A slot is only valid until the next insertion or removal.
+	 * @tparam K the type of key the elements in the page will be associated with
+	 * @tparam V the type of value stored in the page
+	 * @tparam PAGE_SIZE the number of elements stored within the page
+	 */
 	template<class K, class V, int PAGE_SIZE>
-	class Leaf : public BTree_Node<K, V, PAGE_SIZE>
+	class BTREE_PAGE_ALIAS BTree_ArrayPage
 	{
 	private:
-		typedef BTree_Element<K, V> Element;
-		typedef BTree_Page<K, V, PAGE_SIZE> Page;
-		typedef BTree_Node<K, V, PAGE_SIZE> Node;
+		struct Element
+		{
+			K key;
+			V value;
+		};
 
-		Page page;
+		/**
+		 * The number of elements holding data within the page. These are stored in data_[0, size_).
+		 */
+		int size_;
+		/**
+		 * The elements of the page. Those past size_ are free.
+		 */
+		Element data_[PAGE_SIZE];
 
-	public:
-		Element* find(const K& key) const
+		/**
+		 * @return the index of the first element whose key is greater than the given key
+		 */
+		int upperBound(const K& key) const
 		{
-			return page.find(key);
+			int lo = 0;
+			int hi = size_;
+			while (lo < hi) {
+				int mid = (lo + hi) / 2;
+				if (key < data_[mid].key) {
+					hi = mid;
+				} else {
+					lo = mid + 1;
+				}
+			}
+			return lo;
 		}
 
-		Element* findOrInsert(const K& key)
+	public:
+		BTree_ArrayPage()
 		{
-			return page.findOrInsert(key);
+			size_ = 0;
 		}
 
-		void remove(const K& key)
+		int first() const
 		{
-			page.remove(key);
+			return size_ == 0 ? PAGE_END : 0;
 		}
 
-		Element* first() const
+		int last() const
 		{
-			return page.first();
+			return size_ - 1;
 		}
 
-		Leaf* split()
+		int next(int s) const
 		{
-			Leaf* newLeaf = new Leaf;
-			page.split(newLeaf->page);
-			return newLeaf;
+			return s + 1 < size_ ? s + 1 : PAGE_END;
 		}
 
-		void merge(Node* node)
+		int prev(int s) const
 		{
-			Leaf* leaf = static_cast<Leaf*>(node);
-			page.addAll(leaf->page);
+			return s > 0 ? s - 1 : PAGE_END;
 		}
 
-		void borrow(Node* node)
+		const K& key(int s) const
 		{
-			Leaf* leaf = static_cast<Leaf*>(node);
-			page.borrow(leaf->page);
+			return data_[s].key;
 		}
 
-		void print(int indent) const
+		void setKey(int s, const K& key)
 		{
-			const Element* e = page.first();
-			while (e != 0) {
-				for (int i = 0; i < indent; ++i) {
-					std::cout << "  ";
-				}
-				std::cout << e->key << ": (value)" << std::endl;
-				e = e->next;
-			}
+			data_[s].key = key;
 		}
 
-		int depth() const
+		V& value(int s)
 		{
-			return 1;
+			return data_[s].value;
 		}
 
-		int count() const
+		const V& value(int s) const
 		{
-			return page.size();
+			return data_[s].value;
 		}
 
-		Node* replaceChild()
+		int find(const K& key) const
 		{
-			// Leaves have no children - they cannot be replaced
-			return 0;
+			int s = findInsertPos(key);
+			if (s != PAGE_END && data_[s].key == key) {
+				return s;
+			}
+			return PAGE_END;
 		}
 
-		bool valid(int depth) const
+		int insert(const K& key)
 		{
-			return depth == 0 || page.valid();
+			if (size_ == PAGE_SIZE) {
+				return PAGE_FULL;
+			}
+			int s = upperBound(key);
+			shiftElements(data_, size_, s);
+			++size_;
+			data_[s].key = key;
+			return s;
 		}
-	};
-
-	template<class K, class V, int PAGE_SIZE>
-	class Index : public BTree_Node<K, V, PAGE_SIZE>
-	{
-	private:
-		typedef BTree_Page<K, BTree_Node<K, V, PAGE_SIZE>*, PAGE_SIZE> Page;
-		typedef BTree_Element<K, BTree_Node<K, V, PAGE_SIZE>*> NodeElement;
-
-		typedef BTree_Node<K, V, PAGE_SIZE> Node;
-		typedef BTree_Element<K, V> Element;
 
-		Page page;
-
-	public:
-		~Index()
+		int findInsertPos(const K& key) const
 		{
-			for (NodeElement* e = page.first(); e != 0; e = e->next) {
-				delete e->value;
-			}
+			return upperBound(key) - 1;
 		}
 
-		Element* find(const K& key) const
+		int findOrInsert(const K& key)
 		{
-			NodeElement *el = page.findInsertPos(key);
-			if (el == 0) {
-				el = page.first();
+			int s = find(key);
+			if (s == PAGE_END) {
+				s = insert(key);
 			}
-			return el->value->find(key);
+			return s;
 		}
 
-		Element* findOrInsert(const K& key)
+		void removeAt(int s)
 		{
-			NodeElement* el = page.findInsertPos(key);
-			if (el == 0) {
-				el = page.first();
-			}
-			Node* node = el->value;
-			Element* e = node->findOrInsert(key);
-			if (e == Element::FULL) {
-				if (page.full()) {
-					return Element::FULL;
-				} else {
-					Node* newNode = node->split();
-					page.insert(newNode->first()->key)->value = newNode;
-					e = findOrInsert(key);
-				}
-			}
-			if (key < el->key) {
-				el->key = key;
-			}
-			return e;
+			--size_;
+			shiftElements(data_, s, size_);
 		}
 
 		void remove(const K& key)
 		{
-			NodeElement* el = page.findInsertPos(key);
-			if (el != 0) {
-				Node* node = el->value;
-				node->remove(key);
-				if (node->count() < PAGE_SIZE/2) {
-					if (el->next != 0) {
-						Node* toMerge = el->next->value;
-						if (toMerge->count() > PAGE_SIZE/2) {
-							node->borrow(toMerge);
-							el->next->key = toMerge->first()->key;
-						} else {
-							page.remove(el->next->key);
-							node->merge(toMerge);
-							delete toMerge;
-						}
-					} else if (el->prev != 0) {
-						Node* toMerge = el->prev->value;
-						if (toMerge->count() > PAGE_SIZE/2) {
-							node->borrow(toMerge);
-							el->prev->key = toMerge->first()->key;
-							el->key = node->first()->key;
-						} else {
-							page.remove(el->key);
-							toMerge->merge(node);
-							delete node;
-						}
-					}
-				}
+			int s = find(key);
+			if (s != PAGE_END) {
+				removeAt(s);
 			}
 		}
 
-		Element* first() const
+		/**
+		 * Move the elements after the first keep elements from this page into the given empty page.
+		 */
+		void split(BTree_ArrayPage& newPage, int keep)
 		{
-			return page.first()->value->first();
+			assert(newPage.size_ == 0);
+			assert(keep > 0 && keep < size_);
+
+			int toMove = size_ - keep;
+			moveElements(&data_[keep], newPage.data_, toMove);
+			newPage.size_ = toMove;
+			size_ = keep;
 		}
 
-		Index* split()
+		void addAll(BTree_ArrayPage& page)
 		{
-			Index* newIndex = new Index;
-			page.split(newIndex->page);
-			return newIndex;
+			for (int i = 0; i < page.size_; ++i) {
+				int s = insert(page.data_[i].key);
+				value(s) = page.data_[i].value;
+			}
 		}
 
-		void merge(Node*)
+		void borrow(BTree_ArrayPage& page)
 		{
-
+			int s = insert(page.data_[0].key);
+			value(s) = page.data_[0].value;
+			page.removeAt(0);
 		}
 
-		void borrow(Node*)
+		bool full() const
 		{
-
+			return size_ == PAGE_SIZE;
 		}
 
-		void addPage(Node* p)
+		int size() const
 		{
-			NodeElement* el = page.insert(p->first()->key);
-			el->value = p;
+			return size_;
 		}
 
-		void print(int indent) const
+		bool valid() const
 		{
-			NodeElement* ie = page.first();
-			while (ie != 0) {
-				for (int i = 0; i < indent; i++) {
+			return size_ >= PAGE_SIZE/2 && size_ <= PAGE_SIZE;
+		}
+	};
+
+	/**
+	 * A key-value store which keeps the keys of the page packed together in one sorted array, and the values in a
+	 * parallel array. Searching a page only touches the cache lines holding keys, however large the values are.
+	 *
+	 * As in BTree_ArrayPage, the columns are shifted with memmove only when they are trivially copyable, and a slot is
+	 * only valid until the next insertion or removal.
+	 * @tparam K the type of key the elements in the page will be associated with
+	 * @tparam V the type of value stored in the page
+	 * @tparam PAGE_SIZE the number of elements stored within the page
+	 */
+	template<class K, class V, int PAGE_SIZE>
+	class BTREE_PAGE_ALIAS BTree_ColumnPage
+	{
+	private:
+		/**
+		 * The number of elements holding data within the page. These are stored in [0, size_) of each array.
+		 */
+		int size_;
+		/**
+		 * The keys of the page, in increasing order.
+		 */
+		K keys_[PAGE_SIZE];
+		/**
+		 * The values of the page. values_[i] is associated with keys_[i].
+		 */
+		V values_[PAGE_SIZE];
+
+		int upperBound(const K& key) const
+		{
+			return BTree_KeySearch<K>::upperBound(keys_, size_, key);
+		}
+
+	public:
+		BTree_ColumnPage()
+		{
+			size_ = 0;
+		}
+
+		int first() const
+		{
+			return size_ == 0 ? PAGE_END : 0;
+		}
+
+		int last() const
+		{
+			return size_ - 1;
+		}
+
+		int next(int s) const
+		{
+			return s + 1 < size_ ? s + 1 : PAGE_END;
+		}
+
+		int prev(int s) const
+		{
+			return s > 0 ? s - 1 : PAGE_END;
+		}
+
+		const K& key(int s) const
+		{
+			return keys_[s];
+		}
+
+		void setKey(int s, const K& key)
+		{
+			keys_[s] = key;
+		}
+
+		V& value(int s)
+		{
+			return values_[s];
+		}
+
+		const V& value(int s) const
+		{
+			return values_[s];
+		}
+
+		int find(const K& key) const
+		{
+			int s = findInsertPos(key);
+			if (s != PAGE_END && keys_[s] == key) {
+				return s;
+			}
+			return PAGE_END;
+		}
+
+		int insert(const K& key)
+		{
+			if (size_ == PAGE_SIZE) {
+				return PAGE_FULL;
+			}
+			int s = upperBound(key);
+			shiftElements(keys_, size_, s);
+			shiftElements(values_, size_, s);
+			++size_;
+			keys_[s] = key;
+			return s;
+		}
+
+		int findInsertPos(const K& key) const
+		{
+			return upperBound(key) - 1;
+		}
+
+		int findOrInsert(const K& key)
+		{
+			int s = find(key);
+			if (s == PAGE_END) {
+				s = insert(key);
+			}
+			return s;
+		}
+
+		void removeAt(int s)
+		{
+			--size_;
+			shiftElements(keys_, s, size_);
+			shiftElements(values_, s, size_);
+		}
+
+		void remove(const K& key)
+		{
+			int s = find(key);
+			if (s != PAGE_END) {
+				removeAt(s);
+			}
+		}
+
+		/**
+		 * Move the elements after the first keep elements from this page into the given empty page.
+		 */
+		void split(BTree_ColumnPage& newPage, int keep)
+		{
+			assert(newPage.size_ == 0);
+			assert(keep > 0 && keep < size_);
+
+			int toMove = size_ - keep;
+			moveElements(&keys_[keep], newPage.keys_, toMove);
+			moveElements(&values_[keep], newPage.values_, toMove);
+			newPage.size_ = toMove;
+			size_ = keep;
+		}
+
+		void addAll(BTree_ColumnPage& page)
+		{
+			for (int i = 0; i < page.size_; ++i) {
+				int s = insert(page.keys_[i]);
+				value(s) = page.values_[i];
+			}
+		}
+
+		void borrow(BTree_ColumnPage& page)
+		{
+			int s = insert(page.keys_[0]);
+			value(s) = page.values_[0];
+			page.removeAt(0);
+		}
+
+		bool full() const
+		{
+			return size_ == PAGE_SIZE;
+		}
+
+		int size() const
+		{
+			return size_;
+		}
+
+		bool valid() const
+		{
+			return size_ >= PAGE_SIZE/2 && size_ <= PAGE_SIZE;
+		}
+	};
+
+	/**
+	 * The summary kept by trees which are not augmented. It is empty, and is not stored in index pages at all.
+	 */
+	struct BTree_NoSummary
+	{
+		bool operator==(const BTree_NoSummary&) const
+		{
+			return true;
+		}
+	};
+
+	/**
+	 * The part of an index entry which holds the summary of the child's subtree.
+	 */
+	template<class Summary>
+	struct BTree_ChildSummary
+	{
+		Summary summary_;
+
+		const Summary& summary() const
+		{
+			return summary_;
+		}
+
+		void setSummary(const Summary& summary)
+		{
+			summary_ = summary;
+		}
+	};
+
+	template<>
+	struct BTree_ChildSummary<BTree_NoSummary>
+	{
+		BTree_NoSummary summary() const
+		{
+			return BTree_NoSummary();
+		}
+
+		void setSummary(const BTree_NoSummary&)
+		{
+		}
+	};
+
+	/**
+	 * The value stored in an index page: a child node, together with the summary of everything beneath it. When the
+	 * tree is not augmented, the summary takes no space and an entry is just the pointer.
+	 */
+	template<class Node, class Summary>
+	struct BTree_Child : public BTree_ChildSummary<Summary>
+	{
+		Node* node;
+	};
+
+	template<class K, class V, int PAGE_SIZE, class Layout, class Augment>
+	class Leaf;
+
+	template<class K, class V, int PAGE_SIZE, class Layout, class Augment>
+	class Index;
+
+	/**
+	 * The common part of Leaves and Indexes. Nodes have no virtual functions: each one records whether it is a leaf,
+	 * and the functions below dispatch on that tag with a static cast. This keeps vtable pointers out of the nodes and
+	 * lets the compiler inline the node functions used on the way down the tree.
+	 */
+	template<class K, class V, int PAGE_SIZE, class Layout, class Augment>
+	class BTree_Node
+	{
+	private:
+		typedef Leaf<K, V, PAGE_SIZE, Layout, Augment> LeafNode;
+		typedef Index<K, V, PAGE_SIZE, Layout, Augment> IndexNode;
+
+		bool leaf_;
+
+	protected:
+		BTree_Node(bool leaf)
+		{
+			leaf_ = leaf;
+		}
+
+		/**
+		 * Nodes are released through the tree's node allocator, as the right kind of node.
+		 */
+		~BTree_Node() = default;
+
+	public:
+		/**
+		 * A marker value retuned by Leaf::findOrInsert to indicate that the leaf is full.
+		 */
+		static V* const FULL;
+
+		/**
+		 * The number of elements a split at the right edge of the tree leaves in the new node: a tenth of a page, and at
+		 * least one.
+		 */
+		static const int RIGHT_SPLIT_SIZE = PAGE_SIZE/10 > 1 ? PAGE_SIZE/10 : 1;
+
+		bool isLeaf() const
+		{
+			return leaf_;
+		}
+
+		LeafNode* asLeaf()
+		{
+			return static_cast<LeafNode*>(this);
+		}
+
+		const LeafNode* asLeaf() const
+		{
+			return static_cast<const LeafNode*>(this);
+		}
+
+		IndexNode* asIndex()
+		{
+			return static_cast<IndexNode*>(this);
+		}
+
+		const IndexNode* asIndex() const
+		{
+			return static_cast<const IndexNode*>(this);
+		}
+
+		/**
+		 * @return the lowest key stored beneath this node
+		 */
+		const K& firstKey() const
+		{
+			return leaf_ ? asLeaf()->firstKey() : asIndex()->firstKey();
+		}
+
+		/**
+		 * @return the highest key stored beneath this node
+		 */
+		const K& lastKey() const
+		{
+			return leaf_ ? asLeaf()->lastKey() : asIndex()->lastKey();
+		}
+
+		/**
+		 * Move this node's elements after the first keep into the given empty node, which must be of the same kind.
+		 */
+		void split(BTree_Node* newNode, int keep)
+		{
+			if (leaf_) {
+				asLeaf()->split(newNode->asLeaf(), keep);
+			} else {
+				asIndex()->split(newNode->asIndex(), keep);
+			}
+		}
+
+		/**
+		 * @return a key under which this node may be filed in its parent, which is no greater than any key beneath it
+		 * and greater than any key beneath the nodes before it. The node must not be an empty leaf.
+		 */
+		const K& separator() const
+		{
+			return leaf_ ? asLeaf()->firstKey() : asIndex()->page().key(asIndex()->page().first());
+		}
+
+		/**
+		 * Move all the elements of the given node, which must be the next node on the same level, into this one.
+		 * @param separator the key the given node is filed under in the parent of both
+		 */
+		void merge(BTree_Node* node, const K& separator)
+		{
+			if (leaf_) {
+				asLeaf()->merge(node);
+			} else {
+				node->asIndex()->fileFirstUnder(separator);
+				asIndex()->merge(node);
+			}
+		}
+
+		/**
+		 * Move the first element of the given node, which must be the next node on the same level, to the end of
+		 * this one.
+		 * @param separator the key the given node is filed under in the parent of both
+		 */
+		void borrow(BTree_Node* node, const K& separator)
+		{
+			if (leaf_) {
+				asLeaf()->borrow(node);
+			} else {
+				node->asIndex()->fileFirstUnder(separator);
+				asIndex()->borrow(node);
+			}
+		}
+
+		/**
+		 * Move the last elements of the given node, which must be the previous node on the same level, to the front of
+		 * this one.
+		 * @param separator the key this node is filed under in the parent of both
+		 * @param count the number of elements to move
+		 */
+		void borrowLast(BTree_Node* node, const K& separator, int count)
+		{
+			if (leaf_) {
+				node->asLeaf()->giveLast(asLeaf(), count);
+			} else {
+				asIndex()->fileFirstUnder(separator);
+				node->asIndex()->giveLast(asIndex(), count);
+			}
+		}
+
+		void print(int indent) const
+		{
+			if (leaf_) {
+				asLeaf()->print(indent);
+			} else {
+				asIndex()->print(indent);
+			}
+		}
+
+		/**
+		 * The number of elements stored in *this* node. For indexes, this is the number of child nodes. For leaves,
+		 * the number of data elements.
+		 */
+		int count() const
+		{
+			return leaf_ ? asLeaf()->count() : asIndex()->count();
+		}
+
+		/**
+		 * @param rightmost whether this is the last node on its level of a tree which has been split at its right edge.
+		 * Such a node need only hold as many elements as that split leaves in it.
+		 */
+		bool valid(int depth, bool rightmost) const
+		{
+			return leaf_ ? asLeaf()->valid(depth, rightmost) : asIndex()->valid(depth, rightmost);
+		}
+	};
+
+	template<class K, class V, int PAGE_SIZE, class Layout, class Augment>
+	V* const BTree_Node<K, V, PAGE_SIZE, Layout, Augment>::FULL = (V*) 1;
+
+	template<class K, class V, int PAGE_SIZE, class Layout, class Augment>
+	class Leaf : public BTree_Node<K, V, PAGE_SIZE, Layout, Augment>
+	{
+	public:
+		typedef typename Layout::template Page<K, V, PAGE_SIZE>::Type Page;
+
+	private:
+		typedef BTree_Node<K, V, PAGE_SIZE, Layout, Augment> Node;
+
+		Page page_;
+		/**
+		 * The leaf holding the next higher keys in the tree, or 0 if this is the last leaf.
+		 */
+		Leaf* next_;
+
+	public:
+		Leaf() : Node(true)
+		{
+			next_ = 0;
+		}
+
+		const Page& page() const
+		{
+			return page_;
+		}
+
+		const Leaf* next() const
+		{
+			return next_;
+		}
+
+		Leaf* next()
+		{
+			return next_;
+		}
+
+		void setNext(Leaf* next)
+		{
+			next_ = next;
+		}
+
+		/**
+		 * Move the elements with the highest keys from this leaf to the front of the given leaf, which must follow it.
+		 * @param right the leaf to receive the elements
+		 * @param count the number of elements to move
+		 */
+		void giveLast(Leaf* right, int count)
+		{
+			for (int i = 0; i < count; ++i) {
+				int s = page_.last();
+				int t = right->page_.insert(page_.key(s));
+				right->page_.value(t) = page_.value(s);
+				page_.removeAt(s);
+			}
+		}
+
+		/**
+		 * @return the slot of the first element whose key is not less than the given key, or PAGE_END if every key in
+		 * this leaf is less than it
+		 */
+		int lowerBound(const K& key) const
+		{
+			int s = page_.findInsertPos(key);
+			if (s == PAGE_END) {
+				return page_.first();
+			}
+			return page_.key(s) == key ? s : page_.next(s);
+		}
+
+		/**
+		 * @return the slot of the first element whose key is greater than the given key, or PAGE_END
+		 */
+		int upperBound(const K& key) const
+		{
+			int s = page_.findInsertPos(key);
+			return s == PAGE_END ? page_.first() : page_.next(s);
+		}
+
+		V* find(const K& key) const
+		{
+			int s = page_.find(key);
+			return s == PAGE_END ? 0 : const_cast<V*>(&page_.value(s));
+		}
+
+		V* findOrInsert(const K& key)
+		{
+			int s = page_.findOrInsert(key);
+			return s == PAGE_FULL ? Node::FULL : &page_.value(s);
+		}
+
+		void remove(const K& key)
+		{
+			page_.remove(key);
+		}
+
+		/**
+		 * Remove every element with a key in [lo, hi), working back from the highest so that the slots still to be
+		 * visited stay put.
+		 */
+		void removeRange(const K& lo, const K& hi)
+		{
+			int s = lowerBound(hi);
+			s = s == PAGE_END ? page_.last() : page_.prev(s);
+			while (s != PAGE_END && !(page_.key(s) < lo)) {
+				int prev = page_.prev(s);
+				page_.removeAt(s);
+				s = prev;
+			}
+		}
+
+		const K& firstKey() const
+		{
+			return page_.key(page_.first());
+		}
+
+		const K& lastKey() const
+		{
+			return page_.key(page_.last());
+		}
+
+		void split(Leaf* newLeaf, int keep)
+		{
+			page_.split(newLeaf->page_, keep);
+			newLeaf->next_ = next_;
+			next_ = newLeaf;
+		}
+
+		/**
+		 * Move all the elements of the given leaf, which must be the next leaf in the chain, into this one.
+		 */
+		void merge(Node* node)
+		{
+			Leaf* leaf = node->asLeaf();
+			page_.addAll(leaf->page_);
+			next_ = leaf->next_;
+		}
+
+		void borrow(Node* node)
+		{
+			Leaf* leaf = node->asLeaf();
+			page_.borrow(leaf->page_);
+		}
+
+		void print(int indent) const
+		{
+			for (int s = page_.first(); s != PAGE_END; s = page_.next(s)) {
+				for (int i = 0; i < indent; ++i) {
+					std::cout << "  ";
+				}
+				std::cout << page_.key(s) << ": (value)" << std::endl;
+			}
+		}
+
+		int count() const
+		{
+			return page_.size();
+		}
+
+		bool valid(int depth, bool rightmost) const
+		{
+			return depth == 0 || (rightmost ? page_.size() >= Node::RIGHT_SPLIT_SIZE : page_.valid());
+		}
+	};
+
+	template<class K, class V, int PAGE_SIZE, class Layout, class Augment>
+	class Index : public BTree_Node<K, V, PAGE_SIZE, Layout, Augment>
+	{
+	private:
+		typedef BTree_Node<K, V, PAGE_SIZE, Layout, Augment> Node;
+
+	public:
+		typedef typename Augment::Summary Summary;
+		typedef BTree_Child<Node, Summary> Child;
+		typedef typename Layout::template Page<K, Child, PAGE_SIZE>::Type Page;
+
+		/**
+		 * Whether entries carry summaries which must be kept up to date.
+		 */
+		static const bool AUGMENTED = !std::is_same<Summary, BTree_NoSummary>::value;
+
+	private:
+		Page page_;
+
+	public:
+		Index() : Node(false)
+		{
+		}
+
+		const Page& page() const
+		{
+			return page_;
+		}
+
+		/**
+		 * @return the slot of the child beneath which the given key is stored, or PAGE_END if the key is lower than
+		 * every key in the index (and so cannot be stored beneath it)
+		 */
+		int findChild(const K& key) const
+		{
+			return page_.findInsertPos(key);
+		}
+
+		/**
+		 * @return the slot of the child beneath which the given key is, or would be, stored
+		 */
+		int childSlot(const K& key) const
+		{
+			int s = page_.findInsertPos(key);
+			return s == PAGE_END ? page_.first() : s;
+		}
+
+		/**
+		 * @return the child beneath which the given key is, or would be, stored
+		 */
+		Node* child(const K& key) const
+		{
+			return page_.value(childSlot(key)).node;
+		}
+
+		Node* childAt(int s) const
+		{
+			return page_.value(s).node;
+		}
+
+		Node* firstChild() const
+		{
+			return page_.value(page_.first()).node;
+		}
+
+		Node* lastChild() const
+		{
+			return page_.value(page_.last()).node;
+		}
+
+		/**
+		 * @return the summary of everything beneath the child in the given slot
+		 */
+		Summary summaryAt(int s) const
+		{
+			return page_.value(s).summary();
+		}
+
+		/**
+		 * @return the summary of everything beneath this index
+		 */
+		Summary summary() const
+		{
+			Summary summary = Augment::identity();
+			for (int s = page_.first(); s != PAGE_END; s = page_.next(s)) {
+				summary = Augment::combine(summary, page_.value(s).summary());
+			}
+			return summary;
+		}
+
+		/**
+		 * @return the summary of everything beneath the given node, computed from its own page
+		 */
+		static Summary summarize(const Node* node)
+		{
+			if (!node->isLeaf()) {
+				return node->asIndex()->summary();
+			}
+			const typename Leaf<K, V, PAGE_SIZE, Layout, Augment>::Page& page = node->asLeaf()->page();
+			Summary summary = Augment::identity();
+			for (int s = page.first(); s != PAGE_END; s = page.next(s)) {
+				summary = Augment::combine(summary, Augment::of(page.key(s), page.value(s)));
+			}
+			return summary;
+		}
+
+		/**
+		 * Recompute the summary of the child in the given slot, after something beneath it has changed.
+		 */
+		void refresh(int s)
+		{
+			if (AUGMENTED) {
+				page_.value(s).setSummary(summarize(page_.value(s).node));
+			}
+		}
+
+		/**
+		 * Lower the key under which the child in the given slot is filed, if the given key is lower than it. Used when
+		 * a key lower than any in the tree is about to be inserted beneath the first child.
+		 */
+		void lowerKey(int s, const K& key)
+		{
+			if (key < page_.key(s)) {
+				page_.setKey(s, key);
+			}
+		}
+
+		/**
+		 * Restore the child in the given slot to at least half full, by borrowing from a sibling until it is, if the
+		 * sibling can spare that much, or else by merging with the sibling. The summaries of the children involved are
+		 * brought up to date.
+		 * @param s the slot of the child, updated to the slot of the node now holding its elements
+		 * @return a node which has been merged into its sibling and detached from this index, for the caller to
+		 * release, or 0
+		 */
+		Node* rebalance(int& s)
+		{
+			refresh(s);
+			Node* node = page_.value(s).node;
+			if (node->count() >= PAGE_SIZE/2) {
+				return 0;
+			}
+			int next = page_.next(s);
+			int prev = page_.prev(s);
+			if (next != PAGE_END) {
+				Node* sibling = page_.value(next).node;
+				if (node->count() + sibling->count() >= 2 * (PAGE_SIZE/2)) {
+					while (node->count() < PAGE_SIZE/2) {
+						node->borrow(sibling, page_.key(next));
+						page_.setKey(next, sibling->separator());
+					}
+					refresh(s);
+					refresh(next);
+				} else {
+					node->merge(sibling, page_.key(next));
+					page_.removeAt(next);
+					refresh(s);
+					return sibling;
+				}
+			} else if (prev != PAGE_END) {
+				Node* sibling = page_.value(prev).node;
+				if (node->count() + sibling->count() >= 2 * (PAGE_SIZE/2)) {
+					node->borrowLast(sibling, page_.key(s), PAGE_SIZE/2 - node->count());
+					page_.setKey(s, node->separator());
+					refresh(s);
+					refresh(prev);
+				} else {
+					sibling->merge(node, page_.key(s));
+					page_.removeAt(s);
+					s = prev;
+					refresh(s);
+					return node;
+				}
+			}
+			return 0;
+		}
+
+		/**
+		 * Remove the child in the given slot from this index, without releasing it.
+		 */
+		void removeChild(int s)
+		{
+			page_.removeAt(s);
+		}
+
+		const K& firstKey() const
+		{
+			return firstChild()->firstKey();
+		}
+
+		const K& lastKey() const
+		{
+			return lastChild()->lastKey();
+		}
+
+		void split(Index* newIndex, int keep)
+		{
+			page_.split(newIndex->page_, keep);
+		}
+
+		/**
+		 * File the first child under the key this index is filed under in its parent. The key a first child is filed
+		 * under need only be a lower bound for its keys, and may be lower still than keys held in the previous index,
+		 * so it must be raised before the child is moved behind another.
+		 */
+		void fileFirstUnder(const K& key)
+		{
+			assert(page_.size() > 0);
+			page_.setKey(page_.first(), key);
+		}
+
+		/**
+		 * Move all the children of the given index, which must be the next index on the same level, into this one.
+		 * Each keeps its summary.
+		 */
+		void merge(Node* node)
+		{
+			page_.addAll(node->asIndex()->page_);
+		}
+
+		void borrow(Node* node)
+		{
+			page_.borrow(node->asIndex()->page_);
+		}
+
+		/**
+		 * Move the children with the highest keys from this index to the front of the given index, which must follow
+		 * it.
+		 * @param right the index to receive the children
+		 * @param count the number of children to move
+		 */
+		void giveLast(Index* right, int count)
+		{
+			for (int i = 0; i < count; ++i) {
+				int s = page_.last();
+				int t = right->page_.insert(page_.key(s));
+				right->page_.value(t) = page_.value(s);
+				page_.removeAt(s);
+			}
+		}
+
+		void addPage(Node* p)
+		{
+			int s = page_.insert(p->firstKey());
+			page_.value(s).node = p;
+			refresh(s);
+		}
+
+		void print(int indent) const
+		{
+			for (int s = page_.first(); s != PAGE_END; s = page_.next(s)) {
+				for (int i = 0; i < indent; i++) {
 					std::cout << "  ";
 				}
-				std::cout << ie->key << ":" << std::endl;
-				ie->value->print(indent + 1);
-				ie = ie->next;
+				std::cout << page_.key(s) << ":" << std::endl;
+				page_.value(s).node->print(indent + 1);
+			}
+		}
+
+		bool full() const
+		{
+			return page_.full();
+		}
+
+		int count() const
+		{
+			return page_.size();
+		}
+
+		/**
+		 * Used to reduce the height of the tree when enough elements are removed from it. If this function returns a
+		 * value, it means that this node had a single child, which has been detached and can replace the node itself.
+		 */
+		Node* replaceChild()
+		{
+			if (page_.size() == 1) {
+				int s = page_.first();
+				Node* child = page_.value(s).node;
+				page_.removeAt(s);
+				return child;
+			} else {
+				return 0;
+			}
+		}
+
+		bool valid(int depth, bool rightmost) const
+		{
+			if (depth > 0 && !(rightmost ? page_.size() >= Node::RIGHT_SPLIT_SIZE : page_.valid())) {
+				return false;
+			}
+
+			for (int s = page_.first(); s != PAGE_END; s = page_.next(s)) {
+				const Node* child = page_.value(s).node;
+				int next = page_.next(s);
+				if (!child->valid(depth + 1, rightmost && next == PAGE_END)) {
+					return false;
+				}
+				// Every key beneath the child must be routed to it
+				if (child->count() > 0 && ((page_.prev(s) != PAGE_END && child->firstKey() < page_.key(s))
+						|| (next != PAGE_END && !(child->lastKey() < page_.key(next))))) {
+					return false;
+				}
+				if (AUGMENTED && !(page_.value(s).summary() == summarize(child))) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+	};
+
+	/**
+	 * Node allocator which takes each node from the general-purpose heap.
+	 * @tparam T the type of node allocated
+	 */
+	template<class T>
+	class BTree_NodeHeap
+	{
+	public:
+		/**
+		 * True if releaseAll() can discard every node at once.
+		 */
+		static const bool CAN_RELEASE_ALL = false;
+
+		T* create()
+		{
+			return new T;
+		}
+
+		void release(T* node)
+		{
+			delete node;
+		}
+
+		void releaseAll()
+		{
+		}
+
+		/**
+		 * Nodes from the heap can be released by any tree, so there is nothing to share.
+		 */
+		void share(const BTree_NodeHeap&)
+		{
+		}
+	};
+
+	/**
+	 * Node allocator which carves nodes out of large page-aligned slabs owned by one tree. Released nodes go onto a
+	 * free list and are reused before the slabs are extended. Each node starts on a cache line boundary.
+	 *
+	 * Nodes can be handed from one tree to another (see BTree::splitAt and BTree::join). The receiving arena then
+	 * shares ownership of all of the giving arena's slabs, not only those holding the nodes handed over, and keeps them
+	 * until releaseAll() or until it is destroyed. A slab is returned to the heap once no arena holds it. Trees which
+	 * keep exchanging nodes therefore hold on to the memory of every arena they have taken nodes from.
+	 * @tparam T the type of node allocated
+	 */
+	template<class T>
+	class BTree_NodeArena
+	{
+	private:
+		struct FreeNode
+		{
+			FreeNode* next;
+		};
+
+		/**
+		 * The slabs allocated by one arena, freed when the last arena holding nodes in them lets go.
+		 */
+		struct Slabs
+		{
+			std::vector<void*> slabs;
+
+			~Slabs()
+			{
+				for (size_t i = 0; i < slabs.size(); ++i) {
+					free(slabs[i]);
+				}
+			}
+		};
+
+		static const size_t LINE_SIZE = 64;
+		static const size_t PAGE_BYTES = 4096;
+		static const size_t NODE_BYTES = (sizeof(T) + LINE_SIZE - 1) / LINE_SIZE * LINE_SIZE;
+		static const size_t MIN_SLAB_BYTES = 64 * 1024;
+		static const size_t SLAB_BYTES = ((NODE_BYTES * 16 > MIN_SLAB_BYTES ? NODE_BYTES * 16 : MIN_SLAB_BYTES)
+			+ PAGE_BYTES - 1) / PAGE_BYTES * PAGE_BYTES;
+
+		std::shared_ptr<Slabs> slabs_;
+		/**
+		 * The slabs of other arenas which nodes used by this one's tree may lie in.
+		 */
+		std::vector<std::shared_ptr<Slabs> > shared_;
+		/**
+		 * Released nodes, available for reuse.
+		 */
+		FreeNode* free_;
+		/**
+		 * The unused part of the most recent slab.
+		 */
+		char* next_;
+		char* end_;
+
+		// Slabs belong to exactly one tree
+		BTree_NodeArena(const BTree_NodeArena&);
+		BTree_NodeArena& operator=(const BTree_NodeArena&);
+
+	public:
+		static const bool CAN_RELEASE_ALL = true;
+
+		BTree_NodeArena() : slabs_(std::make_shared<Slabs>())
+		{
+			free_ = 0;
+			next_ = 0;
+			end_ = 0;
+		}
+
+		T* create()
+		{
+			void* p;
+			if (free_ != 0) {
+				p = free_;
+				free_ = free_->next;
+			} else {
+				if (next_ == end_) {
+					void* slab;
+					if (posix_memalign(&slab, PAGE_BYTES, SLAB_BYTES) != 0) {
+						throw std::bad_alloc();
+					}
+					slabs_->slabs.push_back(slab);
+					next_ = static_cast<char*>(slab);
+					end_ = next_ + SLAB_BYTES / NODE_BYTES * NODE_BYTES;
+				}
+				p = next_;
+				next_ += NODE_BYTES;
+			}
+			return new (p) T;
+		}
+
+		void release(T* node)
+		{
+			node->~T();
+			FreeNode* f = new (node) FreeNode;
+			f->next = free_;
+			free_ = f;
+		}
+
+		/**
+		 * Return every slab to the heap, without running the destructors of the nodes still in them. Takes time in
+		 * proportion to the number of slabs, not the number of nodes. Slabs shared with another arena are kept until
+		 * it too lets go of them.
+		 */
+		void releaseAll()
+		{
+			slabs_ = std::make_shared<Slabs>();
+			shared_.clear();
+			free_ = 0;
+			next_ = 0;
+			end_ = 0;
+		}
+
+		/**
+		 * Keep the slabs of another arena, and those it shares, until releaseAll() or destruction, so that nodes
+		 * created by it can be released into this one. Slabs already shared are not added again.
+		 */
+		void share(const BTree_NodeArena& other)
+		{
+			addShared(other.slabs_);
+			for (size_t i = 0; i < other.shared_.size(); ++i) {
+				addShared(other.shared_[i]);
+			}
+		}
+
+		/**
+		 * @return the number of slabs allocated
+		 */
+		size_t slabs() const
+		{
+			return slabs_->slabs.size();
+		}
+
+	private:
+		void addShared(const std::shared_ptr<Slabs>& slabs)
+		{
+			if (slabs == slabs_ || slabs->slabs.empty()) {
+				return;
+			}
+			for (size_t i = 0; i < shared_.size(); ++i) {
+				if (shared_[i] == slabs) {
+					return;
+				}
+			}
+			shared_.push_back(slabs);
+		}
+	};
+
+	/**
+	 * A key-value pair referred to by an iterator.
+	 */
+	template<class K, class V>
+	struct BTree_Entry
+	{
+		const K& key;
+		const V& value;
+
+		BTree_Entry(const K& k, const V& v) : key(k), value(v) {}
+
+		const BTree_Entry* operator->() const
+		{
+			return this;
+		}
+	};
+
+	/**
+	 * An iterator over the elements of a BTree in order of increasing key. Steps from one leaf to the next through the
+	 * leaf chain, without going back through the indexes. The end iterator refers to no leaf.
+	 */
+	template<class K, class V, int PAGE_SIZE, class Layout, class Augment>
+	class BTree_Iterator
+	{
+	private:
+		typedef Leaf<K, V, PAGE_SIZE, Layout, Augment> LeafNode;
+		typedef BTree_Entry<K, V> Entry;
+
+		const LeafNode* leaf_;
+		int curr_;
+
+		/**
+		 * Move on to the following leaves until the current slot refers to an element, or the end is reached.
+		 */
+		void skipExhaustedLeaves()
+		{
+			while (leaf_ != 0 && curr_ == PAGE_END) {
+				leaf_ = leaf_->next();
+				curr_ = leaf_ == 0 ? PAGE_END : leaf_->page().first();
+			}
+		}
+
+	public:
+		BTree_Iterator()
+		{
+			leaf_ = 0;
+			curr_ = PAGE_END;
+		}
+
+		BTree_Iterator(const LeafNode* leaf, int slot)
+		{
+			leaf_ = leaf;
+			curr_ = slot;
+			skipExhaustedLeaves();
+		}
+
+		const Entry operator*() const
+		{
+			return Entry(leaf_->page().key(curr_), leaf_->page().value(curr_));
+		}
+
+		const BTree_Iterator& operator++()
+		{
+			curr_ = leaf_->page().next(curr_);
+			skipExhaustedLeaves();
+			return *this;
+		}
+
+		const Entry operator->() const
+		{
+			return **this;
+		}
+
+		bool operator==(const BTree_Iterator& other) const
+		{
+			return leaf_ == other.leaf_ && curr_ == other.curr_;
+		}
+
+		bool operator!=(const BTree_Iterator& other) const
+		{
+			return !(*this == other);
+		}
+	};
+}; // namespace BTree_private
+
+/**
+ * Page layout which stores the elements of each page in a doubly-linked list. This is the default.
+ */
+struct BTree_ListPages
+{
+	template<class K, class V, int PAGE_SIZE>
+	struct Page
+	{
+		typedef BTree_private::BTree_Page<K, V, PAGE_SIZE> Type;
+	};
+};
+
+/**
+ * Page layout which stores the elements of each page in a sorted array, searched by binary search.
+ */
+struct BTree_ArrayPages
+{
+	template<class K, class V, int PAGE_SIZE>
+	struct Page
+	{
+		typedef BTree_private::BTree_ArrayPage<K, V, PAGE_SIZE> Type;
+	};
+};
+
+/**
+ * Page layout which stores the keys of each page in one sorted array and the values in another, so that searches
+ * only read keys.
+ */
+struct BTree_ColumnPages
+{
+	template<class K, class V, int PAGE_SIZE>
+	struct Page
+	{
+		typedef BTree_private::BTree_ColumnPage<K, V, PAGE_SIZE> Type;
+	};
+};
+
+/**
+ * Node allocation policy which allocates every node separately with new. This is the default.
+ */
+struct BTree_HeapNodes
+{
+	template<class T>
+	struct Pool
+	{
+		typedef BTree_private::BTree_NodeHeap<T> Type;
+	};
+};
+
+/**
+ * Node allocation policy which gives each tree its own arena of page-aligned slabs. Nodes are recycled through a free
+ * list, and a tree whose keys and values have trivial destructors is destroyed by dropping its slabs.
+ */
+struct BTree_ArenaNodes
+{
+	template<class T>
+	struct Pool
+	{
+		typedef BTree_private::BTree_NodeArena<T> Type;
+	};
+};
+
+/**
+ * Augmentation policy which keeps no summaries in index pages. This is the default.
+ */
+struct BTree_NoAugment
+{
+	typedef BTree_private::BTree_NoSummary Summary;
+
+	/**
+	 * Whether summaries depend on values, which can then only be written through BTree::insert.
+	 */
+	static const bool USES_VALUES = false;
+
+	static Summary identity()
+	{
+		return Summary();
+	}
+
+	template<class K, class V>
+	static Summary of(const K&, const V&)
+	{
+		return Summary();
+	}
+
+	static Summary combine(const Summary&, const Summary&)
+	{
+		return Summary();
+	}
+};
+
+/**
+ * Augmentation policy which keeps the number of elements beneath each child next to it in index pages, so that
+ * BTree::rank, select and countRange take O(log n) instead of a walk over the elements.
+ */
+struct BTree_CountAugment
+{
+	typedef size_t Summary;
+
+	static const bool USES_VALUES = false;
+
+	static Summary identity()
+	{
+		return 0;
+	}
+
+	template<class K, class V>
+	static Summary of(const K&, const V&)
+	{
+		return 1;
+	}
+
+	static Summary combine(Summary a, Summary b)
+	{
+		return a + b;
+	}
+
+	static size_t count(Summary s)
+	{
+		return s;
+	}
+};
+
+/**
+ * Augmentation policy which keeps the sum of the values beneath each child, for BTree::aggregate.
+ * @tparam T the type in which values are summed
+ */
+template<class T>
+struct BTree_SumAugment
+{
+	typedef T Summary;
+
+	static const bool USES_VALUES = true;
+
+	static Summary identity()
+	{
+		return T();
+	}
+
+	template<class K, class V>
+	static Summary of(const K&, const V& value)
+	{
+		return value;
+	}
+
+	static Summary combine(const Summary& a, const Summary& b)
+	{
+		return a + b;
+	}
+};
+
+/**
+ * Augmentation policy which keeps the least value beneath each child, for BTree::aggregate. The aggregate of no
+ * values is the greatest T.
+ */
+template<class T>
+struct BTree_MinAugment
+{
+	typedef T Summary;
+
+	static const bool USES_VALUES = true;
+
+	static Summary identity()
+	{
+		return std::numeric_limits<T>::max();
+	}
+
+	template<class K, class V>
+	static Summary of(const K&, const V& value)
+	{
+		return value;
+	}
+
+	static Summary combine(const Summary& a, const Summary& b)
+	{
+		return b < a ? b : a;
+	}
+};
+
+/**
+ * Augmentation policy which keeps the greatest value beneath each child, for BTree::aggregate. The aggregate of no
+ * values is the lowest T.
+ */
+template<class T>
+struct BTree_MaxAugment
+{
+	typedef T Summary;
+
+	static const bool USES_VALUES = true;
+
+	static Summary identity()
+	{
+		return std::numeric_limits<T>::lowest();
+	}
+
+	template<class K, class V>
+	static Summary of(const K&, const V& value)
+	{
+		return value;
+	}
+
+	static Summary combine(const Summary& a, const Summary& b)
+	{
+		return a < b ? b : a;
+	}
+};
+
+/**
+ * Thrown by BTree::bulkLoad when its input is not in strictly increasing order of key.
+ */
+class UnsortedInputException : public std::exception {
+	virtual const char* what() const throw() {
+		return "BTree bulk load input is not sorted by key";
+	}
+};
+
+/**
+ * Thrown by BTree::join when the keys of one tree do not all lie on the same side of the keys of the other.
+ */
+class OverlappingKeysException : public std::exception {
+	virtual const char* what() const throw() {
+		return "BTree join of trees whose keys overlap";
+	}
+};
+
+template<class K, class V, int PAGE_SIZE = DEFAULT_PAGE_SIZE, class Layout = BTree_ListPages,
+	class Alloc = BTree_HeapNodes, class Augment = BTree_NoAugment>
+class BTree
+{
+	typedef BTree_private::BTree_Node<K, V, PAGE_SIZE, Layout, Augment> Node;
+	typedef BTree_private::Leaf<K, V, PAGE_SIZE, Layout, Augment> Leaf;
+	typedef BTree_private::Index<K, V, PAGE_SIZE, Layout, Augment> Index;
+	typedef typename Alloc::template Pool<Leaf>::Type LeafPool;
+	typedef typename Alloc::template Pool<Index>::Type IndexPool;
+
+	/**
+	 * The number of lookups findBatch advances together, one tree level at a time.
+	 */
+	static const int BATCH_GROUP = 32;
+
+	/**
+	 * The deepest tree the iterative descents can record a path through.
+	 */
+	static const int MAX_DEPTH = 64;
+
+	LeafPool leaves_;
+	IndexPool indexes_;
+	Node* root_;
+	/**
+	 * The last leaf in the tree, kept so that appends need not descend from the root, or 0 if it must be found again.
+	 */
+	Leaf* last_;
+	/**
+	 * Whether a node has been split at the right edge of the tree since it was last built, which may have left the last
+	 * node on each level less than half full.
+	 */
+	bool rightSplit_;
+	/**
+	 * Changed whenever index pages are restructured, so that cursors can tell whether their paths still hold.
+	 */
+	unsigned long version_;
+	bool asserts_;
+
+	void assertValid()
+	{
+		if (asserts_) {
+			assert(valid());
+		}
+	}
+
+	Leaf* newLeaf()
+	{
+		return leaves_.create();
+	}
+
+	Index* newIndex()
+	{
+		return indexes_.create();
+	}
+
+	/**
+	 * Release a single node, which must already have been detached from the tree.
+	 */
+	void release(Node* node)
+	{
+		if (node->isLeaf()) {
+			leaves_.release(node->asLeaf());
+		} else {
+			indexes_.release(node->asIndex());
+		}
+	}
+
+	/**
+	 * Release a node and everything beneath it.
+	 */
+	void destroy(Node* node)
+	{
+		if (!node->isLeaf()) {
+			const typename Index::Page& page = node->asIndex()->page();
+			for (int s = page.first(); s != BTree_private::PAGE_END; s = page.next(s)) {
+				destroy(page.value(s).node);
+			}
+		}
+		release(node);
+	}
+
+	/**
+	 * Release every node in the tree. When the allocator can drop all its nodes at once, and no node needs its
+	 * destructor run, this does not visit the nodes at all.
+	 */
+	void destroyAll()
+	{
+		if (LeafPool::CAN_RELEASE_ALL && IndexPool::CAN_RELEASE_ALL && std::is_trivially_destructible<Leaf>::value
+				&& std::is_trivially_destructible<Index>::value) {
+			leaves_.releaseAll();
+			indexes_.releaseAll();
+		} else {
+			destroy(root_);
+		}
+		root_ = 0;
+		last_ = 0;
+		rightSplit_ = false;
+		++version_;
+	}
+
+	/**
+	 * @return the leaf in which the given key is, or would be, stored
+	 */
+	const Leaf* findLeaf(const K& key) const
+	{
+		const Node* node = root_;
+		while (!node->isLeaf()) {
+			node = node->asIndex()->child(key);
+		}
+		return node->asLeaf();
+	}
+
+	const Leaf* firstLeaf() const
+	{
+		const Node* node = root_;
+		while (!node->isLeaf()) {
+			node = node->asIndex()->firstChild();
+		}
+		return node->asLeaf();
+	}
+
+	static size_t countNodes(const Node* node)
+	{
+		size_t count = 1;
+		if (!node->isLeaf()) {
+			const typename Index::Page& page = node->asIndex()->page();
+			for (int s = page.first(); s != BTree_private::PAGE_END; s = page.next(s)) {
+				count += countNodes(page.value(s).node);
+			}
+		}
+		return count;
+	}
+
+	Leaf* lastLeaf()
+	{
+		if (last_ == 0) {
+			Node* node = root_;
+			while (!node->isLeaf()) {
+				node = node->asIndex()->lastChild();
+			}
+			last_ = node->asLeaf();
+		}
+		return last_;
+	}
+
+	/**
+	 * @return true if the key lies beyond every key in the tree, given the path down to the (full) leaf it belongs in
+	 */
+	static bool appending(const K& key, Index** path, const int* slots, int depth, const Leaf* leaf)
+	{
+		if (!(leaf->lastKey() < key)) {
+			return false;
+		}
+		for (int level = 0; level < depth; ++level) {
+			if (path[level]->page().next(slots[level]) != BTree_private::PAGE_END) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Find the value associated with a key, adding the key if it is absent, and record the path down to its leaf.
+	 * Full nodes met on the way are split. The summaries along the path are left for the caller to bring up to date.
+	 * @param inserted set to whether the key was added
+	 * @return the value associated with the key
+	 */
+	V* findOrInsert(const K& key, Index** path, int* slots, int& depth, bool& inserted)
+	{
+		// Keys arriving in increasing order all land in the last leaf, which can be used without a descent while it has
+		// room. Augmented trees need the path to refresh, so always descend.
+		if (!Index::AUGMENTED) {
+			Leaf* last = lastLeaf();
+			if (last->count() > 0 ? !(key < last->lastKey()) : last == root_) {
+				int before = last->count();
+				V* e = last->findOrInsert(key);
+				if (e != Node::FULL) {
+					depth = 0;
+					inserted = last->count() != before;
+					return e;
+				}
+			}
+		}
+
+		for (;;) {
+			depth = 0;
+			Node* node = root_;
+			while (!node->isLeaf()) {
+				assert(depth < MAX_DEPTH);
+				Index* index = node->asIndex();
+				int s = index->childSlot(key);
+				index->lowerKey(s, key);
+				path[depth] = index;
+				slots[depth] = s;
+				++depth;
+				node = index->childAt(s);
+			}
+
+			Leaf* leaf = node->asLeaf();
+			int before = leaf->count();
+			V* e = leaf->findOrInsert(key);
+			if (e != Node::FULL) {
+				inserted = leaf->count() != before;
+				return e;
+			}
+
+			// Split the lowest full node on the path whose parent has room (or the root), then descend again. When the
+			// key is appended at the right edge of the tree, nothing more is expected to arrive below the split point, so
+			// the split node keeps 90% of its elements instead of half.
+			int level = depth;
+			Node* full = node;
+			while (level > 0 && path[level - 1]->full()) {
+				--level;
+				full = path[level];
+			}
+			int keep = PAGE_SIZE/2;
+			if (appending(key, path, slots, depth, leaf)) {
+				keep = PAGE_SIZE - Node::RIGHT_SPLIT_SIZE;
+				rightSplit_ = true;
+			}
+			Node* newNode = full->isLeaf() ? static_cast<Node*>(newLeaf()) : static_cast<Node*>(newIndex());
+			full->split(newNode, keep);
+			++version_;
+			if (full->isLeaf() && newNode->asLeaf()->next() == 0) {
+				last_ = newNode->asLeaf();
+			}
+			if (level == 0) {
+				Index* newRoot = newIndex();
+				newRoot->addPage(root_);
+				newRoot->addPage(newNode);
+				root_ = newRoot;
+			} else {
+				Index* parent = path[level - 1];
+				parent->addPage(newNode);
+				parent->refresh(parent->childSlot(full->firstKey()));
+			}
+		}
+	}
+
+	/**
+	 * Restore each node along a path down the tree to at least half full, from the bottom up, and bring the summaries
+	 * along it up to date.
+	 */
+	void rebalancePath(Index** path, int* slots, int depth)
+	{
+		for (int level = depth - 1; level >= 0; --level) {
+			Node* merged;
+			while ((merged = path[level]->rebalance(slots[level])) != 0) {
+				if (merged == last_) {
+					last_ = 0;
+				}
+				// Its elements, or children, now belong to its sibling
+				release(merged);
+			}
+		}
+	}
+
+	/**
+	 * Rebalance the path down to the leaf in which the given key is, or would be, stored.
+	 * @return true if a node on the path was less than half full and had a sibling to take from
+	 */
+	bool rebalanceToward(const K& key)
+	{
+		Index* path[MAX_DEPTH];
+		int slots[MAX_DEPTH];
+		int depth = 0;
+		bool underfull = false;
+		for (Node* node = root_; !node->isLeaf(); ++depth) {
+			assert(depth < MAX_DEPTH);
+			Index* index = node->asIndex();
+			path[depth] = index;
+			slots[depth] = index->childSlot(key);
+			node = index->childAt(slots[depth]);
+			underfull = underfull || (node->count() < PAGE_SIZE/2 && index->count() > 1);
+		}
+		rebalancePath(path, slots, depth);
+		collapseRoot();
+		return underfull;
+	}
+
+	/**
+	 * Replace an index root with only one child by that child, for as long as there is one.
+	 */
+	void collapseRoot()
+	{
+		while (!root_->isLeaf()) {
+			Node* newRoot = root_->asIndex()->replaceChild();
+			if (newRoot == 0) {
+				break;
+			}
+			release(root_);
+			root_ = newRoot;
+		}
+	}
+
+	/**
+	 * Bring the summaries along a path down the tree up to date, from the bottom up, after the leaf at its end has
+	 * changed.
+	 */
+	static void refreshPath(Index** path, const int* slots, int depth)
+	{
+		for (int level = depth - 1; level >= 0; --level) {
+			path[level]->refresh(slots[level]);
+		}
+	}
+
+	/**
+	 * Combine the summaries of the elements beneath a node with keys in [lo, hi).
+	 * @param upper a key above every key beneath the node, or 0 if there is none
+	 */
+	static typename Augment::Summary aggregate(const Node* node, const K& lo, const K& hi, const K* upper)
+	{
+		typename Augment::Summary summary = Augment::identity();
+		if (node->isLeaf()) {
+			const typename Leaf::Page& page = node->asLeaf()->page();
+			for (int s = node->asLeaf()->lowerBound(lo); s != BTree_private::PAGE_END && page.key(s) < hi;
+					s = page.next(s)) {
+				summary = Augment::combine(summary, Augment::of(page.key(s), page.value(s)));
+			}
+			return summary;
+		}
+
+		const Index* index = node->asIndex();
+		const typename Index::Page& page = index->page();
+		for (int s = page.first(); s != BTree_private::PAGE_END; s = page.next(s)) {
+			if (!(page.key(s) < hi)) {
+				break;
+			}
+			int next = page.next(s);
+			const K* childUpper = next == BTree_private::PAGE_END ? upper : &page.key(next);
+			if (childUpper != 0 && !(lo < *childUpper)) {
+				continue;
+			}
+			if (!(page.key(s) < lo) && childUpper != 0 && !(hi < *childUpper)) {
+				summary = Augment::combine(summary, index->summaryAt(s));
+			} else {
+				summary = Augment::combine(summary, aggregate(index->childAt(s), lo, hi, childUpper));
+			}
+		}
+		return summary;
+	}
+
+	/**
+	 * @return the number of elements to put in each page to fill it to the given fraction, kept at least half full
+	 */
+	static int perPageFor(double fillFactor)
+	{
+		int perPage = (int) (fillFactor * PAGE_SIZE + 0.5);
+		if (perPage > PAGE_SIZE) {
+			perPage = PAGE_SIZE;
+		}
+		if (perPage < PAGE_SIZE/2 || perPage < 1) {
+			perPage = PAGE_SIZE/2 > 0 ? PAGE_SIZE/2 : 1;
+		}
+		return perPage;
+	}
+
+	/**
+	 * Release the indexes beneath a node, leaving its leaves alone.
+	 */
+	void releaseIndexes(Node* node)
+	{
+		if (!node->isLeaf()) {
+			const typename Index::Page& page = node->asIndex()->page();
+			for (int s = page.first(); s != BTree_private::PAGE_END; s = page.next(s)) {
+				releaseIndexes(page.value(s).node);
+			}
+			release(node);
+		}
+	}
+
+	/**
+	 * Build the index levels over a chain of leaves, after topping up the last leaf from its neighbour, or folding
+	 * it into its neighbour if they fit in one page.
+	 * @param level the leaves, in order; left holding the root
+	 * @param perPage the number of children to put in each index
+	 * @return the root
+	 */
+	Node* buildIndexes(std::vector<Node*>& level, int perPage)
+	{
+		Leaf* leaf = level.back()->asLeaf();
+		if (level.size() > 1 && leaf->count() < PAGE_SIZE/2) {
+			Leaf* prev = level[level.size() - 2]->asLeaf();
+			if (prev->count() + leaf->count() <= PAGE_SIZE) {
+				prev->merge(leaf);
+				release(leaf);
+				level.pop_back();
+			} else {
+				prev->giveLast(leaf, PAGE_SIZE/2 - leaf->count());
+			}
+		}
+
+		while (level.size() > 1) {
+			int count = level.size();
+			int pages = pagesFor(count, perPage);
+			std::vector<Node*> parents;
+			int next = 0;
+			for (int p = 0; p < pages; ++p) {
+				int size = count / pages + (p < count % pages ? 1 : 0);
+				Index* index = newIndex();
+				for (int j = 0; j < size; ++j) {
+					index->addPage(level[next++]);
+				}
+				parents.push_back(index);
+			}
+			level.swap(parents);
+		}
+		return level[0];
+	}
+
+	/**
+	 * @return the number of pages to divide count entries between, so that each page holds about perPage entries
+	 * without being over full or under half full
+	 */
+	static int pagesFor(int count, int perPage)
+	{
+		int pages = (count + perPage - 1) / perPage;
+		int fewest = (count + PAGE_SIZE - 1) / PAGE_SIZE;
+		int most = count / (PAGE_SIZE/2 > 0 ? PAGE_SIZE/2 : 1);
+		if (pages > most) {
+			pages = most;
+		}
+		if (pages < fewest) {
+			pages = fewest;
+		}
+		return pages > 0 ? pages : 1;
+	}
+
+	/**
+	 * @return the number of levels in the subtree under a node, counting the node itself
+	 */
+	static int heightOf(const Node* node)
+	{
+		int height = 1;
+		for (; !node->isLeaf(); node = node->asIndex()->firstChild()) {
+			++height;
+		}
+		return height;
+	}
+
+	/**
+	 * Divide a node and everything beneath it between the keys lower than the given key and the rest. Only the
+	 * nodes on the path to the key are divided; the children on either side of the path are moved whole. The nodes
+	 * returned are the same height as the one divided, and may be less than half full.
+	 * @param lower set to the node left holding the lower keys, or 0 if there are none
+	 * @param upper set to the node holding the other keys, or 0 if there are none
+	 */
+	void splitNode(Node* node, const K& key, Node*& lower, Node*& upper)
+	{
+		if (node->isLeaf()) {
+			Leaf* leaf = node->asLeaf();
+			const typename Leaf::Page& page = leaf->page();
+			int keep = 0;
+			for (int s = page.first(); s != BTree_private::PAGE_END && page.key(s) < key; s = page.next(s)) {
+				++keep;
+			}
+			lower = keep > 0 ? leaf : 0;
+			upper = keep < leaf->count() ? leaf : 0;
+			if (lower != 0 && upper != 0) {
+				Leaf* right = newLeaf();
+				leaf->split(right, keep);
+				upper = right;
 			}
+			return;
 		}
 
-		int depth() const
-		{
-			return 1 + page.first()->value->depth();
+		// Keep the children up to the one the key belongs under, which is divided in turn
+		Index* index = node->asIndex();
+		const typename Index::Page& page = index->page();
+		int c = index->childSlot(key);
+		Node* child = index->childAt(c);
+		int keep = 1;
+		for (int s = page.first(); s != c; s = page.next(s)) {
+			++keep;
+		}
+		Index* right = 0;
+		if (keep < index->count()) {
+			right = newIndex();
+			index->split(right, keep);
 		}
+		index->removeChild(page.last());
 
-		int count() const
-		{
-			return page.size();
+		Node* childLower;
+		Node* childUpper;
+		splitNode(child, key, childLower, childUpper);
+		if (childLower != 0) {
+			index->addPage(childLower);
+		}
+		if (childUpper != 0) {
+			if (right == 0) {
+				right = newIndex();
+			}
+			right->addPage(childUpper);
 		}
 
-		Node* replaceChild()
-		{
-			if (page.size() == 1) {
-				NodeElement* el = page.first();
-				page.remove(el->key);
-				return el->value;
-			} else {
-				return 0;
+		lower = index;
+		if (index->count() == 0) {
+			release(index);
+			lower = 0;
+		}
+		upper = right;
+	}
+
+	/**
+	 * File a node in an index under its first key, first splitting the index in half if it is full.
+	 * @return the index split off, holding the upper half of the children, for the caller to file in the parent, or 0
+	 */
+	Index* addChild(Index* index, Node* child)
+	{
+		if (!index->full()) {
+			index->addPage(child);
+			return 0;
+		}
+		Index* upper = newIndex();
+		index->split(upper, PAGE_SIZE/2);
+		if (child->firstKey() < upper->separator()) {
+			index->addPage(child);
+		} else {
+			upper->addPage(child);
+		}
+		return upper;
+	}
+
+	/**
+	 * Join two subtrees by filing the shorter as a child at the near edge of the taller, at the level where it fits,
+	 * and splitting full indexes on the way back up.
+	 * @param low a subtree whose keys are all lower than those of high
+	 * @param high a subtree whose keys are all higher than those of low
+	 * @return the root of the joined tree
+	 */
+	Node* graft(Node* low, Node* high)
+	{
+		int lowHeight = heightOf(low);
+		int highHeight = heightOf(high);
+		Index* path[MAX_DEPTH];
+		int depth = 0;
+		Node* root;
+		Node* carry;
+		if (lowHeight >= highHeight) {
+			root = low;
+			for (Node* node = low; lowHeight - depth > highHeight; node = node->asIndex()->lastChild()) {
+				path[depth++] = node->asIndex();
 			}
+			carry = high;
+		} else {
+			root = high;
+			for (Node* node = high; highHeight - depth > lowHeight; node = node->asIndex()->firstChild()) {
+				path[depth++] = node->asIndex();
+			}
+			// The first child may be filed under a key lower than those now going in front of it, so file it under its
+			// own first key, which is also the first key of high
+			path[depth - 1]->fileFirstUnder(high->firstKey());
+			carry = low;
 		}
 
-		bool valid(int depth) const
-		{
-			if (depth > 0 && !page.valid()) {
-				return false;
+		for (int level = depth - 1; level >= 0 && carry != 0; --level) {
+			carry = addChild(path[level], carry);
+		}
+		if (carry != 0) {
+			Index* newRoot = newIndex();
+			newRoot->addPage(root);
+			newRoot->addPage(carry);
+			root = newRoot;
+		}
+		if (lowHeight < highHeight) {
+			// The first slots above the low subtree must now admit its keys, as after an insert below every key
+			const K& key = low->firstKey();
+			for (Node* node = root; node != low; node = node->asIndex()->firstChild()) {
+				node->asIndex()->lowerKey(node->asIndex()->page().first(), key);
 			}
+		}
+		return root;
+	}
 
-			NodeElement* ie = page.first();
-			while (ie != 0) {
-				if (!ie->value->valid(depth + 1)) {
-					return false;
-				}
-				ie = ie->next;
+	/**
+	 * Bring up to date the summaries of the children on the path to the given key, and of their neighbours on
+	 * either side, from the bottom up.
+	 */
+	void refreshAround(const K& key)
+	{
+		if (!Index::AUGMENTED) {
+			return;
+		}
+		Index* path[MAX_DEPTH];
+		int slots[MAX_DEPTH];
+		int depth = 0;
+		for (Node* node = root_; !node->isLeaf(); node = path[depth - 1]->childAt(slots[depth - 1])) {
+			assert(depth < MAX_DEPTH);
+			path[depth] = node->asIndex();
+			slots[depth] = path[depth]->childSlot(key);
+			++depth;
+		}
+		for (int level = depth - 1; level >= 0; --level) {
+			const typename Index::Page& page = path[level]->page();
+			int s = slots[level];
+			path[level]->refresh(s);
+			if (page.prev(s) != BTree_private::PAGE_END) {
+				path[level]->refresh(page.prev(s));
 			}
+			if (page.next(s) != BTree_private::PAGE_END) {
+				path[level]->refresh(page.next(s));
+			}
+		}
+	}
 
-			return true;
+	/**
+	 * Rebalance the paths to the given keys until no node on either is left less than half full.
+	 */
+	void settle(const K& lo, const K& hi)
+	{
+		// Merging two underfull nodes can leave a node with no sibling to merge with until its parent has been merged
+		// in turn, so repeat until neither path has an underfull node
+		while (rebalanceToward(lo) | rebalanceToward(hi)) {
 		}
-	};
+	}
 
-	template<class K, class V>
-	class BTree_Iterator
+public:
+	typedef BTree_private::BTree_Iterator<K, V, PAGE_SIZE, Layout, Augment> Iterator;
+
+	/**
+	 * Remembers the path to the leaf used by the last find or insertHint it was passed to, so that the next one can
+	 * start there instead of at the root. A cursor stays usable across any change to the tree: once its path has been
+	 * restructured, the next operation simply descends from the root again.
+	 */
+	class Cursor
 	{
-	private:
-		typedef BTree_Element<K, V> Element;
+		friend class BTree;
 
-		Element* curr_;
+		const BTree* tree_;
+		unsigned long version_;
+		int depth_;
+		Index* path_[MAX_DEPTH];
+		int slots_[MAX_DEPTH];
 
 	public:
-		BTree_Iterator(Element* first)
-		{
-			curr_ = first;
-		}
-
-		const Element& operator*()
+		Cursor()
 		{
-			return *curr_;
+			tree_ = 0;
+			version_ = 0;
+			depth_ = 0;
 		}
+	};
 
-		const BTree_Iterator& operator++()
-		{
-			curr_ = curr_->next;
-			return *this;
+private:
+	/**
+	 * Move a cursor to the leaf in which the given key is, or would be, stored. Starting from the cursor's leaf, climb
+	 * only as far as the first index known to cover the key, then descend from there.
+	 * @param inserting whether the key is about to be inserted, so that separators along the path may need lowering
+	 * @return that leaf
+	 */
+	Leaf* seek(Cursor& cursor, const K& key, bool inserting)
+	{
+		int level = 0;
+		if (cursor.tree_ == this && cursor.version_ == version_) {
+			// A child whose slot has neighbours on both sides is bounded by their keys alone. At the ends of a page the
+			// bound is inherited from further up.
+			level = cursor.depth_;
+			for (int l = cursor.depth_ - 1; l >= 0; --l) {
+				const typename Index::Page& page = cursor.path_[l]->page();
+				int s = cursor.slots_[l];
+				int prev = page.prev(s);
+				int next = page.next(s);
+				if ((prev != BTree_private::PAGE_END && key < page.key(s))
+						|| (next != BTree_private::PAGE_END && !(key < page.key(next)))) {
+					level = l;
+				} else if (prev != BTree_private::PAGE_END && next != BTree_private::PAGE_END) {
+					break;
+				}
+			}
 		}
 
-		const Element* operator->()
-		{
-			return curr_;
+		Node* node = level == 0 ? root_ : cursor.path_[level - 1]->childAt(cursor.slots_[level - 1]);
+		while (!node->isLeaf()) {
+			assert(level < MAX_DEPTH);
+			Index* index = node->asIndex();
+			int s = index->childSlot(key);
+			cursor.path_[level] = index;
+			cursor.slots_[level] = s;
+			++level;
+			node = index->childAt(s);
 		}
-	};
-}; // namespace BTree_private
-
-template<class K, class V, int PAGE_SIZE = DEFAULT_PAGE_SIZE>
-class BTree
-{
-	typedef BTree_private::BTree_Node<K, V, PAGE_SIZE> Node;
-	typedef BTree_private::Leaf<K, V, PAGE_SIZE> Leaf;
-	typedef BTree_private::Index<K, V, PAGE_SIZE> Index;
-	typedef BTree_private::BTree_Element<K, V> Element;
-
-	Node* root_;
-	bool asserts_;
-
-	void assertValid()
-	{
-		if (asserts_) {
-			assert(valid());
+		cursor.tree_ = this;
+		cursor.version_ = version_;
+		cursor.depth_ = level;
+
+		// Only a key below every key in its leaf can be below the key a slot on the path is filed under
+		Leaf* leaf = node->asLeaf();
+		if (inserting && (leaf->count() == 0 || key < leaf->firstKey())) {
+			for (int l = 0; l < level; ++l) {
+				cursor.path_[l]->lowerKey(cursor.slots_[l], key);
+			}
 		}
+		return leaf;
 	}
 
 public:
-	typedef BTree_private::BTree_Iterator<K, V> Iterator;
 
 	BTree()
 	{
-		root_ = new Leaf;
+		root_ = newLeaf();
+		last_ = 0;
+		rightSplit_ = false;
+		version_ = 0;
+		asserts_ = false;
+	}
+
+	/**
+	 * Construct a tree from sorted input. See bulkLoad.
+	 */
+	template<class InputIterator>
+	BTree(InputIterator begin, InputIterator end, double fillFactor = 1.0)
+	{
+		root_ = newLeaf();
+		last_ = 0;
+		rightSplit_ = false;
+		version_ = 0;
 		asserts_ = false;
+		bulkLoad(begin, end, fillFactor);
 	}
 
 	~BTree()
 	{
-		delete root_;
+		destroyAll();
+	}
+
+	/**
+	 * Associate a value with a key, replacing any value already associated with it. Unlike operator[], this keeps
+	 * augmentations which summarize values, such as BTree_SumAugment, up to date.
+	 */
+	void insert(const K& key, const V& value)
+	{
+		Index* path[MAX_DEPTH];
+		int slots[MAX_DEPTH];
+		int depth;
+		bool inserted;
+		*findOrInsert(key, path, slots, depth, inserted) = value;
+		if (Index::AUGMENTED) {
+			refreshPath(path, slots, depth);
+		}
+		assertValid();
 	}
 
 	V& operator[](const K& key)
 	{
-		Element *e = root_->findOrInsert(key);
-		if (e == Element::FULL) {
-			Node* newPage = root_->split();
-			Index* newRoot = new Index;
-			newRoot->addPage(root_);
-			newRoot->addPage(newPage);
-			root_ = newRoot;
-			e = root_->findOrInsert(key);
+		static_assert(!Augment::USES_VALUES, "values written through operator[] would not be summarized; use insert");
+		Index* path[MAX_DEPTH];
+		int slots[MAX_DEPTH];
+		int depth;
+		bool inserted;
+		V* e = findOrInsert(key, path, slots, depth, inserted);
+		if (Index::AUGMENTED && inserted) {
+			refreshPath(path, slots, depth);
+		}
+		assertValid();
+		return *e;
+	}
+
+	/**
+	 * As operator[], starting from the leaf the cursor was left at. Unless the leaf has to be split, runs of keys which
+	 * land in the same leaf cost a search of that leaf each. The cursor is left at the key's leaf.
+	 */
+	V& insertHint(Cursor& cursor, const K& key)
+	{
+		static_assert(!Augment::USES_VALUES, "values written through insertHint would not be summarized; use insert");
+		Leaf* leaf = seek(cursor, key, true);
+		int before = leaf->count();
+		V* e = leaf->findOrInsert(key);
+		bool inserted = leaf->count() != before;
+		if (e == Node::FULL) {
+			e = findOrInsert(key, cursor.path_, cursor.slots_, cursor.depth_, inserted);
+			cursor.version_ = version_;
+			if (cursor.depth_ == 0 && !root_->isLeaf()) {
+				// The key was appended to the last leaf without recording a path
+				cursor.tree_ = 0;
+			}
+		}
+		if (Index::AUGMENTED && inserted) {
+			refreshPath(cursor.path_, cursor.slots_, cursor.depth_);
 		}
 		assertValid();
-		return e->value;
+		return *e;
 	}
 
 	bool contains(const K& key)
 	{
-		return root_->find(key) != 0;
+		return findLeaf(key)->find(key) != 0;
+	}
+
+	/**
+	 * Look up many independent keys at once. Descents are advanced in groups, one level at a time, prefetching each
+	 * node on the next level before any of them is searched, so that the cache misses of a group overlap instead of
+	 * being taken one after another.
+	 * @param keys the keys to look up
+	 * @param n the number of keys
+	 * @param out receives, for each key, a pointer to its value, or 0 if the key is absent
+	 */
+	void findBatch(const K* keys, size_t n, V** out)
+	{
+		const int levels = depth();
+		const Node* nodes[BATCH_GROUP];
+
+		for (size_t base = 0; base < n; base += BATCH_GROUP) {
+			int group = n - base < (size_t) BATCH_GROUP ? n - base : BATCH_GROUP;
+			for (int i = 0; i < group; ++i) {
+				nodes[i] = root_;
+			}
+			for (int level = 1; level < levels; ++level) {
+				size_t childSize = level == levels - 1 ? sizeof(Leaf) : sizeof(Index);
+				for (int i = 0; i < group; ++i) {
+					nodes[i] = nodes[i]->asIndex()->child(keys[base + i]);
+					BTree_private::prefetch(nodes[i], childSize);
+				}
+			}
+			for (int i = 0; i < group; ++i) {
+				out[base + i] = nodes[i]->asLeaf()->find(keys[base + i]);
+			}
+		}
 	}
 
 	const Iterator begin()
 	{
-		return Iterator(root_->first());
+		const Leaf* leaf = firstLeaf();
+		return Iterator(leaf, leaf->page().first());
+	}
+
+	const Iterator end()
+	{
+		return Iterator();
+	}
+
+	/**
+	 * @return an iterator referring to the element with the given key, or end() if there is none
+	 */
+	const Iterator find(const K& key)
+	{
+		const Leaf* leaf = findLeaf(key);
+		int s = leaf->page().find(key);
+		return s == BTree_private::PAGE_END ? end() : Iterator(leaf, s);
+	}
+
+	/**
+	 * As find(key), starting from the leaf the cursor was left at, which makes lookups of keys near each other cost
+	 * little more than a search of one leaf. The cursor is left at the key's leaf.
+	 */
+	const Iterator find(Cursor& cursor, const K& key)
+	{
+		const Leaf* leaf = seek(cursor, key, false);
+		int s = leaf->page().find(key);
+		return s == BTree_private::PAGE_END ? end() : Iterator(leaf, s);
+	}
+
+	/**
+	 * @return an iterator referring to the first element whose key is not less than the given key
+	 */
+	const Iterator lowerBound(const K& key)
+	{
+		const Leaf* leaf = findLeaf(key);
+		return Iterator(leaf, leaf->lowerBound(key));
+	}
+
+	/**
+	 * @return an iterator referring to the first element whose key is greater than the given key
+	 */
+	const Iterator upperBound(const K& key)
+	{
+		const Leaf* leaf = findLeaf(key);
+		return Iterator(leaf, leaf->upperBound(key));
+	}
+
+	/**
+	 * Call visit(key, value) for every element with a key in [lo, hi), in order of increasing key. Descends the tree
+	 * once to find lo, then follows the leaf chain, so the cost is O(log n + k) for k elements visited.
+	 * @return the visitor, after it has seen every element in the range
+	 */
+	template<class Visitor>
+	Visitor scan(const K& lo, const K& hi, Visitor visit)
+	{
+		const Leaf* leaf = findLeaf(lo);
+		int s = leaf->lowerBound(lo);
+		while (leaf != 0) {
+			const typename Leaf::Page& page = leaf->page();
+			for (; s != BTree_private::PAGE_END; s = page.next(s)) {
+				if (!(page.key(s) < hi)) {
+					return visit;
+				}
+				visit(page.key(s), page.value(s));
+			}
+			leaf = leaf->next();
+			if (leaf != 0) {
+				s = leaf->page().first();
+			}
+		}
+		return visit;
+	}
+
+	/**
+	 * Count the elements with keys lower than the given key. Requires an augmentation which counts elements, such as
+	 * BTree_CountAugment.
+	 * @return the number of elements with keys less than the given key, which need not be in the tree
+	 */
+	size_t rank(const K& key)
+	{
+		size_t rank = 0;
+		const Node* node = root_;
+		while (!node->isLeaf()) {
+			const Index* index = node->asIndex();
+			const typename Index::Page& page = index->page();
+			int c = index->childSlot(key);
+			for (int s = page.first(); s != c; s = page.next(s)) {
+				rank += Augment::count(index->summaryAt(s));
+			}
+			node = index->childAt(c);
+		}
+		const typename Leaf::Page& page = node->asLeaf()->page();
+		for (int s = page.first(); s != BTree_private::PAGE_END && page.key(s) < key; s = page.next(s)) {
+			++rank;
+		}
+		return rank;
+	}
+
+	/**
+	 * Find the element with the given rank. Requires an augmentation which counts elements, such as
+	 * BTree_CountAugment.
+	 * @param i the number of elements with lower keys than the one wanted
+	 * @return an iterator referring to the element, or end() if there are not more than i elements
+	 */
+	const Iterator select(size_t i)
+	{
+		const Node* node = root_;
+		while (!node->isLeaf()) {
+			const Index* index = node->asIndex();
+			const typename Index::Page& page = index->page();
+			int s = page.first();
+			for (;;) {
+				size_t count = Augment::count(index->summaryAt(s));
+				if (i < count) {
+					break;
+				}
+				i -= count;
+				s = page.next(s);
+				if (s == BTree_private::PAGE_END) {
+					return end();
+				}
+			}
+			node = index->childAt(s);
+		}
+		const Leaf* leaf = node->asLeaf();
+		int s = leaf->page().first();
+		for (; s != BTree_private::PAGE_END && i > 0; --i) {
+			s = leaf->page().next(s);
+		}
+		return s == BTree_private::PAGE_END ? end() : Iterator(leaf, s);
+	}
+
+	/**
+	 * Count the elements with keys in [lo, hi), without visiting them. Requires an augmentation which counts
+	 * elements, such as BTree_CountAugment.
+	 */
+	size_t countRange(const K& lo, const K& hi)
+	{
+		return lo < hi ? rank(hi) - rank(lo) : 0;
+	}
+
+	/**
+	 * Combine the summaries of the elements with keys in [lo, hi), in order of increasing key. Children lying wholly
+	 * inside the range contribute the summaries stored in their index entries, so only the nodes on the paths to lo
+	 * and hi are visited.
+	 * @return the combined summary, or the identity of the augmentation if the range is empty
+	 */
+	typename Augment::Summary aggregate(const K& lo, const K& hi)
+	{
+		if (!(lo < hi)) {
+			return Augment::identity();
+		}
+		return aggregate(root_, lo, hi, 0);
 	}
 
 	void remove(const K& key)
 	{
-		root_->remove(key);
-		Node* newRoot = root_->replaceChild();
-		if (newRoot != 0) {
-			delete root_;
-			root_ = newRoot;
+		Index* path[MAX_DEPTH];
+		int slots[MAX_DEPTH];
+		int depth = 0;
+		Node* node = root_;
+		while (!node->isLeaf()) {
+			assert(depth < MAX_DEPTH);
+			Index* index = node->asIndex();
+			int s = index->findChild(key);
+			if (s == BTree_private::PAGE_END) {
+				// The key is lower than any in the tree
+				return;
+			}
+			path[depth] = index;
+			slots[depth] = s;
+			++depth;
+			node = index->childAt(s);
+		}
+
+		node->asLeaf()->remove(key);
+		++version_;
+		rebalancePath(path, slots, depth);
+		collapseRoot();
+		assertValid();
+	}
+
+	/**
+	 * Remove every element with a key in [lo, hi). Subtrees lying wholly inside the range are detached and released
+	 * without visiting their elements, so only the two leaves at the ends of the range are searched, and only the two
+	 * paths down to them are rebalanced.
+	 */
+	void erase(const K& lo, const K& hi)
+	{
+		if (!(lo < hi)) {
+			return;
+		}
+
+		// Walk down the paths to the leaves holding lo and hi, dropping every child which lies between them
+		Node* left = root_;
+		Node* right = root_;
+		while (!left->isLeaf()) {
+			Index* a = left->asIndex();
+			Index* b = right->asIndex();
+			int s = a->childSlot(lo);
+			Node* nextLeft = a->childAt(s);
+			Node* nextRight = b->childAt(b->childSlot(hi));
+			if (a != b || nextLeft != nextRight) {
+				for (int t = a->page().next(s); t != BTree_private::PAGE_END && a->childAt(t) != nextRight;
+						t = a->page().next(s)) {
+					destroy(a->childAt(t));
+					a->removeChild(t);
+				}
+			}
+			if (a != b) {
+				for (int t = b->page().first(); b->childAt(t) != nextRight; t = b->page().first()) {
+					destroy(b->childAt(t));
+					b->removeChild(t);
+				}
+			}
+			left = nextLeft;
+			right = nextRight;
+		}
+		left->asLeaf()->removeRange(lo, hi);
+		if (right != left) {
+			right->asLeaf()->removeRange(lo, hi);
+			left->asLeaf()->setNext(right->asLeaf());
+		}
+		last_ = 0;
+		++version_;
+		settle(lo, hi);
+		assertValid();
+	}
+
+	/**
+	 * Remove every element from the tree, releasing whole nodes at once.
+	 */
+	void clear()
+	{
+		destroyAll();
+		root_ = newLeaf();
+	}
+
+	/**
+	 * Move every element with a key not less than the given key into another tree, replacing its contents. The tree
+	 * is cut along the path to the key: the nodes on either side of the path change hands whole, and only the nodes
+	 * on the path are divided and then rebalanced, so the cost is O(log n) however many elements move.
+	 *
+	 * With BTree_ArenaNodes, upper takes a share in all of this tree's slabs, and holds them until it is destroyed,
+	 * even after the nodes it was given are gone. This tree's slabs are returned only once both trees are destroyed.
+	 * @param key the lowest key to move
+	 * @param upper the tree to receive the elements, which must not be this one
+	 */
+	void splitAt(const K& key, BTree& upper)
+	{
+		assert(&upper != this);
+		upper.destroyAll();
+		upper.leaves_.share(leaves_);
+		upper.indexes_.share(indexes_);
+
+		Node* lower;
+		Node* higher;
+		splitNode(root_, key, lower, higher);
+		root_ = lower != 0 ? lower : newLeaf();
+		upper.root_ = higher != 0 ? higher : upper.newLeaf();
+		upper.rightSplit_ = rightSplit_;
+		last_ = 0;
+		lastLeaf()->setNext(0);
+		++version_;
+		++upper.version_;
+
+		settle(key, key);
+		upper.settle(key, key);
+		assertValid();
+		upper.assertValid();
+	}
+
+	/**
+	 * Move every element of another tree into this one, leaving the other empty. The keys of one tree must all be
+	 * lower than those of the other, in either order. The shorter tree is filed whole as a child at the edge of the
+	 * taller, and only the nodes on the path to the join are split or rebalanced, so the cost is O(log n).
+	 *
+	 * With BTree_ArenaNodes, this tree takes a share in all of the other tree's slabs, and in those the other shares,
+	 * and holds them until it is destroyed, even after the nodes it was given are gone. A tree which keeps joining
+	 * others holds on to the memory of all of them; copying the elements into a new tree lets it go.
+	 * @param other the tree to take the elements of, which must not be this one
+	 * @throws OverlappingKeysException if neither tree's keys are all lower than the other's, in which case both
+	 * trees are left unchanged
+	 */
+	void join(BTree& other)
+	{
+		assert(&other != this);
+		if (other.root_->count() == 0) {
+			return;
+		}
+		bool empty = root_->count() == 0;
+		bool below = !empty && root_->lastKey() < other.root_->firstKey();
+		if (!empty && !below && !(other.root_->lastKey() < root_->firstKey())) {
+			throw OverlappingKeysException();
+		}
+		leaves_.share(other.leaves_);
+		indexes_.share(other.indexes_);
+		Node* theirs = other.root_;
+		other.root_ = other.newLeaf();
+		rightSplit_ = rightSplit_ || other.rightSplit_;
+		other.rightSplit_ = false;
+		other.last_ = 0;
+		++other.version_;
+		last_ = 0;
+		++version_;
+		if (empty) {
+			release(root_);
+			root_ = theirs;
+			return;
+		}
+
+		Node* low = below ? root_ : theirs;
+		Node* high = below ? theirs : root_;
+		Node* node = low;
+		while (!node->isLeaf()) {
+			node = node->asIndex()->lastChild();
+		}
+		Leaf* lowLast = node->asLeaf();
+		node = high;
+		while (!node->isLeaf()) {
+			node = node->asIndex()->firstChild();
+		}
+		Leaf* highFirst = node->asLeaf();
+		lowLast->setNext(highFirst);
+		K lo = lowLast->lastKey();
+		K hi = highFirst->firstKey();
+
+		root_ = graft(low, high);
+		refreshAround(lo);
+		refreshAround(hi);
+		settle(lo, hi);
+		assertValid();
+	}
+
+	/**
+	 * Replace the contents of the tree with the given key-value pairs, building it from the leaves up in a single pass
+	 * instead of inserting one key at a time. If the input is not sorted, the tree is left unchanged.
+	 * @param begin iterator over pairs whose first member is the key and second member the value, in strictly
+	 * increasing order of key
+	 * @param end the end of the input
+	 * @param fillFactor the fraction of each page to fill, between 0.5 and 1
+	 * @throws UnsortedInputException if a key is not greater than the one before it
+	 */
+	template<class InputIterator>
+	void bulkLoad(InputIterator begin, InputIterator end, double fillFactor = 1.0)
+	{
+		int perPage = perPageFor(fillFactor);
+		std::vector<Node*> level;
+		Leaf* leaf = newLeaf();
+		level.push_back(leaf);
+		K lastKey = K();
+		for (InputIterator i = begin; i != end; ++i) {
+			if (leaf->count() > 0 && !(lastKey < i->first)) {
+				for (size_t j = 0; j < level.size(); ++j) {
+					release(level[j]);
+				}
+				throw UnsortedInputException();
+			}
+			lastKey = i->first;
+			if (leaf->count() == perPage) {
+				Leaf* next = newLeaf();
+				leaf->setNext(next);
+				leaf = next;
+				level.push_back(leaf);
+			}
+			*leaf->findOrInsert(i->first) = i->second;
+		}
+
+		destroy(root_);
+		root_ = buildIndexes(level, perPage);
+		last_ = 0;
+		rightSplit_ = false;
+		++version_;
+		assertValid();
+	}
+
+	/**
+	 * Repack the tree in place, after removals have left it sparse, so that each leaf holds about the given fraction
+	 * of a page. Elements are shifted forward into earlier leaves, leaves left empty are released, and the index
+	 * levels are rebuilt over the leaves which remain. Leaves already fuller than the target are left as they are.
+	 * @param fillFactor the fraction of each page to fill, between 0.5 and 1
+	 */
+	void compact(double fillFactor = 1.0)
+	{
+		int perPage = perPageFor(fillFactor);
+		Node* node = root_;
+		while (!node->isLeaf()) {
+			node = node->asIndex()->firstChild();
+		}
+		releaseIndexes(root_);
+
+		std::vector<Node*> level;
+		Leaf* leaf = node->asLeaf();
+		level.push_back(leaf);
+		Leaf* next = leaf->next();
+		while (next != 0) {
+			Leaf* following = next->next();
+			if (leaf->count() + next->count() <= perPage) {
+				leaf->merge(next);
+				release(next);
+			} else {
+				while (leaf->count() < perPage) {
+					leaf->borrow(next);
+				}
+				leaf = next;
+				level.push_back(leaf);
+			}
+			next = following;
 		}
+
+		root_ = buildIndexes(level, perPage);
+		last_ = 0;
+		rightSplit_ = false;
+		++version_;
 		assertValid();
 	}
 
@@ -659,9 +3451,31 @@ public:
 		root_->print(0);
 	}
 
+	/**
+	 * @return the number of nodes in the tree, leaves and indexes
+	 */
+	size_t nodes() const
+	{
+		return countNodes(root_);
+	}
+
+	/**
+	 * @return the number of elements in the leaves as a fraction of the number they have room for
+	 */
+	double leafFill() const
+	{
+		size_t elements = 0;
+		size_t leaves = 0;
+		for (const Leaf* leaf = firstLeaf(); leaf != 0; leaf = leaf->next()) {
+			elements += leaf->count();
+			++leaves;
+		}
+		return (double) elements / (leaves * PAGE_SIZE);
+	}
+
 	int depth()
 	{
-		return root_->depth();
+		return heightOf(root_);
 	}
 
 	void enableAsserts(bool enabled)
@@ -671,6 +3485,8 @@ public:
 
 	bool valid()
 	{
-		return root_->valid(0);
+		return root_->valid(0, rightSplit_);
 	}
 };
+
+#endif
@@ -0,0 +1,584 @@
+#include "btree.h"
+#include "frozen_btree.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * A small deterministic generator, so that every run benchmarks the same key sequence.
+ */
+static unsigned long long nextRandom(unsigned long long& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+static std::vector<int> shuffledKeys(int n)
+{
+	std::vector<int> keys(n);
+	for (int i = 0; i < n; i++) {
+		keys[i] = i;
+	}
+	unsigned long long state = 88172645463325252ULL;
+	for (int i = n - 1; i > 0; i--) {
+		int j = nextRandom(state) % (i + 1);
+		int t = keys[i];
+		keys[i] = keys[j];
+		keys[j] = t;
+	}
+	return keys;
+}
+
+/**
+ * A value as large as the Data type used by the tests, so that interleaved keys and values span several cache lines.
+ */
+struct Payload
+{
+	int n;
+	char padding[100];
+
+	Payload& operator=(int i)
+	{
+		n = i;
+		return *this;
+	}
+};
+
+/**
+ * An int which BTree_KeySearch has no vectorised specialization for, so pages fall back to the generic search.
+ */
+struct ScalarInt
+{
+	int n;
+
+	ScalarInt() {}
+	ScalarInt(int i) : n(i) {}
+
+	bool operator<(const ScalarInt& other) const { return n < other.n; }
+	bool operator==(const ScalarInt& other) const { return n == other.n; }
+};
+
+/**
+ * Insert n keys in random order, then look each of them up again in a different random order.
+ */
+template<class Tree>
+static void benchInsertLookup(const char* name, int n)
+{
+	std::vector<int> keys = shuffledKeys(n);
+	std::vector<int> probes = shuffledKeys(n);
+
+	Tree tree;
+
+	double start = now();
+	for (int i = 0; i < n; i++) {
+		tree[keys[i]] = i;
+	}
+	double inserted = now();
+	long found = 0;
+	for (int i = 0; i < n; i++) {
+		found += tree.contains(probes[i]);
+	}
+	double looked = now();
+
+	if (found != n) {
+		printf("%s: expected %d keys but found %ld\n", name, n, found);
+	}
+	printf("%-24s n=%-9d insert %7.1f ns/op   lookup %7.1f ns/op\n", name, n,
+		(inserted - start) * 1e9 / n, (looked - inserted) * 1e9 / n);
+}
+
+/**
+ * Build a tree from n sorted keys, once by inserting them one at a time and once by bulk loading them.
+ */
+template<class Tree>
+static void benchBulkLoad(const char* name, int n)
+{
+	std::vector<std::pair<int, int> > input(n);
+	for (int i = 0; i < n; i++) {
+		input[i] = std::make_pair(i, i);
+	}
+
+	double start = now();
+	{
+		Tree tree;
+		for (int i = 0; i < n; i++) {
+			tree[input[i].first] = input[i].second;
+		}
+	}
+	double inserted = now();
+	{
+		Tree tree(input.begin(), input.end());
+	}
+	double loaded = now();
+
+	printf("%-24s n=%-9d insert %7.1f ns/op   bulk   %7.1f ns/op\n", name, n,
+		(inserted - start) * 1e9 / n, (loaded - inserted) * 1e9 / n);
+}
+
+/**
+ * Insert n keys in increasing order, then n keys which are only nearly sorted (each block of four is shuffled), and
+ * report how full each leaves its leaves.
+ */
+template<class Tree>
+static void benchAppend(const char* name, int n)
+{
+	unsigned long long state = 88172645463325252ULL;
+	std::vector<int> nearly(n);
+	for (int i = 0; i < n; i++) {
+		nearly[i] = i ^ (int) (nextRandom(state) & 3);
+	}
+
+	double start = now();
+	Tree sorted;
+	for (int i = 0; i < n; i++) {
+		sorted[i] = i;
+	}
+	double appended = now();
+	Tree clustered;
+	for (int i = 0; i < n; i++) {
+		clustered[nearly[i]] = i;
+	}
+	double inserted = now();
+
+	printf("%-24s n=%-9d sorted %7.1f ns/op, fill %3.0f%%   nearly sorted %7.1f ns/op, fill %3.0f%%\n", name, n,
+		(appended - start) * 1e9 / n, sorted.leafFill() * 100, (inserted - appended) * 1e9 / n,
+		clustered.leafFill() * 100);
+}
+
+/**
+ * Follow a random walk over a tree of n even keys, looking up each key visited, then inserting the odd keys beside
+ * them, once from the root each time and once through a cursor.
+ */
+template<class Tree>
+static void benchCursor(const char* name, int n)
+{
+	std::vector<std::pair<int, int> > input(n);
+	for (int i = 0; i < n; i++) {
+		input[i] = std::make_pair(2 * i, i);
+	}
+	std::vector<int> walk(n);
+	unsigned long long state = 88172645463325252ULL;
+	int key = n;
+	for (int i = 0; i < n; i++) {
+		key += (int) (nextRandom(state) % 17) - 8;
+		walk[i] = key < 0 ? -key : key % (2 * n);
+		key = walk[i];
+	}
+
+	Tree plain(input.begin(), input.end());
+	Tree hinted(input.begin(), input.end());
+	typename Tree::Cursor cursor;
+	int found = 0;
+	double start = now();
+	for (int i = 0; i < n; i++) {
+		found += plain.find(walk[i]) != plain.end();
+	}
+	double looked = now();
+	for (int i = 0; i < n; i++) {
+		found += hinted.find(cursor, walk[i]) != hinted.end();
+	}
+	double cursorLooked = now();
+	for (int i = 0; i < n; i++) {
+		plain[walk[i] | 1] = i;
+	}
+	double inserted = now();
+	for (int i = 0; i < n; i++) {
+		hinted.insertHint(cursor, walk[i] | 1) = i;
+	}
+	double cursorInserted = now();
+
+	printf("%-24s n=%-9d find %6.1f -> %6.1f ns/op   insert %6.1f -> %6.1f ns/op   (%d)\n", name, n,
+		(looked - start) * 1e9 / n, (cursorLooked - looked) * 1e9 / n, (inserted - cursorLooked) * 1e9 / n,
+		(cursorInserted - inserted) * 1e9 / n, found);
+}
+
+/**
+ * Time lookups of random keys which are present in the tree.
+ * @return nanoseconds per lookup
+ */
+template<class Tree>
+static double timeLookups(Tree& tree, const std::vector<int>& live, unsigned long long& state)
+{
+	const int LOOKUPS = 1000000;
+	int found = 0;
+	double start = now();
+	for (int i = 0; i < LOOKUPS; i++) {
+		found += tree.contains(live[nextRandom(state) % live.size()]);
+	}
+	double elapsed = now() - start;
+	if (found != LOOKUPS) {
+		printf("lost keys!\n");
+	}
+	return elapsed * 1e9 / LOOKUPS;
+}
+
+/**
+ * Fill a tree with n random keys, then run rounds which each remove n/5 keys and insert n/10 new ones, tracking the
+ * shape of the tree and the cost of lookups as it shrinks, and finally compact it.
+ */
+template<class Tree>
+static void benchChurn(const char* name, int n)
+{
+	std::vector<int> keys = shuffledKeys(4 * n);
+	std::vector<int> live(keys.begin(), keys.begin() + n);
+	size_t unused = n;
+	unsigned long long state = 88172645463325252ULL;
+	Tree tree;
+	for (int i = 0; i < n; i++) {
+		tree[live[i]] = i;
+	}
+
+	printf("%s, n=%d\n", name, n);
+	for (int round = 0; round <= 8; round++) {
+		double updated = 0;
+		if (round > 0) {
+			double start = now();
+			for (int i = 0; i < n / 5; i++) {
+				size_t j = nextRandom(state) % live.size();
+				tree.remove(live[j]);
+				live[j] = live.back();
+				live.pop_back();
+			}
+			for (int i = 0; i < n / 10; i++) {
+				tree[keys[unused]] = i;
+				live.push_back(keys[unused++]);
+			}
+			updated = (now() - start) * 1e9 / (n / 5 + n / 10);
+		}
+		printf("  round %d   %8zu keys   depth %d   %7zu nodes   fill %3.0f%%   update %6.1f ns/op   lookup %6.1f ns/op\n",
+			round, live.size(), tree.depth(), tree.nodes(), tree.leafFill() * 100, updated,
+			timeLookups(tree, live, state));
+	}
+	double start = now();
+	tree.compact();
+	double compacted = now() - start;
+	printf("  compact   %8zu keys   depth %d   %7zu nodes   fill %3.0f%%   %6.1f ms          lookup %6.1f ns/op\n",
+		live.size(), tree.depth(), tree.nodes(), tree.leafFill() * 100, compacted * 1e3,
+		timeLookups(tree, live, state));
+}
+
+/**
+ * Drop a tenth of the key range from two trees of n keys, once a key at a time and once with erase, then time
+ * clearing each of them.
+ */
+template<class Tree>
+static void benchErase(const char* name, int n)
+{
+	std::vector<std::pair<int, int> > input(n);
+	for (int i = 0; i < n; i++) {
+		input[i] = std::make_pair(i, i);
+	}
+	Tree removed(input.begin(), input.end());
+	Tree erased(input.begin(), input.end());
+	int lo = n / 3;
+	int hi = lo + n / 10;
+
+	double start = now();
+	for (int i = lo; i < hi; i++) {
+		removed.remove(i);
+	}
+	double removing = now();
+	erased.erase(lo, hi);
+	double erasing = now();
+	removed.clear();
+	double clearing = now();
+
+	printf("%-24s n=%-9d remove %8.2f ms   erase %8.3f ms   clear %7.2f ms\n", name, n, (removing - start) * 1e3,
+		(erasing - removing) * 1e3, (clearing - erasing) * 1e3);
+}
+
+/**
+ * Move the upper half of a tree of n keys into another tree and back, once by copying the elements across and once
+ * with splitAt and join, then time cutting the tree at many random keys.
+ */
+template<class Tree>
+static void benchSplitJoin(const char* name, int n)
+{
+	std::vector<std::pair<int, int> > input(n);
+	for (int i = 0; i < n; i++) {
+		input[i] = std::make_pair(i, i);
+	}
+	Tree tree(input.begin(), input.end());
+	Tree upper;
+
+	double start = now();
+	for (typename Tree::Iterator i = tree.lowerBound(n / 2); i != tree.end(); ++i) {
+		upper[i->key] = i->value;
+	}
+	tree.erase(n / 2, n);
+	for (typename Tree::Iterator i = upper.begin(); i != upper.end(); ++i) {
+		tree[i->key] = i->value;
+	}
+	upper.clear();
+	double copying = now();
+	tree.splitAt(n / 2, upper);
+	tree.join(upper);
+	double moving = now();
+
+	const int ROUNDS = 1000;
+	unsigned long long state = 1;
+	double splitting = 0;
+	double joining = 0;
+	for (int r = 0; r < ROUNDS; r++) {
+		double before = now();
+		tree.splitAt(nextRandom(state) % n, upper);
+		double split = now();
+		tree.join(upper);
+		splitting += split - before;
+		joining += now() - split;
+	}
+
+	printf("%-24s n=%-9d copy %8.2f ms   split+join %7.3f ms   split %6.2f us   join %6.2f us\n", name, n,
+		(copying - start) * 1e3, (moving - copying) * 1e3, splitting / ROUNDS * 1e6, joining / ROUNDS * 1e6);
+}
+
+/**
+ * Look up n random keys in a tree of n keys, once with a loop of single lookups and once in batches.
+ */
+template<class Tree>
+static void benchFindBatch(const char* name, int n)
+{
+	std::vector<std::pair<int, int> > input(n);
+	for (int i = 0; i < n; i++) {
+		input[i] = std::make_pair(i, i);
+	}
+	Tree tree(input.begin(), input.end());
+	std::vector<int> probes = shuffledKeys(n);
+	std::vector<int*> out(n);
+
+	double start = now();
+	long found = 0;
+	for (int i = 0; i < n; i++) {
+		found += tree.contains(probes[i]);
+	}
+	double single = now();
+	const int BATCH = 4096;
+	for (int i = 0; i < n; i += BATCH) {
+		tree.findBatch(&probes[i], n - i < BATCH ? n - i : BATCH, &out[i]);
+	}
+	double batched = now();
+	for (int i = 0; i < n; i++) {
+		found -= out[i] != 0;
+	}
+
+	if (found != 0) {
+		printf("%s: batched lookups disagree with single lookups\n", name);
+	}
+	printf("%-24s n=%-9d single %7.1f ns/op   batch  %7.1f ns/op   speedup %.2fx\n", name, n,
+		(single - start) * 1e9 / n, (batched - single) * 1e9 / n, (single - start) / (batched - single));
+}
+
+/**
+ * Repeatedly build a tree of n random keys and destroy it, which mostly exercises node allocation and release.
+ */
+template<class Tree>
+static void benchBuildDestroy(const char* name, int n)
+{
+	std::vector<int> keys = shuffledKeys(n);
+	const int ROUNDS = 5;
+
+	double building = 0;
+	double destroying = 0;
+	for (int round = 0; round < ROUNDS; round++) {
+		double start = now();
+		Tree* tree = new Tree;
+		for (int i = 0; i < n; i++) {
+			(*tree)[keys[i]] = i;
+		}
+		double built = now();
+		delete tree;
+		double destroyed = now();
+		building += built - start;
+		destroying += destroyed - built;
+	}
+
+	printf("%-24s n=%-9d build  %7.1f ns/op   free   %7.2f ms\n", name, n,
+		building * 1e9 / n / ROUNDS, destroying * 1e3 / ROUNDS);
+}
+
+/**
+ * Adds up the values a scan visits.
+ */
+struct SumVisitor
+{
+	long sum;
+
+	SumVisitor() : sum(0) {}
+
+	void operator()(int, long value)
+	{
+		sum += value;
+	}
+};
+
+/**
+ * Sum the values in random windows of about a tenth of a tree of n keys, once by scanning the window and once from
+ * the subtree sums kept in the index pages.
+ */
+static void benchAggregate(int n)
+{
+	BTree<int, long, 64, BTree_ColumnPages, BTree_HeapNodes, BTree_SumAugment<long> > tree;
+	std::vector<int> keys = shuffledKeys(n);
+	for (int i = 0; i < n; i++) {
+		tree.insert(keys[i], keys[i] % 100);
+	}
+	const int QUERIES = 1000;
+	std::vector<int> los(QUERIES);
+	unsigned long long state = 88172645463325252ULL;
+	for (int q = 0; q < QUERIES; q++) {
+		los[q] = nextRandom(state) % n;
+	}
+
+	double start = now();
+	long scanned = 0;
+	for (int q = 0; q < QUERIES; q++) {
+		scanned += tree.scan(los[q], los[q] + n / 10, SumVisitor()).sum;
+	}
+	double scanning = now();
+	long aggregated = 0;
+	for (int q = 0; q < QUERIES; q++) {
+		aggregated += tree.aggregate(los[q], los[q] + n / 10);
+	}
+	double aggregating = now();
+
+	if (scanned != aggregated) {
+		printf("window sums: aggregate disagrees with scan\n");
+	}
+	printf("%-24s n=%-9d scan   %7.1f us/op   aggregate %7.2f us/op\n", "window sums (64)", n,
+		(scanning - start) * 1e6 / QUERIES, (aggregating - scanning) * 1e6 / QUERIES);
+}
+
+/**
+ * Look up n random keys in a tree of n keys, and then in a frozen snapshot of it.
+ */
+template<class Tree>
+static void benchFrozen(const char* name, int n)
+{
+	std::vector<std::pair<int, int> > input(n);
+	for (int i = 0; i < n; i++) {
+		input[i] = std::make_pair(i, i);
+	}
+	Tree tree(input.begin(), input.end());
+	FrozenBTree<int, int> frozen(tree);
+	std::vector<int> probes = shuffledKeys(n);
+
+	double start = now();
+	long found = 0;
+	for (int i = 0; i < n; i++) {
+		found += tree.contains(probes[i]);
+	}
+	double live = now();
+	for (int i = 0; i < n; i++) {
+		found -= frozen.contains(probes[i]);
+	}
+	double frozenTime = now();
+
+	if (found != 0) {
+		printf("%s: frozen lookups disagree with live lookups\n", name);
+	}
+	printf("%-24s n=%-9d live   %7.1f ns/op   frozen %7.1f ns/op   keys+values %.1f MB\n", name, n,
+		(live - start) * 1e9 / n, (frozenTime - live) * 1e9 / n, frozen.bytes() / 1e6);
+}
+
+/**
+ * Compare starting up by rebuilding a tree of n keys from sorted input with starting up by mapping a saved snapshot,
+ * then look up every key in the mapped snapshot.
+ */
+static void benchOpen(int n)
+{
+	const char* path = "btree_bench.tmp";
+	std::vector<std::pair<int, int> > input(n);
+	for (int i = 0; i < n; i++) {
+		input[i] = std::make_pair(i, i);
+	}
+
+	double start = now();
+	BTree<int, int, 64, BTree_ColumnPages> tree(input.begin(), input.end());
+	double rebuilt = now();
+	FrozenBTree<int, int>(tree).save(path);
+
+	double opening = now();
+	FrozenBTree<int, int> mapped = FrozenBTree<int, int>::open(path);
+	double opened = now();
+	std::vector<int> probes = shuffledKeys(n);
+	long found = 0;
+	for (int i = 0; i < n; i++) {
+		found += mapped.contains(probes[i]);
+	}
+	double looked = now();
+	remove(path);
+
+	if (found != n) {
+		printf("mapped snapshot: expected %d keys but found %ld\n", n, found);
+	}
+	printf("%-24s n=%-9d rebuild %6.1f ms   open %7.3f ms   lookup %7.1f ns/op\n", "mapped snapshot", n,
+		(rebuilt - start) * 1e3, (opened - opening) * 1e3, (looked - opened) * 1e9 / n);
+}
+
+int main(int argc, char** argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	benchInsertLookup<BTree<int, int, 16, BTree_ListPages> >("list pages (16)", n);
+	benchInsertLookup<BTree<int, int, 16, BTree_ArrayPages> >("array pages (16)", n);
+	benchInsertLookup<BTree<int, int, 64, BTree_ListPages> >("list pages (64)", n);
+	benchInsertLookup<BTree<int, int, 64, BTree_ArrayPages> >("array pages (64)", n);
+	benchInsertLookup<BTree<int, int, 16, BTree_ColumnPages> >("column pages (16)", n);
+	benchInsertLookup<BTree<int, int, 64, BTree_ColumnPages> >("column pages (64)", n);
+
+	benchInsertLookup<BTree<ScalarInt, int, 16, BTree_ColumnPages> >("column (16), scalar", n);
+	benchInsertLookup<BTree<ScalarInt, int, 64, BTree_ColumnPages> >("column (64), scalar", n);
+	benchInsertLookup<BTree<uint64_t, int, 64, BTree_ColumnPages> >("column (64), uint64_t", n);
+
+	benchInsertLookup<BTree<int, Payload, 16, BTree_ArrayPages> >("array pages, payload", n);
+	benchInsertLookup<BTree<int, Payload, 16, BTree_ColumnPages> >("column pages, payload", n);
+
+	benchBulkLoad<BTree<int, int, 16, BTree_ListPages> >("sorted build, list", n);
+	benchBulkLoad<BTree<int, int, 64, BTree_ColumnPages> >("sorted build, column", n);
+
+	benchAppend<BTree<int, int, 16, BTree_ArrayPages> >("append, array (16)", n);
+	benchAppend<BTree<int, int, 64, BTree_ColumnPages> >("append, column (64)", n);
+
+	benchCursor<BTree<int, int, 16, BTree_ArrayPages> >("cursor, array (16)", n);
+	benchCursor<BTree<int, int, 64, BTree_ColumnPages> >("cursor, column (64)", n);
+	benchCursor<BTree<int, int, 64, BTree_ColumnPages> >("cursor, column (64)", n * 16);
+
+	benchChurn<BTree<int, int, 16, BTree_ArrayPages> >("churn, array (16)", n);
+	benchChurn<BTree<int, int, 64, BTree_ColumnPages> >("churn, column (64)", n);
+
+	benchErase<BTree<int, int, 16, BTree_ArrayPages> >("erase, array (16)", n);
+	benchErase<BTree<int, int, 64, BTree_ColumnPages> >("erase, column (64)", n);
+	benchErase<BTree<int, int, 64, BTree_ColumnPages, BTree_ArenaNodes> >("erase, column arena (64)", n);
+
+	benchSplitJoin<BTree<int, int, 16, BTree_ArrayPages> >("split, array (16)", n);
+	benchSplitJoin<BTree<int, int, 64, BTree_ColumnPages> >("split, column (64)", n);
+	benchSplitJoin<BTree<int, int, 64, BTree_ColumnPages, BTree_ArenaNodes> >("split, column arena (64)", n);
+
+	benchBuildDestroy<BTree<int, int, 16, BTree_ArrayPages, BTree_HeapNodes> >("heap nodes (16)", n);
+	benchBuildDestroy<BTree<int, int, 16, BTree_ArrayPages, BTree_ArenaNodes> >("arena nodes (16)", n);
+	benchBuildDestroy<BTree<int, int, 64, BTree_ColumnPages, BTree_HeapNodes> >("heap nodes (64)", n);
+	benchBuildDestroy<BTree<int, int, 64, BTree_ColumnPages, BTree_ArenaNodes> >("arena nodes (64)", n);
+
+	// Batched lookups only pay off once the tree is well beyond the last level cache
+	benchFindBatch<BTree<int, int, 16, BTree_ArrayPages> >("batch, array (16)", n * 16);
+	benchFindBatch<BTree<int, int, 64, BTree_ColumnPages> >("batch, column (64)", n * 16);
+
+	benchAggregate(n);
+
+	benchFrozen<BTree<int, int, 16, BTree_ArrayPages> >("frozen vs array (16)", n);
+	benchFrozen<BTree<int, int, 64, BTree_ColumnPages> >("frozen vs column (64)", n);
+	benchFrozen<BTree<int, int, 64, BTree_ColumnPages> >("frozen vs column (64)", n * 16);
+
+	benchOpen(n * 16);
+
+	return 0;
+}
@@ -1,6 +1,11 @@
 #include "btree.h"
 #include "gtest/gtest.h"
 #include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
 
 static int totalCreated = 0;
 static int totalDestroyed = 0;
@@ -167,7 +172,9 @@ TEST(BTreeTest, ValueDestructorCalledForDeepTree)
 		totalDestroyed = 0;
 		// b goes out of scope here
 	}
-	ASSERT_EQ(28, totalDestroyed) << "Expected 28 elements (7 pages) of elements to have been destroyed";
+	// Ascending keys split each full leaf at the right edge of the tree, keeping 3 of its 4 elements, so 16 keys take
+	// 5 leaves rather than the 7 of half splits. The other ValueDestructorCalledForDeepTree tests build the same tree.
+	ASSERT_EQ(20, totalDestroyed) << "Expected 20 elements (5 pages) of elements to have been destroyed";
 }
 
 TEST(BTreeTest, ObjectCorruption)
@@ -368,5 +375,805 @@ TEST(BTreeTest, RandomInsertDelete)
 	ASSERT_TRUE(b.valid()) << "Expected a valid tree";
 }
 
+TEST(BTreeTest, ArrayPagesIterate)
+{
+	BTree<int, Data, 4, BTree_ArrayPages> b;
+	b.enableAsserts(true);
+
+	b[4] = Data("four");
+	b[9] = Data("nine");
+	b[3] = Data("three");
+	b[5] = Data("five");
+
+	BTree<int, Data, 4, BTree_ArrayPages>::Iterator i = b.begin();
+
+	ASSERT_EQ(3, i->key) << "Expected 3 to be next";
+	ASSERT_STREQ("three", i->value.str()) << "Expected the correct value";
+	++i;
+	ASSERT_EQ(4, i->key) << "Expected 4 to be next";
+	ASSERT_STREQ("four", i->value.str()) << "Expected the correct value";
+	++i;
+	ASSERT_EQ(5, i->key) << "Expected 5 to be next";
+	ASSERT_STREQ("five", i->value.str()) << "Expected the correct value";
+}
+
+TEST(BTreeTest, ArrayPagesValueDestructorCalledForDeepTree)
+{
+	Data fill("test");
+	{
+		BTree<int, Data, 4, BTree_ArrayPages> b;
+		for (int i = 0; i < 16; i++) {
+			b[i] = fill;
+		}
+		totalDestroyed = 0;
+		// b goes out of scope here
+	}
+	ASSERT_EQ(20, totalDestroyed) << "Expected 20 elements (5 pages) of elements to have been destroyed";
+}
+
+TEST(BTreeTest, ArrayPagesRandomInsertion)
+{
+	const int ITERATIONS = 200000;
+	BTree<int, int, 16, BTree_ArrayPages> b;
+
+	for (int i = ITERATIONS-1; i >=0; i--) {
+		int key = (i * 257) % ITERATIONS;
+		b[key] = key * 2;
+	}
+
+	for (int i = 0; i < ITERATIONS; i++) {
+		ASSERT_EQ(i * 2, b[i]) << "Expected element " << i << " to have been stored";
+	}
+
+	ASSERT_TRUE(b.valid()) << "Expected a valid tree";
+}
+
+TEST(BTreeTest, ArrayPagesCombinePages)
+{
+	Data fill("test");
+	BTree<int, Data, 4, BTree_ArrayPages> b;
+	b.enableAsserts(true);
+
+	for (int i = 0; i < 5; i++) {
+		b[i] = fill;
+	}
+	ASSERT_EQ(2, b.depth()) << "Expected a tree of depth 2";
+
+	totalDestroyed = 0;
+	b.remove(0);
+	ASSERT_EQ(0, totalDestroyed) << "Expected no values to have been destroyed (elements redistributed)";
+	b.remove(1);
+	ASSERT_EQ(4, totalDestroyed) << "Expected four values to have been destroyed (pages merged)";
+	ASSERT_EQ(1, b.depth()) << "Expected a tree of depth 1";
+	ASSERT_FALSE(b.contains(1)) << "Expected 1 to have been removed";
+	ASSERT_TRUE(b.contains(4)) << "Expected 4 to be present";
+}
+
+/**
+ * Insert and remove std::string values, both short enough to be stored inline in the string and long enough to be
+ * allocated, through enough splits and merges to shift every page.
+ */
+template<class Tree>
+static void checkStringValues()
+{
+	const int ITERATIONS = 2000;
+	Tree b;
+
+	for (int i = 0; i < ITERATIONS; i++) {
+		int key = (i * 257) % ITERATIONS;
+		b[key] = std::string(key % 40, 'a' + key % 26);
+	}
+	for (int i = 0; i < ITERATIONS; i += 2) {
+		b.remove(i);
+	}
+
+	for (int i = 0; i < ITERATIONS; i++) {
+		if (i % 2 == 0) {
+			ASSERT_FALSE(b.contains(i)) << "Expected " << i << " to have been removed";
+		} else {
+			ASSERT_EQ(std::string(i % 40, 'a' + i % 26), b[i]) << "Expected the value of " << i << " to be intact";
+		}
+	}
+	ASSERT_TRUE(b.valid()) << "Expected a valid tree";
+}
+
+TEST(BTreeTest, ArrayPagesStringValues)
+{
+	checkStringValues<BTree<int, std::string, 4, BTree_ArrayPages> >();
+}
+
+TEST(BTreeTest, ColumnPagesIterate)
+{
+	BTree<int, Data, 4, BTree_ColumnPages> b;
+	b.enableAsserts(true);
+
+	for (int i = 0; i < 20; i++) {
+		TEST_DATA[2*i] = 'A' + i;
+		TEST_DATA[2*i+1] = 0;
+	}
+	for (int i = 19; i >= 0; i--) {
+		b[i] = Data(&TEST_DATA[i*2]);
+	}
+
+	BTree<int, Data, 4, BTree_ColumnPages>::Iterator i = b.begin();
+
+	ASSERT_EQ(0, i->key) << "Expected 0 to be next";
+	ASSERT_STREQ("A", i->value.str()) << "Expected the correct value";
+	++i;
+	ASSERT_EQ(1, i->key) << "Expected 1 to be next";
+	ASSERT_STREQ("B", i->value.str()) << "Expected the correct value";
+
+	for (int i = 0; i < 20; i++) {
+		ASSERT_STREQ(&TEST_DATA[i*2], b[i].str()) << "Expected element " << i << " to have been stored";
+	}
+}
+
+TEST(BTreeTest, ColumnPagesRandomInsertion)
+{
+	const int ITERATIONS = 200000;
+	BTree<int, int, 16, BTree_ColumnPages> b;
+
+	for (int i = ITERATIONS-1; i >=0; i--) {
+		int key = (i * 257) % ITERATIONS;
+		b[key] = key * 2;
+	}
+
+	for (int i = 0; i < ITERATIONS; i++) {
+		ASSERT_EQ(i * 2, b[i]) << "Expected element " << i << " to have been stored";
+	}
+
+	ASSERT_TRUE(b.valid()) << "Expected a valid tree";
+}
+
+TEST(BTreeTest, ColumnPagesStringValues)
+{
+	checkStringValues<BTree<int, std::string, 4, BTree_ColumnPages> >();
+}
+
+template<class K>
+static void checkKeySearch(K base, K step)
+{
+	K keys[70];
+	for (int n = 0; n <= 70; n++) {
+		for (int i = 0; i < n; i++) {
+			keys[i] = base + step * i;
+		}
+		for (int p = -1; p <= 2 * n + 1; p++) {
+			K probe = base + step * p / 2;
+			int expected = 0;
+			while (expected < n && !(probe < keys[expected])) {
+				expected++;
+			}
+			ASSERT_EQ(expected, BTree_private::BTree_KeySearch<K>::upperBound(keys, n, probe))
+				<< "Expected the upper bound of probe " << p << " in " << n << " keys";
+		}
+	}
+}
+
+TEST(BTreeTest, KeySearchIntegral)
+{
+	checkKeySearch<int32_t>(-50, 4);
+	checkKeySearch<uint32_t>(0x7fffffc0u, 2);
+	checkKeySearch<int64_t>(-(1LL << 40), 1LL << 34);
+	checkKeySearch<uint64_t>(0x7fffffffffffffc0ULL, 2);
+}
+
+TEST(BTreeTest, KeySearchFloatingPoint)
+{
+	checkKeySearch<float>(-20.0f, 1.5f);
+	checkKeySearch<double>(-1e10, 3e8);
+}
+
+TEST(BTreeTest, ColumnPagesUnsigned64Keys)
+{
+	const int ITERATIONS = 20000;
+	BTree<uint64_t, int, 64, BTree_ColumnPages> b;
+
+	for (int i = 0; i < ITERATIONS; i++) {
+		uint64_t key = ((uint64_t) ((i * 257) % ITERATIONS) << 48) | 0x8000000000000000ULL;
+		b[key] = i;
+	}
+
+	for (int i = 0; i < ITERATIONS; i++) {
+		uint64_t key = ((uint64_t) i << 48) | 0x8000000000000000ULL;
+		ASSERT_TRUE(b.contains(key)) << "Expected element " << i << " to have been stored";
+		ASSERT_FALSE(b.contains(key + 1)) << "Expected element " << i << " + 1 to be absent";
+	}
+}
+
+TEST(BTreeTest, IterateAcrossLeaves)
+{
+	const int ITERATIONS = 10000;
+	BTree<int, int, 4> b;
+
+	for (int i = ITERATIONS-1; i >= 0; i--) {
+		int key = (i * 257) % ITERATIONS;
+		b[key] = key * 2;
+	}
+
+	int expected = 0;
+	for (BTree<int, int, 4>::Iterator i = b.begin(); i != b.end(); ++i) {
+		ASSERT_EQ(expected, i->key) << "Expected " << expected << " to be next";
+		ASSERT_EQ(expected * 2, i->value) << "Expected the correct value";
+		expected++;
+	}
+	ASSERT_EQ(ITERATIONS, expected) << "Expected every element to have been visited";
+}
+
+TEST(BTreeTest, IterateEmptyTree)
+{
+	BTree<int, int> b;
+
+	ASSERT_TRUE(b.begin() == b.end()) << "Expected an empty tree to have no elements";
+	ASSERT_TRUE(b.lowerBound(5) == b.end()) << "Expected no lower bound in an empty tree";
+}
+
+TEST(BTreeTest, LowerAndUpperBound)
+{
+	BTree<int, int, 4, BTree_ArrayPages> b;
+
+	for (int i = 0; i < 1000; i++) {
+		b[i * 10] = i;
+	}
+
+	ASSERT_EQ(500, b.lowerBound(500)->key) << "Expected the lower bound of a present key to be the key";
+	ASSERT_EQ(510, b.upperBound(500)->key) << "Expected the upper bound of a present key to be the next key";
+	ASSERT_EQ(510, b.lowerBound(501)->key) << "Expected the lower bound of an absent key to be the next key";
+	ASSERT_EQ(510, b.upperBound(501)->key) << "Expected the upper bound of an absent key to be the next key";
+	ASSERT_EQ(0, b.lowerBound(-100)->key) << "Expected the lower bound of a small key to be the first key";
+	ASSERT_TRUE(b.lowerBound(9991) == b.end()) << "Expected no lower bound past the last key";
+	ASSERT_TRUE(b.upperBound(9990) == b.end()) << "Expected no upper bound of the last key";
+
+	ASSERT_EQ(70, b.find(700)->value) << "Expected find to locate a present key";
+	ASSERT_TRUE(b.find(701) == b.end()) << "Expected find to return end for an absent key";
+}
+
+struct SumVisitor
+{
+	long count;
+	long sum;
+
+	SumVisitor() : count(0), sum(0) {}
+
+	void operator()(const int& key, const int&)
+	{
+		count++;
+		sum += key;
+	}
+};
+
+TEST(BTreeTest, RangeScan)
+{
+	const int ITERATIONS = 100000;
+	BTree<int, int, 16, BTree_ColumnPages> b;
+
+	for (int i = ITERATIONS-1; i >= 0; i--) {
+		int key = (i * 257) % ITERATIONS;
+		b[key] = key;
+	}
+
+	SumVisitor v = b.scan(1000, 50000, SumVisitor());
+	ASSERT_EQ(49000, v.count) << "Expected every key in [1000, 50000) to be visited";
+	ASSERT_EQ(49000L * (1000 + 49999) / 2, v.sum) << "Expected each key to be visited once";
+
+	v = b.scan(-50, 10, SumVisitor());
+	ASSERT_EQ(10, v.count) << "Expected the scan to start at the first key";
+
+	v = b.scan(ITERATIONS - 5, ITERATIONS + 100, SumVisitor());
+	ASSERT_EQ(5, v.count) << "Expected the scan to stop at the last key";
+
+	v = b.scan(10, 10, SumVisitor());
+	ASSERT_EQ(0, v.count) << "Expected an empty range to visit nothing";
+}
+
+TEST(BTreeTest, BulkLoad)
+{
+	const int ITERATIONS = 100000;
+	std::vector<std::pair<int, int> > input;
+	for (int i = 0; i < ITERATIONS; i++) {
+		input.push_back(std::make_pair(i * 2, i));
+	}
+
+	BTree<int, int, 16> b;
+	b.enableAsserts(true);
+	b[-1] = -1;
+	b.bulkLoad(input.begin(), input.end());
+
+	ASSERT_FALSE(b.contains(-1)) << "Expected the previous contents to have been replaced";
+	for (int i = 0; i < ITERATIONS; i++) {
+		ASSERT_EQ(i, b[i * 2]) << "Expected element " << i * 2 << " to have been loaded";
+		ASSERT_FALSE(b.contains(i * 2 + 1)) << "Expected element " << i * 2 + 1 << " to be absent";
+	}
+
+	int expected = 0;
+	for (BTree<int, int, 16>::Iterator i = b.begin(); i != b.end(); ++i) {
+		ASSERT_EQ(expected * 2, i->key) << "Expected the leaves to be chained in order";
+		expected++;
+	}
+	ASSERT_EQ(ITERATIONS, expected) << "Expected every element to be reachable through the leaf chain";
+	ASSERT_EQ(5, b.depth()) << "Expected packed pages to give a tree of depth 5";
+}
+
+TEST(BTreeTest, BulkLoadSmallInputs)
+{
+	for (int n = 0; n < 100; n++) {
+		std::map<int, int> input;
+		for (int i = 0; i < n; i++) {
+			input[i] = i;
+		}
+
+		BTree<int, int, 4, BTree_ArrayPages> b(input.begin(), input.end(), 0.75);
+
+		ASSERT_TRUE(b.valid()) << "Expected a valid tree for " << n << " elements";
+		for (int i = 0; i < n; i++) {
+			ASSERT_TRUE(b.contains(i)) << "Expected element " << i << " of " << n << " to have been loaded";
+		}
+
+		b[n] = n;
+		b.remove(0);
+		ASSERT_TRUE(b.valid()) << "Expected the loaded tree to accept updates";
+	}
+}
+
+TEST(BTreeTest, BulkLoadFillFactor)
+{
+	std::vector<std::pair<int, int> > input;
+	for (int i = 0; i < 4096; i++) {
+		input.push_back(std::make_pair(i, i));
+	}
+
+	BTree<int, int, 16> packed(input.begin(), input.end(), 1.0);
+	BTree<int, int, 16> half(input.begin(), input.end(), 0.5);
+
+	ASSERT_EQ(3, packed.depth()) << "Expected 256 full leaves under 16 full indexes";
+	ASSERT_EQ(4, half.depth()) << "Expected half-full pages to need another level";
+	ASSERT_TRUE(half.valid()) << "Expected half-full pages to be valid";
+}
+
+TEST(BTreeTest, BulkLoadUnsorted)
+{
+	std::vector<std::pair<int, int> > input;
+	for (int i = 0; i < 100; i++) {
+		input.push_back(std::make_pair(i, i));
+	}
+	input[50].first = 10;
+
+	BTree<int, int, 4> b;
+	b[7] = 7;
+
+	ASSERT_THROW({
+		b.bulkLoad(input.begin(), input.end());
+	}, UnsortedInputException) << "Expected unsorted input to be rejected";
+	ASSERT_TRUE(b.contains(7)) << "Expected the tree to be unchanged";
+	ASSERT_FALSE(b.contains(0)) << "Expected none of the input to have been loaded";
+
+	input[50].first = 49;
+	ASSERT_THROW({
+		b.bulkLoad(input.begin(), input.end());
+	}, UnsortedInputException) << "Expected duplicate keys to be rejected";
+}
+
+TEST(BTreeTest, FindBatch)
+{
+	const int ITERATIONS = 10000;
+	BTree<int, int, 8, BTree_ColumnPages> b;
+
+	int probes[ITERATIONS + 5];
+	int* found[ITERATIONS + 5];
+	for (int i = 0; i < ITERATIONS + 5; i++) {
+		probes[i] = ((i * 257) % (ITERATIONS + 5)) * 2 - 5;
+	}
+
+	b.findBatch(probes, 3, found);
+	for (int i = 0; i < 3; i++) {
+		ASSERT_EQ(0, found[i]) << "Expected no keys to be found in an empty tree";
+	}
+
+	for (int i = 0; i < ITERATIONS; i++) {
+		b[i * 2] = i;
+	}
+
+	b.findBatch(probes, ITERATIONS + 5, found);
+
+	for (int i = 0; i < ITERATIONS + 5; i++) {
+		int key = probes[i];
+		if (key >= 0 && key < ITERATIONS * 2 && key % 2 == 0) {
+			ASSERT_TRUE(found[i] != 0) << "Expected " << key << " to be found";
+			ASSERT_EQ(key / 2, *found[i]) << "Expected the value of " << key;
+		} else {
+			ASSERT_EQ(0, found[i]) << "Expected " << key << " to be absent";
+		}
+	}
+}
+
+TEST(BTreeTest, ArenaNodes)
+{
+	const int ITERATIONS = 200000;
+	BTree<int, int, 16, BTree_ArrayPages, BTree_ArenaNodes> b;
+
+	for (int i = ITERATIONS-1; i >= 0; i--) {
+		int key = (i * 257) % ITERATIONS;
+		b[key] = key;
+	}
+
+	for (int i = 0; i < ITERATIONS; i++) {
+		ASSERT_EQ(i, b[i]) << "Expected element " << i << " to have been stored";
+	}
+
+	ASSERT_TRUE(b.valid()) << "Expected a valid tree";
+}
+
+TEST(BTreeTest, ArenaNodesValueDestructorCalledForDeepTree)
+{
+	Data fill("test");
+	{
+		BTree<int, Data, 4, BTree_ListPages, BTree_ArenaNodes> b;
+		for (int i = 0; i < 16; i++) {
+			b[i] = fill;
+		}
+		totalDestroyed = 0;
+		// b goes out of scope here
+	}
+	ASSERT_EQ(20, totalDestroyed) << "Expected values to be destroyed even though nodes live in an arena";
+}
+
+TEST(BTreeTest, ArenaNodesRecycled)
+{
+	Data fill("test");
+	BTree<int, Data, 4, BTree_ListPages, BTree_ArenaNodes> b;
+	b.enableAsserts(true);
+
+	for (int round = 0; round < 100; round++) {
+		for (int i = 0; i < 5; i++) {
+			b[i] = fill;
+		}
+		ASSERT_EQ(2, b.depth()) << "Expected a tree of depth 2";
+		totalDestroyed = 0;
+		b.remove(0);
+		b.remove(1);
+		ASSERT_EQ(4, totalDestroyed) << "Expected the merged leaf to have been destroyed";
+		ASSERT_EQ(1, b.depth()) << "Expected a tree of depth 1";
+		b.remove(2);
+		b.remove(3);
+		b.remove(4);
+	}
+}
+
+TEST(BTreeTest, OrderStatistics)
+{
+	const int ITERATIONS = 20000;
+	BTree<int, int, 8, BTree_ArrayPages, BTree_HeapNodes, BTree_CountAugment> b;
+	for (int i = 0; i < ITERATIONS; i++) {
+		int key = (i * 257) % ITERATIONS;
+		b[key * 2] = key;
+	}
+	b[0] = 0;
+	ASSERT_TRUE(b.valid()) << "Expected the subtree counts to match the tree";
+
+	for (int i = 0; i < ITERATIONS; i++) {
+		ASSERT_EQ((size_t) i, b.rank(i * 2)) << "Expected " << i << " keys below " << i * 2;
+		ASSERT_EQ((size_t) i + 1, b.rank(i * 2 + 1)) << "Expected " << i + 1 << " keys below " << i * 2 + 1;
+		ASSERT_EQ(i * 2, b.select(i)->key) << "Expected key " << i * 2 << " at rank " << i;
+	}
+	ASSERT_EQ(0u, b.rank(-5));
+	ASSERT_TRUE(b.select(ITERATIONS) == b.end()) << "Expected no element past the last rank";
+	ASSERT_EQ(50u, b.countRange(100, 200));
+	ASSERT_EQ(51u, b.countRange(99, 201));
+	ASSERT_EQ(0u, b.countRange(200, 100));
+	ASSERT_EQ((size_t) ITERATIONS, b.countRange(-1, ITERATIONS * 2));
+}
+
+TEST(BTreeTest, OrderStatisticsAfterRemoveAndBulkLoad)
+{
+	BTree<int, int, 16, BTree_ListPages, BTree_HeapNodes, BTree_CountAugment> b;
+	b.enableAsserts(true);
+	for (int i = 0; i < 100; i++) {
+		b[i] = i;
+	}
+	for (int i = 0; i < 100; i += 2) {
+		b.remove(i);
+	}
+	for (int i = 0; i < 50; i++) {
+		ASSERT_EQ((size_t) i, b.rank(i * 2 + 1)) << "Expected removals to be counted";
+		ASSERT_EQ(i * 2 + 1, b.select(i)->key);
+	}
+
+	std::vector<std::pair<int, int> > input;
+	for (int i = 0; i < 10000; i++) {
+		input.push_back(std::make_pair(i * 3, i));
+	}
+	b.bulkLoad(input.begin(), input.end(), 0.7);
+	ASSERT_EQ(3334u, b.countRange(0, 10000));
+	ASSERT_EQ(9999 * 3, b.select(9999)->key);
+}
+
+TEST(BTreeTest, SumAggregate)
+{
+	const int ITERATIONS = 5000;
+	BTree<int, long, 8, BTree_ArrayPages, BTree_HeapNodes, BTree_SumAugment<long> > b;
+	std::vector<long> values(ITERATIONS);
+	for (int i = 0; i < ITERATIONS; i++) {
+		int key = (i * 257) % ITERATIONS;
+		values[key] = key % 7;
+		b.insert(key, values[key]);
+	}
+	values[10] = 1000;
+	b.insert(10, 1000);
+	ASSERT_TRUE(b.valid()) << "Expected the subtree sums to match the tree";
+
+	for (int lo = -3; lo < ITERATIONS; lo += 97) {
+		for (int hi = lo; hi < ITERATIONS + 5; hi += 131) {
+			long expected = 0;
+			for (int k = lo < 0 ? 0 : lo; k < hi && k < ITERATIONS; k++) {
+				expected += values[k];
+			}
+			ASSERT_EQ(expected, b.aggregate(lo, hi)) << "Expected the sum over [" << lo << ", " << hi << ")";
+		}
+	}
+	ASSERT_EQ(0, b.aggregate(20, 10));
+}
+
+TEST(BTreeTest, MaxAggregateAfterRemove)
+{
+	BTree<int, int, 16, BTree_ListPages, BTree_HeapNodes, BTree_MaxAugment<int> > b;
+	b.enableAsserts(true);
+	for (int i = 0; i < 100; i++) {
+		b.insert(i, i);
+	}
+	ASSERT_EQ(99, b.aggregate(0, 100));
+	ASSERT_EQ(49, b.aggregate(0, 50));
+	for (int i = 99; i >= 60; i--) {
+		b.remove(i);
+	}
+	ASSERT_EQ(59, b.aggregate(0, 100)) << "Expected removed values to leave the maximum";
+	ASSERT_EQ(std::numeric_limits<int>::lowest(), b.aggregate(70, 80));
+	b.insert(30, 500);
+	ASSERT_EQ(500, b.aggregate(0, 40)) << "Expected replaced values to be summarized";
+	ASSERT_EQ(29, b.aggregate(0, 30));
+}
+
+TEST(BTreeTest, AppendPacksLeaves)
+{
+	const int ITERATIONS = 10000;
+	BTree<int, int, 16> b;
+	for (int i = 0; i < ITERATIONS; i++) {
+		b[i] = i;
+	}
+	ASSERT_TRUE(b.valid());
+	ASSERT_GT(b.leafFill(), 0.85) << "Expected ascending keys to leave the leaves nearly full";
+
+	// Removing from the end merges away the last leaf, which appends must then find again
+	b.enableAsserts(true);
+	for (int i = ITERATIONS - 1; i >= ITERATIONS - 100; i--) {
+		b.remove(i);
+	}
+	for (int i = ITERATIONS - 100; i < ITERATIONS + 100; i++) {
+		b[i] = -i;
+	}
+	b[ITERATIONS / 2] = -(ITERATIONS / 2);
+	for (int i = 0; i < ITERATIONS + 100; i++) {
+		ASSERT_EQ(i < ITERATIONS - 100 && i != ITERATIONS / 2 ? i : -i, b[i]);
+	}
+
+	BTree<int, int, 16> random;
+	for (int i = 0; i < ITERATIONS; i++) {
+		random[(i * 257) % ITERATIONS] = i;
+	}
+	ASSERT_LT(random.leafFill(), 0.85) << "Expected other keys to split leaves in half";
+}
+
+TEST(BTreeTest, CursorFindAndInsert)
+{
+	BTree<int, int, 4, BTree_ArrayPages> b;
+	b.enableAsserts(true);
+	BTree<int, int, 4, BTree_ArrayPages>::Cursor cursor;
+	std::map<int, int> expected;
+
+	// A random walk, so that most steps stay in the same leaf or move to a neighbour
+	srand(11);
+	int key = 0;
+	for (int i = 0; i < 20000; i++) {
+		key += rand() % 7 - 3;
+		b.insertHint(cursor, key) = i;
+		expected[key] = i;
+		if (i % 10 == 0) {
+			// Splits made without the cursor invalidate its path
+			b[key + 50] = -i;
+			expected[key + 50] = -i;
+		}
+		int probe = key + rand() % 9 - 4;
+		BTree<int, int, 4, BTree_ArrayPages>::Iterator it = b.find(cursor, probe);
+		if (expected.count(probe) != 0) {
+			ASSERT_TRUE(it != b.end()) << "Expected to find " << probe;
+			ASSERT_EQ(expected[probe], (*it).value);
+		} else {
+			ASSERT_TRUE(it == b.end()) << "Expected not to find " << probe;
+		}
+	}
+
+	// Far jumps, keys below the whole tree, and a cursor used on another tree all fall back to a descent
+	ASSERT_TRUE(b.find(cursor, -100000) == b.end());
+	b.insertHint(cursor, -100000) = 7;
+	ASSERT_EQ(7, (*b.find(cursor, -100000)).value);
+	ASSERT_EQ(7, b[-100000]);
+	BTree<int, int, 4, BTree_ArrayPages> other;
+	other[1] = 1;
+	ASSERT_EQ(1, (*other.find(cursor, 1)).value);
+	ASSERT_TRUE(b.valid());
+}
+
+TEST(BTreeTest, RemoveMergesIndexes)
+{
+	const int ITERATIONS = 4000;
+	BTree<int, int, 4, BTree_ArrayPages> b;
+	for (int i = 0; i < ITERATIONS; i++) {
+		b[(i * 257) % ITERATIONS] = i;
+	}
+	int fullDepth = b.depth();
+	size_t fullNodes = b.nodes();
+
+	b.enableAsserts(true);
+	for (int i = 0; i < ITERATIONS; i++) {
+		if (i % 10 != 0) {
+			b.remove((i * 31) % ITERATIONS);
+		}
+	}
+	ASSERT_LT(b.depth(), fullDepth) << "Expected underfull indexes to merge until the tree lost a level";
+	ASSERT_LT(b.nodes(), fullNodes / 5);
+	for (int i = 0; i < ITERATIONS; i++) {
+		ASSERT_EQ(i % 10 == 0, b.find((i * 31) % ITERATIONS) != b.end());
+	}
+
+	for (int i = 0; i < ITERATIONS; i += 10) {
+		b.remove((i * 31) % ITERATIONS);
+	}
+	ASSERT_EQ(1, b.depth());
+	ASSERT_TRUE(b.begin() == b.end());
+}
+
+TEST(BTreeTest, Compact)
+{
+	const int ITERATIONS = 10000;
+	BTree<int, int, 16, BTree_ListPages, BTree_HeapNodes, BTree_CountAugment> b;
+	for (int i = 0; i < ITERATIONS; i++) {
+		b[(i * 257) % ITERATIONS] = i;
+	}
+	for (int i = 0; i < ITERATIONS; i++) {
+		if (i % 3 != 0) {
+			b.remove(i);
+		}
+	}
+	ASSERT_LT(b.leafFill(), 0.7);
+	size_t sparseNodes = b.nodes();
+
+	b.compact();
+	ASSERT_TRUE(b.valid());
+	ASSERT_GT(b.leafFill(), 0.95);
+	ASSERT_LT(b.nodes(), sparseNodes);
+	int expected = 0;
+	for (BTree<int, int, 16, BTree_ListPages, BTree_HeapNodes, BTree_CountAugment>::Iterator i = b.begin();
+			i != b.end(); ++i) {
+		ASSERT_EQ(expected, (*i).key);
+		expected += 3;
+	}
+	ASSERT_EQ(ITERATIONS / 3 + 1, (int) b.rank(ITERATIONS)) << "Expected the counts to be rebuilt";
+
+	b.compact(0.75);
+	ASSERT_TRUE(b.valid());
+	b[1] = 1;
+	ASSERT_EQ(1, b[1]);
+}
+
+TEST(BTreeTest, EraseRange)
+{
+	const int ITERATIONS = 5000;
+	BTree<int, int, 4, BTree_ArrayPages, BTree_HeapNodes, BTree_CountAugment> b;
+	b.enableAsserts(true);
+	for (int i = 0; i < ITERATIONS; i++) {
+		b[(i * 257) % ITERATIONS] = i;
+	}
+
+	b.erase(1000, 3000);
+	b.erase(2500, 2600);
+	b.erase(10, 11);
+	b.erase(4990, ITERATIONS + 10);
+	b.erase(50, 50);
+	for (int i = 0; i < ITERATIONS; i++) {
+		bool erased = (i >= 1000 && i < 3000) || i == 10 || i >= 4990;
+		ASSERT_EQ(!erased, b.find(i) != b.end()) << "Expected " << i << (erased ? " to be erased" : " to remain");
+	}
+	ASSERT_EQ(ITERATIONS - 2000 - 11, (int) b.rank(ITERATIONS)) << "Expected the counts to be kept up to date";
+
+	b.erase(-5, ITERATIONS);
+	ASSERT_EQ(1, b.depth());
+	ASSERT_TRUE(b.begin() == b.end());
+	b[7] = 7;
+	ASSERT_EQ(7, b[7]);
+}
+
+TEST(BTreeTest, Clear)
+{
+	Data fill("test");
+	BTree<int, Data, 4, BTree_ListPages, BTree_ArenaNodes> b;
+	for (int i = 0; i < 100; i++) {
+		b[i] = fill;
+	}
+	totalDestroyed = 0;
+	b.clear();
+	ASSERT_LT(0, totalDestroyed) << "Expected the values to be destroyed";
+	ASSERT_EQ(1, b.depth());
+	ASSERT_TRUE(b.begin() == b.end());
+	b[1] = fill;
+	ASSERT_TRUE(b.contains(1));
+	ASSERT_TRUE(b.valid());
+}
+
+TEST(BTreeTest, SplitAtAndJoin)
+{
+	const int ITERATIONS = 2000;
+	typedef BTree<int, int, 4, BTree_ArrayPages, BTree_HeapNodes, BTree_CountAugment> Tree;
+	Tree b;
+	b.enableAsserts(true);
+	for (int i = 0; i < ITERATIONS; i++) {
+		b[(i * 257) % ITERATIONS] = i;
+	}
+
+	Tree upper;
+	upper.enableAsserts(true);
+	upper[-1] = -1;
+	b.splitAt(1500, upper);
+	ASSERT_FALSE(upper.contains(-1)) << "Expected the previous contents to be replaced";
+	ASSERT_EQ(1500, (int) b.rank(ITERATIONS));
+	ASSERT_EQ(500, (int) upper.rank(ITERATIONS));
+	ASSERT_EQ(1499, b.select(1499)->key);
+	ASSERT_EQ(1500, upper.begin()->key);
+
+	// A short tree joined below a tall one
+	Tree small;
+	small[-5] = 5;
+	upper.join(small);
+	ASSERT_EQ(-5, upper.begin()->key);
+	ASSERT_FALSE(small.contains(-5));
+	Tree clash;
+	clash[1000] = 0;
+	clash[3000] = 0;
+	ASSERT_THROW(upper.join(clash), OverlappingKeysException);
+	ASSERT_TRUE(clash.contains(3000)) << "Expected a failed join to leave both trees alone";
+	upper.remove(-5);
+
+	b.join(upper);
+	ASSERT_EQ(ITERATIONS, (int) b.rank(ITERATIONS));
+	int expected = 0;
+	for (Tree::Iterator i = b.begin(); i != b.end(); ++i) {
+		ASSERT_EQ(expected++, i->key);
+	}
+	ASSERT_EQ(ITERATIONS, expected);
+
+	b.splitAt(-1, upper);
+	ASSERT_TRUE(b.begin() == b.end());
+	ASSERT_EQ(ITERATIONS, (int) upper.rank(ITERATIONS));
+}
+
+TEST(BTreeTest, SplitAtArenaOutlivesSource)
+{
+	typedef BTree<int, Data, 4, BTree_ListPages, BTree_ArenaNodes> Tree;
+	Data fill("test");
+	Tree upper;
+	{
+		Tree b;
+		for (int i = 0; i < 100; i++) {
+			b[i] = fill;
+		}
+		b.splitAt(50, upper);
+	}
+	for (int i = 100; i < 200; i++) {
+		upper[i] = fill;
+	}
+	ASSERT_TRUE(upper.valid());
+	for (int i = 0; i < 200; i++) {
+		ASSERT_EQ(i >= 50, upper.contains(i));
+	}
+}
+
 // custom key comparator
 // proper iterators
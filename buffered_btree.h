@@ -0,0 +1,532 @@
+#ifndef BUFFERED_BTREE_H
+#define BUFFERED_BTREE_H
+
+#include "btree.h"
+#include <algorithm>
+#include <vector>
+
+namespace BufferedBTree_private
+{
+	/**
+	 * A pending change to one key, waiting in an index buffer to be carried down to its leaf.
+	 */
+	template<class K, class V>
+	struct Message
+	{
+		K key;
+		V value;
+		/**
+		 * Whether the key is to be removed, rather than given the value.
+		 */
+		bool remove;
+	};
+
+	template<class K, class V>
+	struct MessageKeyLess
+	{
+		bool operator()(const Message<K, V>& m, const K& key) const
+		{
+			return m.key < key;
+		}
+
+		bool operator()(const K& key, const Message<K, V>& m) const
+		{
+			return key < m.key;
+		}
+	};
+
+	/**
+	 * Merge a run of newer messages into a sorted buffer of older ones. Where both hold a message for the same key,
+	 * only the newer one is kept.
+	 */
+	template<class K, class V>
+	void mergeMessages(std::vector<Message<K, V> >& buffer, const Message<K, V>* begin, const Message<K, V>* end)
+	{
+		std::vector<Message<K, V> > merged;
+		merged.reserve(buffer.size() + (end - begin));
+		typename std::vector<Message<K, V> >::const_iterator old = buffer.begin();
+		while (old != buffer.end() && begin != end) {
+			if (old->key < begin->key) {
+				merged.push_back(*old++);
+			} else {
+				if (!(begin->key < old->key)) {
+					++old;
+				}
+				merged.push_back(*begin++);
+			}
+		}
+		merged.insert(merged.end(), old, typename std::vector<Message<K, V> >::const_iterator(buffer.end()));
+		merged.insert(merged.end(), begin, end);
+		buffer.swap(merged);
+	}
+
+	template<class K, class V, int LEAF_SIZE>
+	struct Node;
+
+	template<class K, class V, int LEAF_SIZE>
+	struct Leaf;
+
+	template<class K, class V, int LEAF_SIZE>
+	struct Index;
+
+	template<class K, class V, int LEAF_SIZE>
+	struct Node
+	{
+		bool leaf;
+
+		Node(bool isLeaf) : leaf(isLeaf) {}
+
+		Leaf<K, V, LEAF_SIZE>* asLeaf()
+		{
+			return static_cast<Leaf<K, V, LEAF_SIZE>*>(this);
+		}
+
+		Index<K, V, LEAF_SIZE>* asIndex()
+		{
+			return static_cast<Index<K, V, LEAF_SIZE>*>(this);
+		}
+
+		const Leaf<K, V, LEAF_SIZE>* asLeaf() const
+		{
+			return static_cast<const Leaf<K, V, LEAF_SIZE>*>(this);
+		}
+
+		const Index<K, V, LEAF_SIZE>* asIndex() const
+		{
+			return static_cast<const Index<K, V, LEAF_SIZE>*>(this);
+		}
+	};
+
+	template<class K, class V, int LEAF_SIZE>
+	struct Leaf : public Node<K, V, LEAF_SIZE>
+	{
+		int count;
+		K keys[LEAF_SIZE];
+		V values[LEAF_SIZE];
+
+		Leaf() : Node<K, V, LEAF_SIZE>(true), count(0) {}
+
+		/**
+		 * @return the index of the given key, or -1 if it is absent
+		 */
+		int find(const K& key) const
+		{
+			int i = BTree_private::BTree_KeySearch<K>::upperBound(keys, count, key) - 1;
+			return i >= 0 && keys[i] == key ? i : -1;
+		}
+	};
+
+	/**
+	 * An index node. keys[i] separates children[i], which holds lower keys, from children[i + 1], which holds keys
+	 * greater than or equal to it. The buffer holds messages for keys beneath the index, sorted by key, at most one
+	 * per key.
+	 */
+	template<class K, class V, int LEAF_SIZE>
+	struct Index : public Node<K, V, LEAF_SIZE>
+	{
+		std::vector<K> keys;
+		std::vector<Node<K, V, LEAF_SIZE>*> children;
+		std::vector<Message<K, V> > buffer;
+
+		Index() : Node<K, V, LEAF_SIZE>(false) {}
+
+		/**
+		 * @return the index of the child beneath which the given key is stored
+		 */
+		int childIndex(const K& key) const
+		{
+			return std::upper_bound(keys.begin(), keys.end(), key) - keys.begin();
+		}
+
+		/**
+		 * @return the message buffered for the given key, or 0
+		 */
+		const Message<K, V>* findMessage(const K& key) const
+		{
+			typename std::vector<Message<K, V> >::const_iterator i = std::lower_bound(buffer.begin(), buffer.end(),
+				key, MessageKeyLess<K, V>());
+			return i != buffer.end() && !(key < i->key) ? &*i : 0;
+		}
+	};
+}; // namespace BufferedBTree_private
+
+/**
+ * A write-optimized B+tree (a B-epsilon tree). Each index carries a buffer of pending changes for the keys beneath
+ * it. insert and remove only add a message to the root's buffer; when a buffer overflows, the messages bound for the
+ * child with the most of them are moved down to it in one batch. A batch reaching a leaf is merged into it in one
+ * pass. The cost of walking down the tree, and of the cache misses on the way, is shared by every message in a batch
+ * instead of being paid by each insertion, at the price of lookups having to check the buffers on their way down.
+ *
+ * An insertion replaces any value the key already has, so it serves as an upsert as well. Since an insertion does
+ * not look for the key, the number of keys in the tree is not known. Leaves emptied by removals are not merged.
+ * @tparam K the type of the keys
+ * @tparam V the type of the values
+ * @tparam LEAF_SIZE the most elements held in a leaf
+ * @tparam FANOUT the most children of an index
+ * @tparam BUFFER_SIZE the most messages buffered in an index before some are flushed to a child
+ */
+template<class K, class V, int LEAF_SIZE = 64, int FANOUT = 16, int BUFFER_SIZE = 256>
+class BufferedBTree
+{
+	static_assert(LEAF_SIZE >= 2 && FANOUT >= 3 && BUFFER_SIZE >= 1, "BufferedBTree nodes are too small");
+
+	typedef BufferedBTree_private::Message<K, V> Message;
+	typedef BufferedBTree_private::Node<K, V, LEAF_SIZE> Node;
+	typedef BufferedBTree_private::Leaf<K, V, LEAF_SIZE> Leaf;
+	typedef BufferedBTree_private::Index<K, V, LEAF_SIZE> Index;
+
+	/**
+	 * A node split off another, to be added to their parent after it.
+	 */
+	struct Split
+	{
+		K separator;
+		Node* node;
+	};
+
+	Node* root_;
+
+	BufferedBTree(const BufferedBTree&);
+	BufferedBTree& operator=(const BufferedBTree&);
+
+	static void destroy(Node* node)
+	{
+		if (node->leaf) {
+			delete node->asLeaf();
+		} else {
+			Index* index = node->asIndex();
+			for (size_t i = 0; i < index->children.size(); ++i) {
+				destroy(index->children[i]);
+			}
+			delete index;
+		}
+	}
+
+	/**
+	 * Apply a sorted batch of messages to a leaf, splitting it into as many leaves as it takes to hold the result.
+	 */
+	static void applyToLeaf(Leaf* leaf, const Message* begin, const Message* end, std::vector<Split>& splits)
+	{
+		std::vector<K> keys;
+		std::vector<V> values;
+		keys.reserve(leaf->count + (end - begin));
+		values.reserve(leaf->count + (end - begin));
+		int i = 0;
+		while (i < leaf->count || begin != end) {
+			if (begin == end || (i < leaf->count && leaf->keys[i] < begin->key)) {
+				keys.push_back(leaf->keys[i]);
+				values.push_back(leaf->values[i]);
+				++i;
+			} else {
+				if (i < leaf->count && !(begin->key < leaf->keys[i])) {
+					++i;
+				}
+				if (!begin->remove) {
+					keys.push_back(begin->key);
+					values.push_back(begin->value);
+				}
+				++begin;
+			}
+		}
+
+		int total = keys.size();
+		int pieces = total <= LEAF_SIZE ? 1 : (total + LEAF_SIZE - 1) / LEAF_SIZE;
+		int next = 0;
+		for (int p = 0; p < pieces; ++p) {
+			int size = total / pieces + (p < total % pieces ? 1 : 0);
+			Leaf* piece = p == 0 ? leaf : new Leaf;
+			std::copy(keys.begin() + next, keys.begin() + next + size, piece->keys);
+			std::copy(values.begin() + next, values.begin() + next + size, piece->values);
+			piece->count = size;
+			if (p > 0) {
+				Split split = { keys[next], piece };
+				splits.push_back(split);
+			}
+			next += size;
+		}
+	}
+
+	/**
+	 * Move the messages bound for the child with the most of them down to that child, adding any nodes split off the
+	 * child to the index.
+	 */
+	static void flushLargest(Index* index)
+	{
+		std::vector<Message>& buffer = index->buffer;
+		int children = index->children.size();
+		int best = 0;
+		size_t bestBegin = 0;
+		size_t bestEnd = 0;
+		size_t begin = 0;
+		for (int c = 0; c < children; ++c) {
+			size_t end = c == children - 1 ? buffer.size() : std::lower_bound(buffer.begin() + begin, buffer.end(),
+				index->keys[c], BufferedBTree_private::MessageKeyLess<K, V>()) - buffer.begin();
+			if (end - begin > bestEnd - bestBegin) {
+				best = c;
+				bestBegin = begin;
+				bestEnd = end;
+			}
+			begin = end;
+		}
+
+		std::vector<Message> batch(buffer.begin() + bestBegin, buffer.begin() + bestEnd);
+		buffer.erase(buffer.begin() + bestBegin, buffer.begin() + bestEnd);
+		std::vector<Split> splits;
+		apply(index->children[best], batch.data(), batch.data() + batch.size(), splits);
+		for (size_t s = 0; s < splits.size(); ++s) {
+			index->keys.insert(index->keys.begin() + best + s, splits[s].separator);
+			index->children.insert(index->children.begin() + best + s + 1, splits[s].node);
+		}
+	}
+
+	/**
+	 * Split an index with too many children into as many indexes as it takes, sharing out its buffer between them.
+	 */
+	static void splitIndex(Index* index, std::vector<Split>& splits)
+	{
+		int total = index->children.size();
+		int pieces = (total + FANOUT - 1) / FANOUT;
+		std::vector<K> keys;
+		std::vector<Node*> children;
+		std::vector<Message> buffer;
+		keys.swap(index->keys);
+		children.swap(index->children);
+		buffer.swap(index->buffer);
+
+		int next = 0;
+		size_t nextMessage = 0;
+		for (int p = 0; p < pieces; ++p) {
+			int size = total / pieces + (p < total % pieces ? 1 : 0);
+			Index* piece = p == 0 ? index : new Index;
+			piece->children.assign(children.begin() + next, children.begin() + next + size);
+			piece->keys.assign(keys.begin() + next, keys.begin() + next + size - 1);
+			size_t endMessage = p == pieces - 1 ? buffer.size() : std::lower_bound(buffer.begin() + nextMessage,
+				buffer.end(), keys[next + size - 1], BufferedBTree_private::MessageKeyLess<K, V>()) - buffer.begin();
+			piece->buffer.assign(buffer.begin() + nextMessage, buffer.begin() + endMessage);
+			if (p > 0) {
+				Split split = { keys[next - 1], piece };
+				splits.push_back(split);
+			}
+			next += size;
+			nextMessage = endMessage;
+		}
+	}
+
+	/**
+	 * Apply a sorted batch of messages, newer than any beneath the node, to the node.
+	 * @param splits receives any nodes split off the node, in order of key
+	 */
+	static void apply(Node* node, const Message* begin, const Message* end, std::vector<Split>& splits)
+	{
+		if (node->leaf) {
+			applyToLeaf(node->asLeaf(), begin, end, splits);
+			return;
+		}
+		Index* index = node->asIndex();
+		BufferedBTree_private::mergeMessages(index->buffer, begin, end);
+		while (index->buffer.size() > (size_t) BUFFER_SIZE) {
+			flushLargest(index);
+		}
+		if (index->children.size() > (size_t) FANOUT) {
+			splitIndex(index, splits);
+		}
+	}
+
+	/**
+	 * Add nodes split off the root under a new root.
+	 */
+	void growRoot(std::vector<Split>& splits)
+	{
+		while (!splits.empty()) {
+			Index* root = new Index;
+			root->children.push_back(root_);
+			for (size_t s = 0; s < splits.size(); ++s) {
+				root->keys.push_back(splits[s].separator);
+				root->children.push_back(splits[s].node);
+			}
+			root_ = root;
+			splits.clear();
+			if (root->children.size() > (size_t) FANOUT) {
+				splitIndex(root, splits);
+			}
+		}
+	}
+
+	void send(const Message& message)
+	{
+		std::vector<Split> splits;
+		if (root_->leaf) {
+			applyToLeaf(root_->asLeaf(), &message, &message + 1, splits);
+		} else {
+			Index* root = root_->asIndex();
+			std::vector<Message>& buffer = root->buffer;
+			typename std::vector<Message>::iterator i = std::lower_bound(buffer.begin(), buffer.end(), message.key,
+				BufferedBTree_private::MessageKeyLess<K, V>());
+			if (i != buffer.end() && !(message.key < i->key)) {
+				*i = message;
+				return;
+			}
+			buffer.insert(i, message);
+			if (buffer.size() > (size_t) BUFFER_SIZE) {
+				flushLargest(root);
+				if (root->children.size() > (size_t) FANOUT) {
+					splitIndex(root, splits);
+				}
+			}
+		}
+		growRoot(splits);
+	}
+
+	int depth(const Node* node) const
+	{
+		return node->leaf ? 1 : 1 + depth(node->asIndex()->children[0]);
+	}
+
+	/**
+	 * Check that keys and messages beneath a node are sorted and lie in [lo, hi), and that every leaf is at the same
+	 * depth.
+	 */
+	bool valid(const Node* node, const K* lo, const K* hi, int level, int leafLevel) const
+	{
+		if (node->leaf) {
+			const Leaf* leaf = node->asLeaf();
+			for (int i = 0; i < leaf->count; ++i) {
+				if ((lo != 0 && leaf->keys[i] < *lo) || (hi != 0 && !(leaf->keys[i] < *hi))
+						|| (i > 0 && !(leaf->keys[i - 1] < leaf->keys[i]))) {
+					return false;
+				}
+			}
+			return level == leafLevel && leaf->count <= LEAF_SIZE;
+		}
+		const Index* index = node->asIndex();
+		if (index->children.size() != index->keys.size() + 1 || index->children.size() > (size_t) FANOUT
+				|| index->buffer.size() > (size_t) BUFFER_SIZE) {
+			return false;
+		}
+		for (size_t i = 0; i < index->buffer.size(); ++i) {
+			const K& key = index->buffer[i].key;
+			if ((lo != 0 && key < *lo) || (hi != 0 && !(key < *hi)) || (i > 0 && !(index->buffer[i - 1].key < key))) {
+				return false;
+			}
+		}
+		for (size_t i = 0; i < index->children.size(); ++i) {
+			const K* childLo = i == 0 ? lo : &index->keys[i - 1];
+			const K* childHi = i == index->keys.size() ? hi : &index->keys[i];
+			if ((childLo != 0 && childHi != 0 && !(*childLo < *childHi))
+					|| !valid(index->children[i], childLo, childHi, level + 1, leafLevel)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+public:
+	BufferedBTree()
+	{
+		root_ = new Leaf;
+	}
+
+	~BufferedBTree()
+	{
+		destroy(root_);
+	}
+
+	/**
+	 * Associate a value with a key, replacing any value already associated with it.
+	 */
+	void insert(const K& key, const V& value)
+	{
+		Message message = { key, value, false };
+		send(message);
+	}
+
+	/**
+	 * Remove a key, if it is present.
+	 */
+	void remove(const K& key)
+	{
+		Message message = { key, V(), true };
+		send(message);
+	}
+
+	/**
+	 * Look up a key. The first message for the key met on the way down is the newest, and decides the result.
+	 * @param value receives the value associated with the key, if there is one
+	 * @return true if the key was found
+	 */
+	bool find(const K& key, V& value) const
+	{
+		const Node* node = root_;
+		while (!node->leaf) {
+			const Index* index = node->asIndex();
+			const Message* message = index->findMessage(key);
+			if (message != 0) {
+				if (message->remove) {
+					return false;
+				}
+				value = message->value;
+				return true;
+			}
+			node = index->children[index->childIndex(key)];
+		}
+		const Leaf* leaf = node->asLeaf();
+		int i = leaf->find(key);
+		if (i < 0) {
+			return false;
+		}
+		value = leaf->values[i];
+		return true;
+	}
+
+	bool contains(const K& key) const
+	{
+		V value;
+		return find(key, value);
+	}
+
+	/**
+	 * Move every buffered message down to its leaf.
+	 */
+	void flush()
+	{
+		std::vector<Split> splits;
+		flushAll(root_, splits);
+		growRoot(splits);
+	}
+
+	int depth() const
+	{
+		return depth(root_);
+	}
+
+	bool valid() const
+	{
+		return valid(root_, 0, 0, 1, depth(root_));
+	}
+
+private:
+	static void flushAll(Node* node, std::vector<Split>& splits)
+	{
+		if (node->leaf) {
+			return;
+		}
+		Index* index = node->asIndex();
+		while (!index->buffer.empty()) {
+			flushLargest(index);
+		}
+		for (size_t i = 0; i < index->children.size(); ++i) {
+			std::vector<Split> childSplits;
+			flushAll(index->children[i], childSplits);
+			for (size_t s = 0; s < childSplits.size(); ++s) {
+				index->keys.insert(index->keys.begin() + i + s, childSplits[s].separator);
+				index->children.insert(index->children.begin() + i + s + 1, childSplits[s].node);
+			}
+			i += childSplits.size();
+		}
+		if (index->children.size() > (size_t) FANOUT) {
+			splitIndex(index, splits);
+		}
+	}
+};
+
+#endif
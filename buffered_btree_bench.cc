@@ -0,0 +1,53 @@
+#include "buffered_btree.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static unsigned long long nextRandom(unsigned long long& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+/**
+ * Insert n random keys, then look up a million random keys.
+ */
+template<class Tree>
+static void bench(const char* name, int n)
+{
+	const int LOOKUPS = 1000000;
+	Tree* tree = new Tree;
+	unsigned long long state = 88172645463325252ULL;
+	double start = now();
+	for (int i = 0; i < n; i++) {
+		tree->insert((int) (nextRandom(state) >> 33), i);
+	}
+	double inserted = now();
+	int found = 0;
+	for (int i = 0; i < LOOKUPS; i++) {
+		found += tree->contains((int) (nextRandom(state) >> 33));
+	}
+	double looked = now();
+	printf("  %-10s insert %6.3f us/op (%6.2f M/s)   lookup %6.3f us/op   (%d found)\n", name,
+		(inserted - start) * 1e6 / n, n / (inserted - start) / 1e6, (looked - inserted) * 1e6 / LOOKUPS, found);
+	delete tree;
+}
+
+int main(int argc, char** argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : 16 << 20;
+	for (int size = 1 << 20; size <= n; size *= 4) {
+		printf("%d random keys:\n", size);
+		bench<BTree<int, int, 64, BTree_ColumnPages> >("BTree", size);
+		bench<BufferedBTree<int, int> >("Buffered", size);
+		bench<BufferedBTree<int, int, 128, 16, 1024> >("Buffered+", size);
+	}
+	return 0;
+}
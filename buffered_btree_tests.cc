@@ -0,0 +1,80 @@
+#include "buffered_btree.h"
+#include "gtest/gtest.h"
+#include <cstdlib>
+#include <map>
+
+TEST(BufferedBTreeTest, InsertFindRemove) {
+	BufferedBTree<int, int, 4, 4, 8> tree;
+	for (int i = 0; i < 1000; i++) {
+		tree.insert((i * 37) % 1000, i);
+	}
+	ASSERT_TRUE(tree.valid());
+	EXPECT_GT(tree.depth(), 3);
+	for (int i = 0; i < 1000; i++) {
+		int value;
+		ASSERT_TRUE(tree.find((i * 37) % 1000, value));
+		EXPECT_EQ(i, value);
+	}
+	EXPECT_FALSE(tree.contains(1000));
+
+	// An upsert of a key still waiting in a buffer replaces its value there
+	tree.insert(5, -5);
+	int value;
+	ASSERT_TRUE(tree.find(5, value));
+	EXPECT_EQ(-5, value);
+
+	for (int i = 0; i < 1000; i += 2) {
+		tree.remove(i);
+	}
+	ASSERT_TRUE(tree.valid());
+	for (int i = 0; i < 1000; i++) {
+		EXPECT_EQ(i % 2 == 1, tree.contains(i));
+	}
+}
+
+TEST(BufferedBTreeTest, FlushMovesEveryMessageToTheLeaves) {
+	BufferedBTree<int, int, 4, 4, 8> tree;
+	for (int i = 0; i < 500; i++) {
+		tree.insert(i, i);
+	}
+	for (int i = 0; i < 500; i += 3) {
+		tree.remove(i);
+	}
+	tree.flush();
+	ASSERT_TRUE(tree.valid());
+	for (int i = 0; i < 500; i++) {
+		int value;
+		ASSERT_EQ(i % 3 != 0, tree.find(i, value));
+		if (i % 3 != 0) {
+			EXPECT_EQ(i, value);
+		}
+	}
+}
+
+TEST(BufferedBTreeTest, RandomOperationsMatchMap) {
+	BufferedBTree<int, int, 6, 5, 16> tree;
+	std::map<int, int> expected;
+	srand(7);
+	for (int i = 0; i < 20000; i++) {
+		int key = rand() % 2000;
+		if (rand() % 3 == 0) {
+			tree.remove(key);
+			expected.erase(key);
+		} else {
+			tree.insert(key, i);
+			expected[key] = i;
+		}
+		if (i % 1000 == 0) {
+			ASSERT_TRUE(tree.valid());
+		}
+	}
+	ASSERT_TRUE(tree.valid());
+	for (int key = 0; key < 2000; key++) {
+		int value;
+		std::map<int, int>::const_iterator it = expected.find(key);
+		ASSERT_EQ(it != expected.end(), tree.find(key, value));
+		if (it != expected.end()) {
+			EXPECT_EQ(it->second, value);
+		}
+	}
+}
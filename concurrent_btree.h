@@ -0,0 +1,937 @@
+#ifndef CONCURRENT_BTREE_H
+#define CONCURRENT_BTREE_H
+
+#include "btree.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Thrown when a thread first operates on a ConcurrentBTree while MAX_THREADS other threads which have done so are still
+ * running.
+ */
+class TooManyThreadsException : public std::exception {
+	virtual const char* what() const throw() {
+		return "ConcurrentBTree used by too many threads at once";
+	}
+};
+
+namespace ConcurrentBTree_private
+{
+	/**
+	 * A version counter which doubles as a write lock. Readers take no lock: they note the version before reading a
+	 * node and check that it is unchanged afterwards, restarting if it is not. Writers lock the node by bumping the
+	 * version with a compare-and-swap, so a lock can only be taken on a node which has not changed since it was read.
+	 *
+	 * Bit 1 of the version is set while the node is locked, and bit 0 once the node has been unlinked from the tree.
+	 */
+	class OptimisticLock
+	{
+	private:
+		std::atomic<uint64_t> version_;
+
+		static bool isLocked(uint64_t version)
+		{
+			return (version & 2) != 0;
+		}
+
+		static bool isObsolete(uint64_t version)
+		{
+			return (version & 1) != 0;
+		}
+
+	public:
+		OptimisticLock() : version_(4) {}
+
+		/**
+		 * Begin reading the node.
+		 * @param restart set to true if the node is locked or obsolete, and so cannot be read now
+		 * @return the version to validate the read against
+		 */
+		uint64_t readLockOrRestart(bool& restart) const
+		{
+			uint64_t version = version_.load(std::memory_order_acquire);
+			if (isLocked(version) || isObsolete(version)) {
+				std::this_thread::yield();
+				restart = true;
+			}
+			return version;
+		}
+
+		/**
+		 * Check that the node has not changed since the given version was read.
+		 * @param restart set to true if it has
+		 */
+		void readUnlockOrRestart(uint64_t version, bool& restart) const
+		{
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (version != version_.load(std::memory_order_relaxed)) {
+				restart = true;
+			}
+		}
+
+		/**
+		 * Turn a read of the given version into a write lock.
+		 * @param restart set to true if the node has changed since that version, in which case it is not locked
+		 */
+		void upgradeToWriteLockOrRestart(uint64_t& version, bool& restart)
+		{
+			if (version_.compare_exchange_strong(version, version + 2, std::memory_order_acquire)) {
+				version = version + 2;
+			} else {
+				restart = true;
+			}
+		}
+
+		void writeUnlock()
+		{
+			version_.fetch_add(2, std::memory_order_release);
+		}
+
+		/**
+		 * Unlock a node which has been unlinked from the tree, so that readers which reach it will restart.
+		 */
+		void writeUnlockObsolete()
+		{
+			version_.fetch_add(3, std::memory_order_release);
+		}
+	};
+
+	/**
+	 * Epoch-based reclamation for nodes unlinked from a tree. Each thread announces the global epoch while it is inside
+	 * a tree operation. A retired node is freed once every thread inside an operation announced an epoch later than
+	 * the one in which the node was retired, since no such thread can still hold a pointer to it.
+	 */
+	class EpochManager
+	{
+	public:
+		/**
+		 * The most threads which may be running at once having operated on any ConcurrentBTree. A thread holds its
+		 * number from its first operation until it exits.
+		 */
+		static const int MAX_THREADS = 256;
+
+	private:
+		/**
+		 * The epoch announced by one thread, or 0 if the thread is not inside an operation. Each slot has a cache line
+		 * to itself.
+		 */
+		struct Slot
+		{
+			std::atomic<uint64_t> epoch;
+			char padding[64 - sizeof(std::atomic<uint64_t>)];
+		};
+
+		struct Retired
+		{
+			void* node;
+			void (*free)(void*);
+			uint64_t epoch;
+		};
+
+		/**
+		 * Hands out thread numbers, and takes them back when threads exit so that they can be reused. A number is always
+		 * below MAX_THREADS, so that it indexes slots_.
+		 */
+		class ThreadRegistry
+		{
+		private:
+			std::mutex mutex_;
+			std::vector<bool> used_;
+
+		public:
+			/**
+			 * @throws TooManyThreadsException if every number is held by a running thread
+			 */
+			int acquire()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				for (size_t i = 0; i < used_.size(); ++i) {
+					if (!used_[i]) {
+						used_[i] = true;
+						return i;
+					}
+				}
+				if (used_.size() >= (size_t) MAX_THREADS) {
+					throw TooManyThreadsException();
+				}
+				used_.push_back(true);
+				return used_.size() - 1;
+			}
+
+			void release(int id)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				used_[id] = false;
+			}
+		};
+
+		struct ThreadId
+		{
+			int id;
+
+			ThreadId() : id(registry().acquire()) {}
+
+			~ThreadId()
+			{
+				registry().release(id);
+			}
+		};
+
+		static ThreadRegistry& registry()
+		{
+			static ThreadRegistry registry;
+			return registry;
+		}
+
+		static int threadId()
+		{
+			static thread_local ThreadId thread;
+			return thread.id;
+		}
+
+		/**
+		 * The number of retired nodes which triggers an attempt to free them.
+		 */
+		static const size_t RECLAIM_THRESHOLD = 64;
+
+		std::atomic<uint64_t> epoch_;
+		Slot slots_[MAX_THREADS];
+		std::mutex retiredMutex_;
+		std::vector<Retired> retired_;
+
+		/**
+		 * Free every retired node which no thread can still be reading. Must be called with retiredMutex_ held.
+		 */
+		void reclaim()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			uint64_t oldest = UINT64_MAX;
+			for (int i = 0; i < MAX_THREADS; ++i) {
+				uint64_t epoch = slots_[i].epoch.load(std::memory_order_acquire);
+				if (epoch != 0 && epoch < oldest) {
+					oldest = epoch;
+				}
+			}
+			size_t kept = 0;
+			for (size_t i = 0; i < retired_.size(); ++i) {
+				if (retired_[i].epoch < oldest) {
+					retired_[i].free(retired_[i].node);
+				} else {
+					retired_[kept++] = retired_[i];
+				}
+			}
+			retired_.resize(kept);
+		}
+
+		EpochManager(const EpochManager&);
+		EpochManager& operator=(const EpochManager&);
+
+	public:
+		EpochManager() : epoch_(1)
+		{
+			for (int i = 0; i < MAX_THREADS; ++i) {
+				slots_[i].epoch.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		/**
+		 * Frees every node still waiting. No thread may be inside an operation.
+		 */
+		~EpochManager()
+		{
+			for (size_t i = 0; i < retired_.size(); ++i) {
+				retired_[i].free(retired_[i].node);
+			}
+		}
+
+		void enter()
+		{
+			slots_[threadId()].epoch.store(epoch_.load(std::memory_order_acquire), std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+
+		void leave()
+		{
+			slots_[threadId()].epoch.store(0, std::memory_order_release);
+		}
+
+		/**
+		 * Hand over a node which has been unlinked from the tree, to be freed once no thread can be reading it.
+		 */
+		void retire(void* node, void (*free)(void*))
+		{
+			std::lock_guard<std::mutex> lock(retiredMutex_);
+			Retired r = { node, free, epoch_.fetch_add(1, std::memory_order_acq_rel) };
+			retired_.push_back(r);
+			if (retired_.size() >= RECLAIM_THRESHOLD) {
+				reclaim();
+			}
+		}
+
+		/**
+		 * @return the number of retired nodes not yet freed
+		 */
+		size_t pending()
+		{
+			std::lock_guard<std::mutex> lock(retiredMutex_);
+			return retired_.size();
+		}
+	};
+
+	/**
+	 * Keeps the calling thread inside an epoch for as long as it is in scope.
+	 */
+	class EpochGuard
+	{
+	private:
+		EpochManager& epochs_;
+
+	public:
+		EpochGuard(EpochManager& epochs) : epochs_(epochs)
+		{
+			epochs_.enter();
+		}
+
+		~EpochGuard()
+		{
+			epochs_.leave();
+		}
+	};
+
+	template<class K, int PAGE_SIZE>
+	struct Node
+	{
+		OptimisticLock lock;
+		bool leaf;
+		/**
+		 * The number of keys in the node. Readers may see a torn value while a writer holds the lock, so it is
+		 * clamped before use and the read validated afterwards.
+		 */
+		int count;
+		K keys[PAGE_SIZE];
+
+		Node(bool isLeaf) : leaf(isLeaf), count(0) {}
+
+		int safeCount() const
+		{
+			int n = count;
+			return n < 0 ? 0 : n > PAGE_SIZE ? PAGE_SIZE : n;
+		}
+
+		/**
+		 * @return the index of the first key greater than the given key
+		 */
+		int upperBound(const K& key) const
+		{
+			return BTree_private::BTree_KeySearch<K>::upperBound(keys, safeCount(), key);
+		}
+
+		bool full() const
+		{
+			return count == PAGE_SIZE;
+		}
+	};
+
+	template<class K, class V, int PAGE_SIZE>
+	struct Leaf : public Node<K, PAGE_SIZE>
+	{
+		V values[PAGE_SIZE];
+
+		Leaf() : Node<K, PAGE_SIZE>(true) {}
+
+		/**
+		 * @return the index of the given key, or -1 if it is absent
+		 */
+		int find(const K& key) const
+		{
+			int i = this->upperBound(key) - 1;
+			return i >= 0 && this->keys[i] == key ? i : -1;
+		}
+
+		/**
+		 * Insert a key which is not already present. The leaf must not be full.
+		 */
+		void insert(const K& key, const V& value)
+		{
+			int i = this->upperBound(key);
+			memmove(&this->keys[i + 1], &this->keys[i], (this->count - i) * sizeof(K));
+			memmove(&values[i + 1], &values[i], (this->count - i) * sizeof(V));
+			this->keys[i] = key;
+			values[i] = value;
+			this->count++;
+		}
+
+		void removeAt(int i)
+		{
+			memmove(&this->keys[i], &this->keys[i + 1], (this->count - i - 1) * sizeof(K));
+			memmove(&values[i], &values[i + 1], (this->count - i - 1) * sizeof(V));
+			this->count--;
+		}
+
+		/**
+		 * Move the upper half of the keys into the given empty leaf.
+		 * @return the lowest key of the new leaf, which separates it from this one
+		 */
+		K split(Leaf* newLeaf)
+		{
+			int keep = this->count / 2;
+			newLeaf->count = this->count - keep;
+			memcpy(newLeaf->keys, &this->keys[keep], newLeaf->count * sizeof(K));
+			memcpy(newLeaf->values, &values[keep], newLeaf->count * sizeof(V));
+			this->count = keep;
+			return newLeaf->keys[0];
+		}
+
+		/**
+		 * Append the contents of the following leaf. The two must fit in one leaf.
+		 */
+		void merge(const Leaf* right)
+		{
+			memcpy(&this->keys[this->count], right->keys, right->count * sizeof(K));
+			memcpy(&values[this->count], right->values, right->count * sizeof(V));
+			this->count += right->count;
+		}
+	};
+
+	/**
+	 * An index node. keys[i] separates children[i], which holds lower keys, from children[i + 1], which holds keys
+	 * greater than or equal to it.
+	 */
+	template<class K, int PAGE_SIZE>
+	struct Inner : public Node<K, PAGE_SIZE>
+	{
+		Node<K, PAGE_SIZE>* children[PAGE_SIZE + 1];
+
+		Inner() : Node<K, PAGE_SIZE>(false) {}
+
+		/**
+		 * Insert a separator and the child holding the keys from it upwards. The node must not be full.
+		 */
+		void insert(const K& key, Node<K, PAGE_SIZE>* child)
+		{
+			int i = this->upperBound(key);
+			memmove(&this->keys[i + 1], &this->keys[i], (this->count - i) * sizeof(K));
+			memmove(&children[i + 2], &children[i + 1], (this->count - i) * sizeof(Node<K, PAGE_SIZE>*));
+			this->keys[i] = key;
+			children[i + 1] = child;
+			this->count++;
+		}
+
+		/**
+		 * Remove the separator at index i together with the child to its right.
+		 */
+		void removeAt(int i)
+		{
+			memmove(&this->keys[i], &this->keys[i + 1], (this->count - i - 1) * sizeof(K));
+			memmove(&children[i + 1], &children[i + 2], (this->count - i - 1) * sizeof(Node<K, PAGE_SIZE>*));
+			this->count--;
+		}
+
+		/**
+		 * Move the upper half of the separators and children into the given empty node.
+		 * @return the separator between this node and the new one, which is removed from both
+		 */
+		K split(Inner* newInner)
+		{
+			int keep = this->count / 2;
+			K separator = this->keys[keep];
+			newInner->count = this->count - keep - 1;
+			memcpy(newInner->keys, &this->keys[keep + 1], newInner->count * sizeof(K));
+			memcpy(newInner->children, &children[keep + 1], (newInner->count + 1) * sizeof(Node<K, PAGE_SIZE>*));
+			this->count = keep;
+			return separator;
+		}
+	};
+
+	template<class T>
+	void freeNode(void* node)
+	{
+		delete static_cast<T*>(node);
+	}
+}; // namespace ConcurrentBTree_private
+
+/**
+ * A B+tree which may be read and written by many threads at once. Readers take no locks at all: they validate the
+ * version of each node they pass through, and restart from the root if a writer changed it under them. Writers lock
+ * only the nodes they modify. Nodes unlinked by remove are freed through epoch-based reclamation, once no reader can
+ * still be looking at them.
+ *
+ * Keys and values are copied in and out of the tree, and must be trivially copyable, since readers may copy them
+ * while a writer is changing them (the copy is then discarded). Full nodes are split on the way down. Leaves left
+ * less than a quarter full by remove are merged with a neighbour where they fit; indexes are only collapsed at the
+ * root.
+ * @tparam K the type of the keys
+ * @tparam V the type of the values
+ * @tparam PAGE_SIZE the most keys held in one node
+ */
+template<class K, class V, int PAGE_SIZE = DEFAULT_PAGE_SIZE>
+class ConcurrentBTree
+{
+	static_assert(std::is_trivially_copyable<K>::value, "ConcurrentBTree keys must be trivially copyable");
+	static_assert(std::is_trivially_copyable<V>::value, "ConcurrentBTree values must be trivially copyable");
+	static_assert(PAGE_SIZE >= 4, "ConcurrentBTree pages must hold at least four keys");
+
+	typedef ConcurrentBTree_private::Node<K, PAGE_SIZE> Node;
+	typedef ConcurrentBTree_private::Leaf<K, V, PAGE_SIZE> Leaf;
+	typedef ConcurrentBTree_private::Inner<K, PAGE_SIZE> Inner;
+	typedef ConcurrentBTree_private::EpochGuard EpochGuard;
+
+	std::atomic<Node*> root_;
+	mutable ConcurrentBTree_private::EpochManager epochs_;
+
+	ConcurrentBTree(const ConcurrentBTree&);
+	ConcurrentBTree& operator=(const ConcurrentBTree&);
+
+	static void destroy(Node* node)
+	{
+		if (node->leaf) {
+			delete static_cast<Leaf*>(node);
+		} else {
+			Inner* inner = static_cast<Inner*>(node);
+			for (int i = 0; i <= inner->count; ++i) {
+				destroy(inner->children[i]);
+			}
+			delete inner;
+		}
+	}
+
+	template<class T>
+	void retire(T* node)
+	{
+		epochs_.retire(node, ConcurrentBTree_private::freeNode<T>);
+	}
+
+	/**
+	 * Replace a full root with a new one above it and the node split from it.
+	 */
+	void growRoot(Node* oldRoot, const K& separator, Node* newNode)
+	{
+		Inner* newRoot = new Inner;
+		newRoot->count = 1;
+		newRoot->keys[0] = separator;
+		newRoot->children[0] = oldRoot;
+		newRoot->children[1] = newNode;
+		root_.store(newRoot, std::memory_order_release);
+	}
+
+	/**
+	 * One attempt at a lookup.
+	 * @return false if a concurrent change forced the attempt to be abandoned
+	 */
+	bool tryFind(const K& key, V* value, bool& found) const
+	{
+		bool restart = false;
+		Node* node = root_.load(std::memory_order_acquire);
+		uint64_t version = node->lock.readLockOrRestart(restart);
+		if (restart || node != root_.load(std::memory_order_acquire)) {
+			return false;
+		}
+
+		while (!node->leaf) {
+			Inner* inner = static_cast<Inner*>(node);
+			Node* child = inner->children[inner->upperBound(key)];
+			inner->lock.readUnlockOrRestart(version, restart);
+			if (restart) {
+				return false;
+			}
+			node = child;
+			version = node->lock.readLockOrRestart(restart);
+			if (restart) {
+				return false;
+			}
+		}
+
+		const Leaf* leaf = static_cast<Leaf*>(node);
+		int i = leaf->find(key);
+		V copy = V();
+		if (i >= 0) {
+			copy = leaf->values[i];
+		}
+		leaf->lock.readUnlockOrRestart(version, restart);
+		if (restart) {
+			return false;
+		}
+		found = i >= 0;
+		if (found && value != 0) {
+			*value = copy;
+		}
+		return true;
+	}
+
+	/**
+	 * One attempt at an insertion.
+	 * @return false if a concurrent change, or a split, means the attempt must be repeated
+	 */
+	bool tryInsert(const K& key, const V& value)
+	{
+		bool restart = false;
+		Node* node = root_.load(std::memory_order_acquire);
+		uint64_t version = node->lock.readLockOrRestart(restart);
+		if (restart || node != root_.load(std::memory_order_acquire)) {
+			return false;
+		}
+		Inner* parent = 0;
+		uint64_t parentVersion = 0;
+
+		while (!node->leaf) {
+			Inner* inner = static_cast<Inner*>(node);
+
+			// Split full indexes on the way down, so that a split below always has room in its parent
+			if (inner->full()) {
+				if (parent != 0) {
+					parent->lock.upgradeToWriteLockOrRestart(parentVersion, restart);
+					if (restart) {
+						return false;
+					}
+				}
+				inner->lock.upgradeToWriteLockOrRestart(version, restart);
+				if (restart) {
+					if (parent != 0) {
+						parent->lock.writeUnlock();
+					}
+					return false;
+				}
+				if (parent == 0 && inner != root_.load(std::memory_order_acquire)) {
+					inner->lock.writeUnlock();
+					return false;
+				}
+				Inner* newInner = new Inner;
+				K separator = inner->split(newInner);
+				if (parent != 0) {
+					parent->insert(separator, newInner);
+				} else {
+					growRoot(inner, separator, newInner);
+				}
+				inner->lock.writeUnlock();
+				if (parent != 0) {
+					parent->lock.writeUnlock();
+				}
+				return false;
+			}
+
+			if (parent != 0) {
+				parent->lock.readUnlockOrRestart(parentVersion, restart);
+				if (restart) {
+					return false;
+				}
+			}
+			parent = inner;
+			parentVersion = version;
+
+			node = inner->children[inner->upperBound(key)];
+			inner->lock.readUnlockOrRestart(version, restart);
+			if (restart) {
+				return false;
+			}
+			version = node->lock.readLockOrRestart(restart);
+			if (restart) {
+				return false;
+			}
+		}
+
+		Leaf* leaf = static_cast<Leaf*>(node);
+		if (leaf->full()) {
+			// The leaf may need splitting, which needs its parent locked first
+			if (parent != 0) {
+				parent->lock.upgradeToWriteLockOrRestart(parentVersion, restart);
+				if (restart) {
+					return false;
+				}
+			}
+			leaf->lock.upgradeToWriteLockOrRestart(version, restart);
+			if (restart) {
+				if (parent != 0) {
+					parent->lock.writeUnlock();
+				}
+				return false;
+			}
+			if (parent == 0 && leaf != root_.load(std::memory_order_acquire)) {
+				leaf->lock.writeUnlock();
+				return false;
+			}
+			int i = leaf->find(key);
+			if (i >= 0) {
+				leaf->values[i] = value;
+			} else {
+				Leaf* newLeaf = new Leaf;
+				K separator = leaf->split(newLeaf);
+				if (key < separator) {
+					leaf->insert(key, value);
+				} else {
+					newLeaf->insert(key, value);
+				}
+				if (parent != 0) {
+					parent->insert(separator, newLeaf);
+				} else {
+					growRoot(leaf, separator, newLeaf);
+				}
+			}
+			leaf->lock.writeUnlock();
+			if (parent != 0) {
+				parent->lock.writeUnlock();
+			}
+			return true;
+		}
+
+		leaf->lock.upgradeToWriteLockOrRestart(version, restart);
+		if (restart) {
+			return false;
+		}
+		if (parent != 0) {
+			parent->lock.readUnlockOrRestart(parentVersion, restart);
+			if (restart) {
+				leaf->lock.writeUnlock();
+				return false;
+			}
+		}
+		int i = leaf->find(key);
+		if (i >= 0) {
+			leaf->values[i] = value;
+		} else {
+			leaf->insert(key, value);
+		}
+		leaf->lock.writeUnlock();
+		return true;
+	}
+
+	/**
+	 * One attempt at a removal.
+	 * @return false if a concurrent change forced the attempt to be abandoned
+	 */
+	bool tryRemove(const K& key, bool& removed)
+	{
+		bool restart = false;
+		Node* node = root_.load(std::memory_order_acquire);
+		uint64_t version = node->lock.readLockOrRestart(restart);
+		if (restart || node != root_.load(std::memory_order_acquire)) {
+			return false;
+		}
+		Inner* parent = 0;
+		uint64_t parentVersion = 0;
+		int position = 0;
+
+		while (!node->leaf) {
+			Inner* inner = static_cast<Inner*>(node);
+			if (parent != 0) {
+				parent->lock.readUnlockOrRestart(parentVersion, restart);
+				if (restart) {
+					return false;
+				}
+			}
+			parent = inner;
+			parentVersion = version;
+
+			position = inner->upperBound(key);
+			node = inner->children[position];
+			inner->lock.readUnlockOrRestart(version, restart);
+			if (restart) {
+				return false;
+			}
+			version = node->lock.readLockOrRestart(restart);
+			if (restart) {
+				return false;
+			}
+		}
+
+		Leaf* leaf = static_cast<Leaf*>(node);
+		bool underfull = leaf->count - 1 < PAGE_SIZE / 4;
+
+		if (!underfull || parent == 0 || parent->count == 0) {
+			leaf->lock.upgradeToWriteLockOrRestart(version, restart);
+			if (restart) {
+				return false;
+			}
+			if (parent != 0) {
+				parent->lock.readUnlockOrRestart(parentVersion, restart);
+				if (restart) {
+					leaf->lock.writeUnlock();
+					return false;
+				}
+			}
+			int i = leaf->find(key);
+			if (i >= 0) {
+				leaf->removeAt(i);
+			}
+			leaf->lock.writeUnlock();
+			removed = i >= 0;
+			return true;
+		}
+
+		// Lock the parent, then the leaf and its neighbour from left to right, so that they can be merged
+		parent->lock.upgradeToWriteLockOrRestart(parentVersion, restart);
+		if (restart) {
+			return false;
+		}
+		int left = position < parent->count ? position : position - 1;
+		Leaf* leftLeaf = static_cast<Leaf*>(parent->children[left]);
+		Leaf* rightLeaf = static_cast<Leaf*>(parent->children[left + 1]);
+		Leaf* sibling = leftLeaf == leaf ? rightLeaf : leftLeaf;
+		uint64_t siblingVersion = sibling->lock.readLockOrRestart(restart);
+		if (restart) {
+			parent->lock.writeUnlock();
+			return false;
+		}
+		uint64_t leftVersion = leftLeaf == leaf ? version : siblingVersion;
+		uint64_t rightVersion = leftLeaf == leaf ? siblingVersion : version;
+		leftLeaf->lock.upgradeToWriteLockOrRestart(leftVersion, restart);
+		if (restart) {
+			parent->lock.writeUnlock();
+			return false;
+		}
+		rightLeaf->lock.upgradeToWriteLockOrRestart(rightVersion, restart);
+		if (restart) {
+			leftLeaf->lock.writeUnlock();
+			parent->lock.writeUnlock();
+			return false;
+		}
+
+		int i = leaf->find(key);
+		if (i >= 0) {
+			leaf->removeAt(i);
+		}
+		removed = i >= 0;
+
+		if (leftLeaf->count + rightLeaf->count <= PAGE_SIZE) {
+			leftLeaf->merge(rightLeaf);
+			parent->removeAt(left);
+			rightLeaf->lock.writeUnlockObsolete();
+			retire(rightLeaf);
+			leftLeaf->lock.writeUnlock();
+
+			if (parent->count == 0 && parent == root_.load(std::memory_order_acquire)) {
+				root_.store(leftLeaf, std::memory_order_release);
+				parent->lock.writeUnlockObsolete();
+				retire(parent);
+				return true;
+			}
+		} else {
+			rightLeaf->lock.writeUnlock();
+			leftLeaf->lock.writeUnlock();
+		}
+		parent->lock.writeUnlock();
+		return true;
+	}
+
+	int depth(const Node* node) const
+	{
+		return node->leaf ? 1 : 1 + depth(static_cast<const Inner*>(node)->children[0]);
+	}
+
+	/**
+	 * Check that the keys beneath a node are sorted, lie in [lo, hi), and that every leaf is at the same depth.
+	 */
+	bool valid(const Node* node, const K* lo, const K* hi, int level, int leafLevel) const
+	{
+		for (int i = 0; i < node->count; ++i) {
+			if ((lo != 0 && node->keys[i] < *lo) || (hi != 0 && !(node->keys[i] < *hi))) {
+				return false;
+			}
+			if (i > 0 && !(node->keys[i - 1] < node->keys[i])) {
+				return false;
+			}
+		}
+		if (node->leaf) {
+			return level == leafLevel;
+		}
+		const Inner* inner = static_cast<const Inner*>(node);
+		for (int i = 0; i <= inner->count; ++i) {
+			const K* childLo = i == 0 ? lo : &inner->keys[i - 1];
+			const K* childHi = i == inner->count ? hi : &inner->keys[i];
+			if (!valid(inner->children[i], childLo, childHi, level + 1, leafLevel)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+public:
+	ConcurrentBTree()
+	{
+		root_.store(new Leaf, std::memory_order_relaxed);
+	}
+
+	/**
+	 * No other thread may be using the tree.
+	 */
+	~ConcurrentBTree()
+	{
+		destroy(root_.load(std::memory_order_relaxed));
+	}
+
+	/**
+	 * Look up a key.
+	 * @param key the key to look up
+	 * @param value receives a copy of the value associated with the key, if there is one
+	 * @return true if the key was found
+	 */
+	bool find(const K& key, V& value) const
+	{
+		EpochGuard guard(epochs_);
+		bool found;
+		while (!tryFind(key, &value, found)) {
+		}
+		return found;
+	}
+
+	bool contains(const K& key) const
+	{
+		EpochGuard guard(epochs_);
+		bool found;
+		while (!tryFind(key, 0, found)) {
+		}
+		return found;
+	}
+
+	/**
+	 * Associate a value with a key, replacing any value already associated with it.
+	 */
+	void insert(const K& key, const V& value)
+	{
+		EpochGuard guard(epochs_);
+		while (!tryInsert(key, value)) {
+		}
+	}
+
+	/**
+	 * Remove a key, if it is present.
+	 * @return true if the key was removed
+	 */
+	bool remove(const K& key)
+	{
+		EpochGuard guard(epochs_);
+		bool removed;
+		while (!tryRemove(key, removed)) {
+		}
+		return removed;
+	}
+
+	/**
+	 * @return the number of nodes unlinked by remove but not yet freed
+	 */
+	size_t pendingReclamation() const
+	{
+		return epochs_.pending();
+	}
+
+	/**
+	 * Not safe to call while other threads are writing to the tree.
+	 */
+	int depth() const
+	{
+		return depth(root_.load(std::memory_order_acquire));
+	}
+
+	/**
+	 * Not safe to call while other threads are writing to the tree.
+	 */
+	bool valid() const
+	{
+		const Node* root = root_.load(std::memory_order_acquire);
+		return valid(root, 0, 0, 1, depth(root));
+	}
+};
+
+#endif
@@ -0,0 +1,109 @@
+#include "concurrent_btree.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static unsigned long long nextRandom(unsigned long long& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+/**
+ * The single-threaded BTree behind one global mutex, as the baseline for the lock-free readers of ConcurrentBTree.
+ */
+class LockedBTree
+{
+private:
+	BTree<int, int, 16, BTree_ColumnPages> tree_;
+	std::mutex mutex_;
+
+public:
+	bool contains(int key)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return tree_.contains(key);
+	}
+
+	void insert(int key, int value)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		tree_[key] = value;
+	}
+
+	void remove(int key)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		tree_.remove(key);
+	}
+};
+
+/**
+ * Run ops operations on each of the given number of threads against a tree holding every even key below n. Each
+ * operation is a lookup, except that writePercent of them alternately insert and remove an odd key.
+ */
+template<class Tree>
+static void benchMixed(const char* name, int n, int threads, int writePercent, int ops)
+{
+	Tree tree;
+	for (int i = 0; i < n; i += 2) {
+		tree.insert(i, i);
+	}
+
+	std::vector<std::thread> workers;
+	std::atomic<long> found(0);
+	double start = now();
+	for (int t = 0; t < threads; t++) {
+		workers.push_back(std::thread([&, t]() {
+			unsigned long long state = 88172645463325252ULL + t;
+			long hits = 0;
+			for (int i = 0; i < ops; i++) {
+				int key = nextRandom(state) % n;
+				if ((int)(nextRandom(state) % 100) < writePercent) {
+					if (i % 2 == 0) {
+						tree.insert(key | 1, key);
+					} else {
+						tree.remove(key | 1);
+					}
+				} else {
+					hits += tree.contains(key);
+				}
+			}
+			found += hits;
+		}));
+	}
+	for (int t = 0; t < threads; t++) {
+		workers[t].join();
+	}
+	double elapsed = now() - start;
+
+	printf("%-22s writes=%2d%% threads=%-3d %7.2f Mops/s\n", name, writePercent, threads,
+		(double)ops * threads / elapsed / 1e6);
+}
+
+int main(int argc, char** argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : 1000000;
+	int maxThreads = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+	const int OPS = 1000000;
+
+	for (int writePercent = 5; writePercent <= 50; writePercent += 45) {
+		for (int threads = 1; threads <= maxThreads; threads *= 2) {
+			benchMixed<ConcurrentBTree<int, int, 16> >("optimistic coupling", n, threads, writePercent, OPS);
+			benchMixed<LockedBTree>("global mutex", n, threads, writePercent, OPS);
+		}
+	}
+
+	return 0;
+}
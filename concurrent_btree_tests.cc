@@ -0,0 +1,186 @@
+#include "concurrent_btree.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static const int THREADS = 4;
+
+TEST(ConcurrentBTreeTest, InsertFindRemove) {
+	ConcurrentBTree<int, int, 8> tree;
+	for (int i = 0; i < 1000; i++) {
+		tree.insert((i * 37) % 1000, i);
+	}
+	ASSERT_TRUE(tree.valid());
+	EXPECT_GT(tree.depth(), 2);
+	for (int i = 0; i < 1000; i++) {
+		int value;
+		ASSERT_TRUE(tree.find((i * 37) % 1000, value));
+		EXPECT_EQ(i, value);
+	}
+	EXPECT_FALSE(tree.contains(1000));
+
+	tree.insert(5, -5);
+	int value;
+	ASSERT_TRUE(tree.find(5, value));
+	EXPECT_EQ(-5, value);
+
+	for (int i = 0; i < 1000; i += 2) {
+		EXPECT_TRUE(tree.remove(i));
+	}
+	EXPECT_FALSE(tree.remove(0));
+	ASSERT_TRUE(tree.valid());
+	for (int i = 0; i < 1000; i++) {
+		EXPECT_EQ(i % 2 == 1, tree.contains(i));
+	}
+}
+
+TEST(ConcurrentBTreeTest, RemoveMergesLeaves) {
+	ConcurrentBTree<int, int, 8> tree;
+	for (int i = 0; i < 24; i++) {
+		tree.insert(i, i);
+	}
+	EXPECT_EQ(2, tree.depth());
+	for (int i = 0; i < 24; i++) {
+		EXPECT_TRUE(tree.remove(i));
+		ASSERT_TRUE(tree.valid());
+	}
+	// Once the leaves under the root have merged into one, it becomes the root
+	EXPECT_EQ(1, tree.depth());
+	EXPECT_FALSE(tree.contains(0));
+}
+
+TEST(ConcurrentBTreeTest, ConcurrentDisjointInserts) {
+	ConcurrentBTree<int, int, 8> tree;
+	const int PER_THREAD = 20000;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREADS; t++) {
+		threads.push_back(std::thread([&tree, t]() {
+			for (int i = 0; i < PER_THREAD; i++) {
+				tree.insert(i * THREADS + t, t);
+			}
+		}));
+	}
+	for (size_t t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+	ASSERT_TRUE(tree.valid());
+	for (int i = 0; i < PER_THREAD * THREADS; i++) {
+		int value;
+		ASSERT_TRUE(tree.find(i, value));
+		EXPECT_EQ(i % THREADS, value);
+	}
+}
+
+TEST(ConcurrentBTreeTest, ReadersSeeStableKeysDuringWrites) {
+	ConcurrentBTree<int, int, 8> tree;
+	const int N = 20000;
+	// Even keys stay put while writers churn the odd ones, so readers must always find them
+	for (int i = 0; i < N; i += 2) {
+		tree.insert(i, i);
+	}
+	std::atomic<bool> done(false);
+	std::atomic<int> missing(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREADS / 2; t++) {
+		threads.push_back(std::thread([&]() {
+			while (!done.load()) {
+				for (int i = 0; i < N; i += 2) {
+					int value;
+					if (!tree.find(i, value) || value != i) {
+						missing++;
+					}
+				}
+			}
+		}));
+	}
+	std::vector<std::thread> writers;
+	for (int t = 0; t < THREADS / 2; t++) {
+		writers.push_back(std::thread([&tree, t]() {
+			for (int round = 0; round < 3; round++) {
+				for (int i = 1 + 2 * t; i < N; i += THREADS) {
+					tree.insert(i, i);
+				}
+				for (int i = 1 + 2 * t; i < N; i += THREADS) {
+					tree.remove(i);
+				}
+			}
+		}));
+	}
+	for (size_t t = 0; t < writers.size(); t++) {
+		writers[t].join();
+	}
+	done = true;
+	for (size_t t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+	EXPECT_EQ(0, missing.load());
+	ASSERT_TRUE(tree.valid());
+	for (int i = 0; i < N; i++) {
+		EXPECT_EQ(i % 2 == 0, tree.contains(i));
+	}
+}
+
+TEST(ConcurrentBTreeTest, ConcurrentRemovesReclaimNodes) {
+	ConcurrentBTree<int, int, 8> tree;
+	const int N = 40000;
+	for (int i = 0; i < N; i++) {
+		tree.insert(i, i);
+	}
+	std::atomic<int> removed(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREADS; t++) {
+		threads.push_back(std::thread([&, t]() {
+			for (int i = t; i < N; i += THREADS) {
+				removed += tree.remove(i);
+			}
+		}));
+	}
+	for (size_t t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+	EXPECT_EQ(N, removed.load());
+	ASSERT_TRUE(tree.valid());
+	for (int i = 0; i < N; i++) {
+		ASSERT_FALSE(tree.contains(i));
+	}
+	// Retired nodes are freed in batches, so only the last partial batch may still be waiting
+	EXPECT_LT(tree.pendingReclamation(), 64u);
+}
+
+TEST(ConcurrentBTreeTest, TooManyThreadsThrows) {
+	ConcurrentBTree<int, int, 8> tree;
+	const int MAX_THREADS = ConcurrentBTree_private::EpochManager::MAX_THREADS;
+	std::atomic<int> succeeded(0);
+	std::atomic<int> refused(0);
+	std::atomic<bool> release(false);
+	std::vector<std::thread> threads;
+	for (int t = 0; t <= MAX_THREADS; t++) {
+		threads.push_back(std::thread([&, t]() {
+			try {
+				tree.insert(t, t);
+				succeeded++;
+			} catch (const TooManyThreadsException&) {
+				refused++;
+			}
+			// Hold on to the thread number until every thread has tried for one
+			while (!release.load()) {
+				std::this_thread::yield();
+			}
+		}));
+	}
+	while (succeeded.load() + refused.load() <= MAX_THREADS) {
+		std::this_thread::yield();
+	}
+	release = true;
+	for (size_t t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+	EXPECT_LE(succeeded.load(), MAX_THREADS);
+	EXPECT_GE(refused.load(), 1);
+
+	// The numbers of the threads which exited are handed out again
+	std::thread([&]() { tree.insert(-1, -1); }).join();
+	EXPECT_TRUE(tree.contains(-1));
+	ASSERT_TRUE(tree.valid());
+}
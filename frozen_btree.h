@@ -0,0 +1,456 @@
+#ifndef FROZEN_BTREE_H
+#define FROZEN_BTREE_H
+
+#include "btree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Thrown by FrozenBTree::save and FrozenBTree::open when a file cannot be written, read, or is not a tree of the
+ * expected kind.
+ */
+class FrozenBTreeFileException : public std::exception {
+	const char* message_;
+
+public:
+	FrozenBTreeFileException(const char* message) : message_(message) {}
+
+	virtual const char* what() const throw() {
+		return message_;
+	}
+};
+
+namespace FrozenBTree_private
+{
+	/**
+	 * The start of a saved tree. All fields are in the byte order of the machine which saved it; a file saved on a
+	 * machine of the other byte order fails the byteOrder check rather than being misread.
+	 *
+	 * The keys of every level follow at keysOffset, exactly as they are laid out in memory, and the values at
+	 * valuesOffset. Both offsets are multiples of FILE_ALIGNMENT, so that the mapped arrays are as well aligned as
+	 * the ones built in memory.
+	 */
+	struct FileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		uint32_t keyBytes;
+		uint32_t valueBytes;
+		uint32_t nodeKeys;
+		uint32_t reserved;
+		uint64_t size;
+		uint64_t keysOffset;
+		uint64_t keyCount;
+		uint64_t valuesOffset;
+	};
+
+	const char FILE_MAGIC[8] = { 'F', 'B', 'T', 'R', 'E', 'E', '\r', '\n' };
+
+	/**
+	 * Incremented whenever the layout of the file or of the levels changes.
+	 */
+	const uint32_t FILE_VERSION = 1;
+
+	const uint32_t FILE_BYTE_ORDER = 0x01020304;
+
+	const size_t FILE_ALIGNMENT = 64;
+
+	inline uint64_t alignUp(uint64_t n)
+	{
+		return (n + FILE_ALIGNMENT - 1) / FILE_ALIGNMENT * FILE_ALIGNMENT;
+	}
+
+	/**
+	 * @return true if count items of the given size, starting at offset, end within the given number of bytes. Nothing
+	 * is multiplied or added, so header fields too large to be real cannot wrap around and pass.
+	 */
+	inline bool fitsWithin(uint64_t offset, uint64_t count, uint64_t itemBytes, uint64_t bytes)
+	{
+		return offset <= bytes && count <= (bytes - offset) / itemBytes;
+	}
+}; // namespace FrozenBTree_private
+
+/**
+ * A read-only snapshot of a BTree, laid out as a static B+tree: every node is one run of NODE_KEYS keys, and the
+ * nodes of each level are stored one after another, root level first and the sorted keys themselves last. Children
+ * are found by arithmetic instead of pointers (child i of node k is node k * (NODE_KEYS + 1) + i on the level below),
+ * so the keys take no more memory than a sorted array plus about one key in NODE_KEYS for the levels above it. With
+ * the default node size each node fills one cache line, and every lookup touches exactly one node per level.
+ *
+ * Internal nodes hold, for each child but the first, the lowest key beneath that child. The last node of a level may
+ * have fewer children than the others; its unused keys repeat its last real one, and searches clamp to the number of
+ * children it really has.
+ *
+ * Since the layout holds no pointers, a snapshot whose values are trivially copyable can be saved to a file and later
+ * opened by mapping the file into memory, and served from the mapping as it stands.
+ * @tparam K the type of the keys, which must be trivially copyable
+ * @tparam V the type of the values
+ * @tparam NODE_KEYS the number of keys in each node
+ */
+template<class K, class V, int NODE_KEYS = (64 / sizeof(K) > 2 ? 64 / sizeof(K) : 2)>
+class FrozenBTree
+{
+	static_assert(std::is_trivially_copyable<K>::value, "FrozenBTree keys must be trivially copyable");
+
+	typedef BTree_private::BTree_KeySearch<K> KeySearch;
+	typedef FrozenBTree_private::FileHeader FileHeader;
+
+	/**
+	 * The most levels a tree can have. Even with two keys per node, this is enough for any number of keys that can be
+	 * addressed.
+	 */
+	static const int MAX_LEVELS = 64;
+
+	/**
+	 * All the keys of the tree, root level first.
+	 */
+	const K* keys_;
+	const V* values_;
+	size_t size_;
+	/**
+	 * The number of levels. Level 0 holds the sorted keys, and the root is on level levels_ - 1.
+	 */
+	int levels_;
+	size_t nodes_[MAX_LEVELS];
+	/**
+	 * Where each level begins in keys_, counted in keys.
+	 */
+	size_t offsets_[MAX_LEVELS];
+
+	/**
+	 * The keys of a snapshot built in memory, or 0.
+	 */
+	K* ownedKeys_;
+	std::vector<V> ownedValues_;
+	/**
+	 * The mapping of an opened file, or 0.
+	 */
+	void* mapping_;
+	size_t mappingBytes_;
+
+	FrozenBTree(const FrozenBTree&);
+	FrozenBTree& operator=(const FrozenBTree&);
+
+	FrozenBTree()
+	{
+		keys_ = 0;
+		values_ = 0;
+		ownedKeys_ = 0;
+		mapping_ = 0;
+		mappingBytes_ = 0;
+	}
+
+	static size_t nodesFor(size_t count, size_t perNode)
+	{
+		return (count + perNode - 1) / perNode;
+	}
+
+	/**
+	 * @return the lowest key beneath the given node
+	 */
+	const K& lowestKey(int level, size_t node) const
+	{
+		size_t leaf = node;
+		for (int l = level; l > 0; --l) {
+			leaf *= NODE_KEYS + 1;
+		}
+		return keys_[offsets_[0] + leaf * NODE_KEYS];
+	}
+
+	/**
+	 * Lay out the levels above the sorted keys, which must already be in place.
+	 */
+	void buildIndexLevels()
+	{
+		for (int level = 1; level < levels_; ++level) {
+			size_t children = nodes_[level - 1];
+			K* node = ownedKeys_ + offsets_[level];
+			for (size_t k = 0; k < nodes_[level]; ++k, node += NODE_KEYS) {
+				size_t first = k * (NODE_KEYS + 1);
+				for (int i = 0; i < NODE_KEYS; ++i) {
+					size_t child = first + i + 1;
+					node[i] = child < children ? lowestKey(level - 1, child) : i > 0 ? node[i - 1]
+						: lowestKey(level - 1, first);
+				}
+			}
+		}
+	}
+
+	/**
+	 * Size the levels for the given number of keys.
+	 */
+	void layOut(size_t size)
+	{
+		size_ = size;
+		levels_ = 0;
+		size_t nodes = nodesFor(size, NODE_KEYS);
+		do {
+			assert(levels_ < MAX_LEVELS);
+			nodes_[levels_++] = nodes;
+			nodes = nodesFor(nodes, NODE_KEYS + 1);
+		} while (nodes_[levels_ - 1] > 1);
+
+		size_t total = 0;
+		for (int level = levels_ - 1; level >= 0; --level) {
+			offsets_[level] = total;
+			total += nodes_[level] * NODE_KEYS;
+		}
+	}
+
+	/**
+	 * @return the number of keys in all the levels
+	 */
+	size_t keyCount() const
+	{
+		return offsets_[0] + nodes_[0] * NODE_KEYS;
+	}
+
+	/**
+	 * @return the number of keys not greater than the given key
+	 */
+	size_t upperBoundPos(const K& key) const
+	{
+		if (size_ == 0) {
+			return 0;
+		}
+		size_t k = 0;
+		for (int level = levels_ - 1; level > 0; --level) {
+			const K* node = keys_ + offsets_[level] + k * NODE_KEYS;
+			size_t first = k * (NODE_KEYS + 1);
+			int i = KeySearch::upperBound(node, NODE_KEYS, key);
+			int separators = (int) (nodes_[level - 1] - first - 1);
+			k = first + (i < separators ? i : separators);
+		}
+		const K* leaf = keys_ + offsets_[0] + k * NODE_KEYS;
+		int i = KeySearch::upperBound(leaf, NODE_KEYS, key);
+		int count = (int) (size_ - k * NODE_KEYS);
+		return k * NODE_KEYS + (i < count ? i : count);
+	}
+
+	/**
+	 * Write bytes at the given offset. Nothing is written for an empty range, whose data may be null.
+	 */
+	static void writeAt(FILE* file, uint64_t offset, const void* data, size_t bytes)
+	{
+		if (bytes == 0) {
+			return;
+		}
+		if (fseek(file, offset, SEEK_SET) != 0 || fwrite(data, 1, bytes, file) != bytes) {
+			fclose(file);
+			throw FrozenBTreeFileException("FrozenBTree file could not be written");
+		}
+	}
+
+public:
+	/**
+	 * Take a snapshot of the given tree. Later changes to the tree do not affect the snapshot.
+	 * @param tree a BTree, or anything else which iterates over entries with key and value members in increasing
+	 * order of key
+	 */
+	template<class Tree>
+	explicit FrozenBTree(Tree& tree)
+	{
+		mapping_ = 0;
+		mappingBytes_ = 0;
+		size_t size = 0;
+		for (typename Tree::Iterator i = tree.begin(); i != tree.end(); ++i) {
+			++size;
+		}
+		layOut(size);
+		void* keys;
+		size_t bytes = keyCount() * sizeof(K);
+		if (posix_memalign(&keys, FrozenBTree_private::FILE_ALIGNMENT, bytes > 0 ? bytes : 1) != 0) {
+			throw std::bad_alloc();
+		}
+		ownedKeys_ = static_cast<K*>(keys);
+		keys_ = ownedKeys_;
+
+		ownedValues_.reserve(size);
+		K* sorted = ownedKeys_ + offsets_[0];
+		for (typename Tree::Iterator i = tree.begin(); i != tree.end(); ++i) {
+			sorted[ownedValues_.size()] = i->key;
+			ownedValues_.push_back(i->value);
+		}
+		values_ = ownedValues_.data();
+		for (size_t i = size; i < nodes_[0] * NODE_KEYS; ++i) {
+			sorted[i] = sorted[size - 1];
+		}
+		buildIndexLevels();
+	}
+
+	FrozenBTree(FrozenBTree&& other) : ownedValues_(std::move(other.ownedValues_))
+	{
+		keys_ = other.keys_;
+		values_ = other.values_;
+		size_ = other.size_;
+		levels_ = other.levels_;
+		memcpy(nodes_, other.nodes_, sizeof(nodes_));
+		memcpy(offsets_, other.offsets_, sizeof(offsets_));
+		ownedKeys_ = other.ownedKeys_;
+		mapping_ = other.mapping_;
+		mappingBytes_ = other.mappingBytes_;
+		other.ownedKeys_ = 0;
+		other.mapping_ = 0;
+	}
+
+	~FrozenBTree()
+	{
+		free(ownedKeys_);
+		if (mapping_ != 0) {
+			munmap(mapping_, mappingBytes_);
+		}
+	}
+
+	/**
+	 * Write the snapshot to a file, which open can later map back in. The file holds the levels exactly as they are
+	 * laid out in memory, so it can only be opened on a machine with the same byte order and type sizes.
+	 * @throws FrozenBTreeFileException if the file cannot be written
+	 */
+	void save(const char* path) const
+	{
+		static_assert(std::is_trivially_copyable<V>::value, "only FrozenBTrees of trivially copyable values can be saved");
+		FileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, FrozenBTree_private::FILE_MAGIC, sizeof(header.magic));
+		header.version = FrozenBTree_private::FILE_VERSION;
+		header.byteOrder = FrozenBTree_private::FILE_BYTE_ORDER;
+		header.keyBytes = sizeof(K);
+		header.valueBytes = sizeof(V);
+		header.nodeKeys = NODE_KEYS;
+		header.size = size_;
+		header.keysOffset = FrozenBTree_private::alignUp(sizeof(FileHeader));
+		header.keyCount = keyCount();
+		header.valuesOffset = FrozenBTree_private::alignUp(header.keysOffset + header.keyCount * sizeof(K));
+
+		FILE* file = fopen(path, "wb");
+		if (file == 0) {
+			throw FrozenBTreeFileException("FrozenBTree file could not be created");
+		}
+		writeAt(file, 0, &header, sizeof(header));
+		writeAt(file, header.keysOffset, keys_, header.keyCount * sizeof(K));
+		writeAt(file, header.valuesOffset, values_, size_ * sizeof(V));
+		if (fclose(file) != 0) {
+			throw FrozenBTreeFileException("FrozenBTree file could not be written");
+		}
+	}
+
+	/**
+	 * Map a file written by save into memory, read only. Nothing is read or copied up front: lookups and scans read
+	 * the mapping directly, so pages of the file are only faulted in as they are needed.
+	 * @throws FrozenBTreeFileException if the file cannot be read, or does not hold a tree of this type
+	 */
+	static FrozenBTree open(const char* path)
+	{
+		static_assert(std::is_trivially_copyable<V>::value, "only FrozenBTrees of trivially copyable values can be opened");
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0) {
+			throw FrozenBTreeFileException("FrozenBTree file could not be opened");
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(FileHeader)) {
+			close(fd);
+			throw FrozenBTreeFileException("FrozenBTree file is truncated");
+		}
+		void* mapping = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (mapping == MAP_FAILED) {
+			throw FrozenBTreeFileException("FrozenBTree file could not be mapped");
+		}
+
+		FrozenBTree tree;
+		tree.mapping_ = mapping;
+		tree.mappingBytes_ = st.st_size;
+
+		const FileHeader* header = static_cast<const FileHeader*>(mapping);
+		if (memcmp(header->magic, FrozenBTree_private::FILE_MAGIC, sizeof(header->magic)) != 0) {
+			throw FrozenBTreeFileException("FrozenBTree file has the wrong magic number");
+		}
+		if (header->version != FrozenBTree_private::FILE_VERSION) {
+			throw FrozenBTreeFileException("FrozenBTree file has an unsupported version");
+		}
+		if (header->byteOrder != FrozenBTree_private::FILE_BYTE_ORDER || header->keyBytes != sizeof(K)
+				|| header->valueBytes != sizeof(V) || header->nodeKeys != (uint32_t) NODE_KEYS) {
+			throw FrozenBTreeFileException("FrozenBTree file was saved for different types");
+		}
+
+		// Every key has a value in the file, so this bounds the size before the levels are sized from it
+		if (header->size > (uint64_t) st.st_size / sizeof(V)) {
+			throw FrozenBTreeFileException("FrozenBTree file is truncated");
+		}
+		tree.layOut(header->size);
+		if (header->keyCount != tree.keyCount() || header->keysOffset % FrozenBTree_private::FILE_ALIGNMENT != 0
+				|| header->valuesOffset % FrozenBTree_private::FILE_ALIGNMENT != 0
+				|| !FrozenBTree_private::fitsWithin(header->keysOffset, header->keyCount, sizeof(K),
+						header->valuesOffset)
+				|| !FrozenBTree_private::fitsWithin(header->valuesOffset, header->size, sizeof(V), st.st_size)) {
+			throw FrozenBTreeFileException("FrozenBTree file is truncated");
+		}
+		const char* base = static_cast<const char*>(mapping);
+		tree.keys_ = reinterpret_cast<const K*>(base + header->keysOffset);
+		tree.values_ = reinterpret_cast<const V*>(base + header->valuesOffset);
+		return tree;
+	}
+
+	/**
+	 * @return a pointer to the value associated with the given key, or 0 if there is none
+	 */
+	const V* find(const K& key) const
+	{
+		size_t p = upperBoundPos(key);
+		return p > 0 && keys_[offsets_[0] + p - 1] == key ? &values_[p - 1] : 0;
+	}
+
+	bool contains(const K& key) const
+	{
+		return find(key) != 0;
+	}
+
+	/**
+	 * Call visit(key, value) for every element with a key in [lo, hi), in order of increasing key.
+	 * @return the visitor, after it has seen every element in the range
+	 */
+	template<class Visitor>
+	Visitor scan(const K& lo, const K& hi, Visitor visit) const
+	{
+		const K* sorted = keys_ + offsets_[0];
+		size_t p = upperBoundPos(lo);
+		if (p > 0 && sorted[p - 1] == lo) {
+			--p;
+		}
+		for (; p < size_ && sorted[p] < hi; ++p) {
+			visit(sorted[p], values_[p]);
+		}
+		return visit;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	/**
+	 * @return the number of levels, including the level of sorted keys
+	 */
+	int depth() const
+	{
+		return levels_;
+	}
+
+	/**
+	 * @return the bytes taken by the keys and values
+	 */
+	size_t bytes() const
+	{
+		return keyCount() * sizeof(K) + size_ * sizeof(V);
+	}
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include "frozen_btree.h"
+#include "gtest/gtest.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+struct CollectVisitor
+{
+	std::vector<int> keys;
+
+	void operator()(int key, int)
+	{
+		keys.push_back(key);
+	}
+};
+
+TEST(FrozenBTreeTest, FindEveryKey)
+{
+	// Sizes either side of whole nodes and whole levels, for the clamping of partly filled nodes
+	const int SIZES[] = { 0, 1, 15, 16, 17, 271, 272, 273, 5000, 100000 };
+	for (size_t t = 0; t < sizeof(SIZES) / sizeof(SIZES[0]); t++) {
+		int n = SIZES[t];
+		BTree<int, int, 16, BTree_ColumnPages> b;
+		for (int i = 0; i < n; i++) {
+			b[i * 2] = i;
+		}
+		FrozenBTree<int, int> f(b);
+		ASSERT_EQ((size_t) n, f.size());
+		for (int i = 0; i < n; i++) {
+			const int* value = f.find(i * 2);
+			ASSERT_TRUE(value != 0) << "Expected " << i * 2 << " in a snapshot of " << n << " keys";
+			ASSERT_EQ(i, *value);
+			ASSERT_FALSE(f.contains(i * 2 + 1)) << "Expected " << i * 2 + 1 << " to be absent";
+		}
+		ASSERT_FALSE(f.contains(-1));
+	}
+}
+
+TEST(FrozenBTreeTest, SnapshotIsIndependent)
+{
+	BTree<int, int> b;
+	b[1] = 10;
+	FrozenBTree<int, int> f(b);
+	b[1] = 20;
+	b[2] = 30;
+	ASSERT_EQ(10, *f.find(1));
+	ASSERT_FALSE(f.contains(2));
+}
+
+TEST(FrozenBTreeTest, SmallNodesAndRangeScan)
+{
+	BTree<int, int, 4> b;
+	for (int i = 0; i < 1000; i++) {
+		b[i * 3] = i;
+	}
+	FrozenBTree<int, int, 2> f(b);
+	ASSERT_EQ(7, f.depth()) << "Expected 500 leaf nodes under six levels of three-way nodes";
+	for (int i = 0; i < 1000; i++) {
+		ASSERT_EQ(i, *f.find(i * 3));
+	}
+
+	CollectVisitor visited = f.scan(10, 31, CollectVisitor());
+	std::vector<int> expected;
+	for (int k = 12; k < 31; k += 3) {
+		expected.push_back(k);
+	}
+	ASSERT_EQ(expected, visited.keys);
+	ASSERT_TRUE(f.scan(3000, 4000, CollectVisitor()).keys.empty());
+	ASSERT_EQ(1000u, f.scan(-5, 5000, CollectVisitor()).keys.size());
+}
+
+static const char* TEST_FILE = "frozen_btree_tests.tmp";
+
+TEST(FrozenBTreeTest, SaveAndOpen)
+{
+	BTree<int64_t, double, 32, BTree_ColumnPages> b;
+	for (int i = 0; i < 50000; i++) {
+		b[i * 5] = i / 2.0;
+	}
+	FrozenBTree<int64_t, double>(b).save(TEST_FILE);
+
+	FrozenBTree<int64_t, double> f = FrozenBTree<int64_t, double>::open(TEST_FILE);
+	ASSERT_EQ(50000u, f.size());
+	for (int i = 0; i < 50000; i++) {
+		const double* value = f.find(i * 5);
+		ASSERT_TRUE(value != 0) << "Expected " << i * 5 << " to be served from the mapping";
+		ASSERT_EQ(i / 2.0, *value);
+		ASSERT_FALSE(f.contains(i * 5 + 1));
+	}
+	remove(TEST_FILE);
+}
+
+TEST(FrozenBTreeTest, SaveAndOpenEmpty)
+{
+	BTree<int, int> b;
+	FrozenBTree<int, int>(b).save(TEST_FILE);
+	FrozenBTree<int, int> f = FrozenBTree<int, int>::open(TEST_FILE);
+	ASSERT_EQ(0u, f.size());
+	ASSERT_FALSE(f.contains(0));
+	remove(TEST_FILE);
+}
+
+TEST(FrozenBTreeTest, OpenRejectsMismatchedFiles)
+{
+	ASSERT_THROW((FrozenBTree<int, int>::open("no such file")), FrozenBTreeFileException);
+
+	BTree<int, int> b;
+	b[1] = 1;
+	FrozenBTree<int, int>(b).save(TEST_FILE);
+	ASSERT_THROW((FrozenBTree<int, int64_t>::open(TEST_FILE)), FrozenBTreeFileException)
+		<< "Expected a file of other value types to be rejected";
+	ASSERT_THROW((FrozenBTree<int, int, 4>::open(TEST_FILE)), FrozenBTreeFileException)
+		<< "Expected a file of other node sizes to be rejected";
+
+	FILE* file = fopen(TEST_FILE, "r+b");
+	fputc('X', file);
+	fclose(file);
+	ASSERT_THROW((FrozenBTree<int, int>::open(TEST_FILE)), FrozenBTreeFileException)
+		<< "Expected a file with the wrong magic number to be rejected";
+	remove(TEST_FILE);
+}
+
+/**
+ * Overwrite one 64-bit field of the header of TEST_FILE.
+ */
+static void patchHeader(size_t offset, uint64_t value)
+{
+	FILE* file = fopen(TEST_FILE, "r+b");
+	fseek(file, (long) offset, SEEK_SET);
+	fwrite(&value, sizeof(value), 1, file);
+	fclose(file);
+}
+
+TEST(FrozenBTreeTest, OpenRejectsOverflowingHeaders)
+{
+	typedef FrozenBTree_private::FileHeader FileHeader;
+	BTree<int, int> b;
+	for (int i = 0; i < 16; ++i) {
+		b[i] = i;
+	}
+
+	FrozenBTree<int, int>(b).save(TEST_FILE);
+	patchHeader(offsetof(FileHeader, size), UINT64_MAX);
+	ASSERT_THROW((FrozenBTree<int, int>::open(TEST_FILE)), FrozenBTreeFileException)
+		<< "Expected a file claiming more keys than it can hold to be rejected";
+
+	// 16 values of 4 bytes starting 64 bytes short of 2^64 would end at 0, inside any file, if the sum wrapped
+	FrozenBTree<int, int>(b).save(TEST_FILE);
+	patchHeader(offsetof(FileHeader, valuesOffset), UINT64_MAX - 63);
+	ASSERT_THROW((FrozenBTree<int, int>::open(TEST_FILE)), FrozenBTreeFileException)
+		<< "Expected a file whose values end past 2^64 to be rejected";
+	remove(TEST_FILE);
+}
@@ -1,8 +1,18 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <exception>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 #define INITIAL_CAPACITY 64
+#define HEAP_CACHE_LINE 64
 
 class EmptyHeapException : public std::exception {
 	virtual const char* what() const throw() {
@@ -10,208 +20,483 @@ class EmptyHeapException : public std::exception {
 	}
 } the_EmptyHeapException;
 
+/**
+ * The default Heap comparator: gives priority to the greater value. It has no state, so it takes up no space in the Heap.
+ * @tparam T type of the compared values
+ */
+template <class T>
+struct Heap_Comparator {
+	inline bool operator()(const T& value1, const T& value2) const {
+		return value1 > value2;
+	}
+};
+
+/**
+ * A Heap comparator which follows a plain bool(T, T) comparison function, given to the Heap constructor. The function
+ * is called indirectly, so prefer a functor type as Compare where comparisons should be inlined.
+ * @tparam T type of the compared values
+ */
 template <class T>
-class Heap {
-	typedef bool (*Comparator)(T value1, T value2);
+struct Heap_FunctionComparator {
+	typedef bool (*Function)(T value1, T value2);
+
+	Function function_;
+
+	Heap_FunctionComparator(Function function) : function_(function) {}
+
+	inline bool operator()(const T& value1, const T& value2) const {
+		return function_(value1, value2);
+	}
+};
+
+namespace Heap_private {
+	/**
+	 * Holds a Heap's comparator. Empty functors, such as captureless lambdas, are held as a base class so that they take
+	 * up no space in the Heap.
+	 */
+	template <class Compare, bool EMPTY = std::is_empty<Compare>::value && !std::is_final<Compare>::value>
+	class ComparatorStore : private Compare {
+	public:
+		ComparatorStore(const Compare& compare) : Compare(compare) {}
+		inline Compare& comparator() { return *this; }
+		inline const Compare& comparator() const { return *this; }
+	};
+
+	template <class Compare>
+	class ComparatorStore<Compare, false> {
+		Compare compare_;
+	public:
+		ComparatorStore(const Compare& compare) : compare_(compare) {}
+		inline Compare& comparator() { return compare_; }
+		inline const Compare& comparator() const { return compare_; }
+	};
+
+	/**
+	 * The most bytes of grandchildren prefetched at each level of a sift-down.
+	 */
+	const size_t PREFETCH_BYTES = 512;
+
+	/**
+	 * Fetch the ARITY*ARITY grandchildren of an element, which are contiguous, into the cache. Called while the
+	 * children are compared: once the comparison is inlined it compiles to a conditional move, and without this the
+	 * next level's miss would not start until it had resolved. Only one group of ARITY grandchildren is visited, so
+	 * with wide heaps or large elements no more than the first PREFETCH_BYTES are fetched.
+	 *
+	 * Always inlined, because GCC finds a function that only prefetches to have no side effects, and drops any call to
+	 * it that it does not inline (at -Os, every one).
+	 * @param firstGrandchild the first of the grandchildren
+	 */
+	template <int ARITY, class T>
+	__attribute__((always_inline)) inline void prefetchGrandchildren(const T* firstGrandchild) {
+		const size_t bytes = ARITY * ARITY * sizeof(T) < PREFETCH_BYTES ? ARITY * ARITY * sizeof(T) : PREFETCH_BYTES;
+		const char* grandchildren = reinterpret_cast<const char*>(firstGrandchild);
+		for (size_t offset = 0; offset < bytes; offset += HEAP_CACHE_LINE) {
+			__builtin_prefetch(grandchildren + offset);
+		}
+	}
+}
+
+/**
+ * A priority queue held as an implicit ARITY-way tree in an array. The children of element i are ARITY*i+1 to ARITY*i+ARITY.
+ * Storage is cache-line aligned and the root is placed ARITY-1 slots in, so that every group of siblings starts at a
+ * multiple of ARITY slots: when ARITY*sizeof(T) divides the cache line, a bubbleDown step reads one line per level, and
+ * the tree is only log_ARITY(n) levels deep.
+ *
+ * Only the first size() slots hold constructed elements, so T needs no default constructor. Sifting moves a hole along
+ * the path rather than swapping, so each element on it is moved once. Trivially copyable elements are copied with memcpy
+ * and grown with realloc.
+ * @tparam T type of the elements
+ * @tparam ARITY number of children of each element; 2 gives a binary heap
+ * @tparam Compare functor called with two elements by const reference, which returns true if the first should be popped
+ *                 before the second
+ */
+template <class T, int ARITY = 2, class Compare = Heap_Comparator<T> >
+class Heap : private Heap_private::ComparatorStore<Compare> {
+	static_assert(ARITY >= 2, "a Heap needs at least two children per element");
+
+	typedef Heap_private::ComparatorStore<Compare> Store;
+	using Store::comparator;
+
+	static const bool TRIVIAL = std::is_trivially_copyable<T>::value;
 
 	int size_;
 	int capacity_;
 	T* data_;
-	Comparator comparator_;
+	char* block_;
 
-	inline void init(int capacity, Comparator comparator) {
+	inline void init(int capacity) {
 		size_ = 0;
 		capacity_ = capacity;
-		data_ = new T[capacity];
-		comparator_ = comparator;
+		data_ = allocate(capacity, block_);
 	}
 
 	void populate(const T* data, int size) {
-		size_ = size;
-		memcpy(data_, data, size * sizeof(T));
+		copyIn(data, size);
 
-		int deepestNodeWithChildren = (size + 1) / 2 - 1;
-
-		for (int i = deepestNodeWithChildren; i >= 0; i--) {
-			bubbleDown(i);
+		for (int i = size > 1 ? computeParentIndex(size - 1) : -1; i >= 0; i--) {
+			bubbleDown(i, T(std::move(data_[i])));
 		}
 	}
 
 public:
-	Heap() {
-		init(INITIAL_CAPACITY, defaultComparator);
+	Heap() : Store(Compare()) {
+		init(INITIAL_CAPACITY);
 	}
 
-	Heap(int capacity) {
-		init(capacity, defaultComparator);
+	Heap(int capacity) : Store(Compare()) {
+		init(capacity);
 	}
 
-	Heap(Comparator comparator) {
-		init(INITIAL_CAPACITY, comparator);
+	/**
+	 * With Heap_FunctionComparator<T> as Compare, comparator may be a plain bool(T, T) function.
+	 */
+	Heap(const Compare& comparator) : Store(comparator) {
+		init(INITIAL_CAPACITY);
 	}
 
-	Heap(int capacity, Comparator comparator) {
-		init(capacity, comparator);
+	Heap(int capacity, const Compare& comparator) : Store(comparator) {
+		init(capacity);
 	}
 
-	Heap(const T* data, int size) {
-		init(size, defaultComparator);
+	Heap(const T* data, int size, const Compare& comparator = Compare()) : Store(comparator) {
+		init(size);
 		populate(data, size);
 	}
 
-	Heap(const Heap& h) {
-		init(h.size_, h.comparator_);
-		memcpy(data_, h.data_, h.size_ * sizeof(T));
+	Heap(const Heap& h) : Store(h.comparator()) {
+		init(h.size_);
+		copyIn(h.data_, h.size_);
+	}
+
+	/**
+	 * Take the elements of h, which is left empty with no storage.
+	 */
+	Heap(Heap&& h) noexcept(std::is_nothrow_copy_constructible<Compare>::value) : Store(std::move(h.comparator())) {
 		size_ = h.size_;
+		capacity_ = h.capacity_;
+		data_ = h.data_;
+		block_ = h.block_;
+		h.forget();
 	}
 
 	~Heap() {
-		delete[] data_;
+		release(data_, size_, block_);
 	}
 
+	/**
+	 * Copy the elements of h, reusing this heap's storage if it is large enough. Larger storage is allocated before the
+	 * old is released, so if that fails this heap is left unchanged.
+	 */
 	Heap& operator=(const Heap& h) {
-		if (capacity_ < h.size_) {
-			delete[] data_;
-			data_ = new T[h.size_];
-			capacity_ = h.size_;
+		if (this != &h) {
+			if (capacity_ < h.size_) {
+				char* block;
+				T* data = allocate(h.size_, block);
+				release(data_, size_, block_);
+				data_ = data;
+				block_ = block;
+				capacity_ = h.size_;
+			} else {
+				destroy(data_, size_);
+			}
+			size_ = 0;
+			copyIn(h.data_, h.size_);
+			comparator() = h.comparator();
+		}
+		return *this;
+	}
+
+	Heap& operator=(Heap&& h) noexcept(std::is_nothrow_move_assignable<Compare>::value) {
+		if (this != &h) {
+			release(data_, size_, block_);
+			size_ = h.size_;
+			capacity_ = h.capacity_;
+			data_ = h.data_;
+			block_ = h.block_;
+			comparator() = std::move(h.comparator());
+			h.forget();
 		}
-		memcpy(data_, h.data_, h.size_ * sizeof(T));
-		size_ = h.size_;
-		comparator_ = h.comparator_;
 		return *this;
 	}
 
 	inline int size() const { return size_; }
 
-	void push(T value);
+	void push(const T& value) { emplace(value); }
+
+	void push(T&& value) { emplace(std::move(value)); }
 
-	T peek() const;
+	/**
+	 * Construct an element from args and add it to the heap. The element is built before the storage can grow, so args
+	 * may refer to an element already in the heap, as in push(peek()).
+	 */
+	template<class... Args>
+	void emplace(Args&&... args);
 
-	T pop() throw (EmptyHeapException);
+	const T& peek() const;
+
+	T pop();
 
 private:
 	void growIfNeeded();
-	inline int computeParentIndex(int index) { return (index - 1) / 2; }
-	inline int computeFirstChildIndex(int index) { return (index + 1) * 2 - 1; }
-	inline int computeSecondChildIndex(int index) { return (index + 1) * 2; }
+	inline int computeParentIndex(int index) { return (index - 1) / ARITY; }
+	inline int computeFirstChildIndex(int index) { return index * ARITY + 1; }
+
+	static T* allocate(int capacity, char*& block);
 
-	bool lessThan(int index1, int index2);
+	static T* alignedRoot(char* block);
 
-	void swap(int index1, int index2);
+	static void destroy(T* data, int size);
 
-	void bubbleUp(int startIndex);
+	static void release(T* data, int size, char* block);
 
-	void bubbleDown(int startIndex);
+	void copyIn(const T* data, int size);
 
-	static bool defaultComparator(T value1, T value2);
+	void forget();
+
+	void bubbleUp(int holeIndex, T&& value);
+
+	void bubbleDown(int holeIndex, T&& value);
+
+	int sinkHole(int holeIndex);
+
+	int topChild(int firstChildIndex, int endChildIndex);
 };
 
-template<class T>
-void Heap<T>::push(T value)
+template<class T, int ARITY, class Compare>
+template<class... Args>
+void Heap<T, ARITY, Compare>::emplace(Args&&... args)
 {
+	T value(std::forward<Args>(args)...);
 	growIfNeeded();
 
-	data_[size_] = value;
-	size_++;
-
-	bubbleUp(size_ - 1);
+	int parentIndex = computeParentIndex(size_);
+	if (size_ > 0 && comparator()(value, data_[parentIndex])) {
+		// The new slot is raw storage, so the parent is constructed into it before the hole moves on up.
+		new (data_ + size_) T(std::move(data_[parentIndex]));
+		size_++;
+		bubbleUp(parentIndex, std::move(value));
+	} else {
+		new (data_ + size_) T(std::move(value));
+		size_++;
+	}
 }
 
-template<class T>
-inline void Heap<T>::growIfNeeded() {
-	if (size_ == capacity_) {
-		int newCapacity = capacity_ * 2;
-		T* newData = new T[newCapacity];
-		memcpy(newData, data_, capacity_ * sizeof(T));
-		delete[] data_;
-		capacity_ = newCapacity;
+template<class T, int ARITY, class Compare>
+inline void Heap<T, ARITY, Compare>::growIfNeeded() {
+	if (size_ < capacity_) {
+		return;
+	}
+	int newCapacity = capacity_ > 0 ? capacity_ * 2 : INITIAL_CAPACITY;
+	if (TRIVIAL && block_) {
+		// realloc may extend the block in place. If it moves, the aligned root can land at a different offset into
+		// the block, and the elements are shifted to it.
+		size_t offset = reinterpret_cast<char*>(data_) - block_;
+		char* newBlock = static_cast<char*>(realloc(block_, (newCapacity + ARITY - 1) * sizeof(T) + HEAP_CACHE_LINE));
+		if (!newBlock) {
+			throw std::bad_alloc();
+		}
+		T* newData = alignedRoot(newBlock);
+		if (reinterpret_cast<char*>(newData) != newBlock + offset) {
+			memmove(static_cast<void*>(newData), newBlock + offset, size_ * sizeof(T));
+		}
+		block_ = newBlock;
+		data_ = newData;
+	} else {
+		char* newBlock;
+		T* newData = allocate(newCapacity, newBlock);
+		for (int i = 0; i < size_; i++) {
+			new (newData + i) T(std::move(data_[i]));
+		}
+		release(data_, size_, block_);
+		block_ = newBlock;
 		data_ = newData;
 	}
+	capacity_ = newCapacity;
 }
 
-template<class T>
-void Heap<T>::bubbleUp(int startIndex)
-{
-	while (startIndex > 0) {
-		int parentIndex = computeParentIndex(startIndex);
-		if (lessThan(parentIndex, startIndex)) {
-			swap(parentIndex, startIndex);
+/**
+ * Allocate room for capacity elements, with the first ARITY-1 slots skipped so that sibling groups start on a cache line.
+ * No elements are constructed.
+ * @param capacity the number of elements to make room for
+ * @param block set to the allocation, which must be passed back to release()
+ * @return a pointer to the root slot
+ */
+template<class T, int ARITY, class Compare>
+T* Heap<T, ARITY, Compare>::allocate(int capacity, char*& block) {
+	block = static_cast<char*>(malloc((capacity + ARITY - 1) * sizeof(T) + HEAP_CACHE_LINE));
+	if (!block) {
+		throw std::bad_alloc();
+	}
+	return alignedRoot(block);
+}
+
+template<class T, int ARITY, class Compare>
+inline T* Heap<T, ARITY, Compare>::alignedRoot(char* block) {
+	uintptr_t aligned = (reinterpret_cast<uintptr_t>(block) + HEAP_CACHE_LINE - 1) & ~(uintptr_t) (HEAP_CACHE_LINE - 1);
+	return reinterpret_cast<T*>(aligned) + ARITY - 1;
+}
+
+template<class T, int ARITY, class Compare>
+inline void Heap<T, ARITY, Compare>::destroy(T* data, int size) {
+	if (!TRIVIAL) {
+		for (int i = 0; i < size; i++) {
+			data[i].~T();
 		}
-		startIndex = parentIndex;		
 	}
 }
 
-template<class T>
-inline void Heap<T>::swap(int index1, int index2)
+template<class T, int ARITY, class Compare>
+void Heap<T, ARITY, Compare>::release(T* data, int size, char* block) {
+	destroy(data, size);
+	free(block);
+}
+
+/**
+ * Construct copies of size elements into the empty storage, which must have room for them.
+ */
+template<class T, int ARITY, class Compare>
+void Heap<T, ARITY, Compare>::copyIn(const T* data, int size) {
+	if (TRIVIAL) {
+		if (size > 0) {
+			memcpy(static_cast<void*>(data_), data, size * sizeof(T));
+		}
+	} else {
+		std::uninitialized_copy(data, data + size, data_);
+	}
+	size_ = size;
+}
+
+/**
+ * Drop the storage without releasing it, after it has been moved to another heap.
+ */
+template<class T, int ARITY, class Compare>
+inline void Heap<T, ARITY, Compare>::forget() {
+	size_ = 0;
+	capacity_ = 0;
+	data_ = 0;
+	block_ = 0;
+}
+
+/**
+ * Move the parents of a hole down into it until value can fill it.
+ * @param holeIndex a slot whose element has been moved out
+ * @param value the element to place
+ */
+template<class T, int ARITY, class Compare>
+void Heap<T, ARITY, Compare>::bubbleUp(int holeIndex, T&& value)
 {
-	T temp = data_[index1];
-	data_[index1] = data_[index2];
-	data_[index2] = temp;
+	while (holeIndex > 0) {
+		int parentIndex = computeParentIndex(holeIndex);
+		if (!comparator()(value, data_[parentIndex])) {
+			break;
+		}
+		data_[holeIndex] = std::move(data_[parentIndex]);
+		holeIndex = parentIndex;
+	}
+	data_[holeIndex] = std::move(value);
 }
 
-template<class T>
-void Heap<T>::bubbleDown(int startIndex)
+/**
+ * Move the top children of a hole up into it until value can fill it.
+ * @param holeIndex a slot whose element has been moved out
+ * @param value the element to place
+ */
+template<class T, int ARITY, class Compare>
+void Heap<T, ARITY, Compare>::bubbleDown(int holeIndex, T&& value)
 {
 	while (true) {
-		int firstChildIndex = computeFirstChildIndex(startIndex);
-		int secondChildIndex = computeSecondChildIndex(startIndex);
-
-		if (lessThan(startIndex, firstChildIndex)) {
-			if (lessThan(startIndex, secondChildIndex)) {
-				if (lessThan(firstChildIndex, secondChildIndex)) {
-					swap(startIndex, secondChildIndex);
-					startIndex = secondChildIndex;
-				} else {
-					swap(startIndex, firstChildIndex);
-					startIndex = firstChildIndex;
-				}
-			} else {
-				swap(startIndex, firstChildIndex);
-				startIndex = firstChildIndex;
-			}
-		} else if (lessThan(startIndex, secondChildIndex)) {
-			swap(startIndex, secondChildIndex);
-			startIndex = secondChildIndex;
-		} else {
+		int firstChildIndex = computeFirstChildIndex(holeIndex);
+		if (firstChildIndex >= size_) {
 			break;
 		}
+
+		int firstGrandchildIndex = computeFirstChildIndex(firstChildIndex);
+		if (firstGrandchildIndex < size_) {
+			Heap_private::prefetchGrandchildren<ARITY>(data_ + firstGrandchildIndex);
+		}
+
+		int topChildIndex = topChild(firstChildIndex, firstChildIndex + ARITY < size_ ? firstChildIndex + ARITY : size_);
+		if (!comparator()(data_[topChildIndex], value)) {
+			break;
+		}
+		data_[holeIndex] = std::move(data_[topChildIndex]);
+		holeIndex = topChildIndex;
+	}
+	data_[holeIndex] = std::move(value);
+}
+
+/**
+ * Move the top child of a hole up into it, all the way down to a leaf, without comparing against the element that will
+ * fill it. The element popped is replaced by the last one, which nearly always belongs near the bottom again, so sinking
+ * the hole first and then bubbling that element up a level or two takes about one comparison per level fewer than
+ * bubbleDown (Floyd's bottom-up variant).
+ * @param holeIndex a slot whose element has been moved out
+ * @return the leaf slot the hole ends up in
+ */
+template<class T, int ARITY, class Compare>
+int Heap<T, ARITY, Compare>::sinkHole(int holeIndex)
+{
+	// Above the last parent with a full group of children, there is no need to check that each child exists.
+	int lastFullParentIndex = size_ > ARITY ? computeParentIndex(size_ - ARITY) : -1;
+	while (holeIndex <= lastFullParentIndex) {
+		int firstChildIndex = computeFirstChildIndex(holeIndex);
+		int firstGrandchildIndex = computeFirstChildIndex(firstChildIndex);
+		if (firstGrandchildIndex < size_) {
+			Heap_private::prefetchGrandchildren<ARITY>(data_ + firstGrandchildIndex);
+		}
+		int topChildIndex = topChild(firstChildIndex, firstChildIndex + ARITY);
+		data_[holeIndex] = std::move(data_[topChildIndex]);
+		holeIndex = topChildIndex;
+	}
+
+	int firstChildIndex = computeFirstChildIndex(holeIndex);
+	if (firstChildIndex < size_) {
+		int topChildIndex = topChild(firstChildIndex, size_);
+		data_[holeIndex] = std::move(data_[topChildIndex]);
+		holeIndex = topChildIndex;
 	}
+	return holeIndex;
 }
 
-template<class T>
-inline bool Heap<T>::lessThan(int index1, int index2)
+/**
+ * @return the index of the child with the highest priority, preferring the first of equals
+ */
+template<class T, int ARITY, class Compare>
+inline int Heap<T, ARITY, Compare>::topChild(int firstChildIndex, int endChildIndex)
 {
-	if (index2 >= size_) {
-		return false;
+	int topChildIndex = firstChildIndex;
+	for (int i = firstChildIndex + 1; i < endChildIndex; i++) {
+		if (comparator()(data_[i], data_[topChildIndex])) {
+			topChildIndex = i;
+		}
 	}
-	T value1 = data_[index1];
-	T value2 = data_[index2];
-	return !comparator_(value1, value2);
+	return topChildIndex;
 }
 
-template<class T>
-inline T Heap<T>::peek() const
+template<class T, int ARITY, class Compare>
+inline const T& Heap<T, ARITY, Compare>::peek() const
 {
 	return data_[0];
 }
 
-template<class T>
-inline T Heap<T>::pop() throw (EmptyHeapException)
+template<class T, int ARITY, class Compare>
+inline T Heap<T, ARITY, Compare>::pop()
 {
 	if (size_ == 0) {
 		throw the_EmptyHeapException;
 	}
 
-	T head = data_[0];
+	T head(std::move(data_[0]));
 	size_--;
-	data_[0] = data_[size_];
-
-	bubbleDown(0);
+	if (size_ > 0) {
+		T last(std::move(data_[size_]));
+		data_[size_].~T();
+		bubbleUp(sinkHole(0), std::move(last));
+	} else {
+		data_[0].~T();
+	}
 
 	return head;
 }
 
-template<class T>
-inline bool Heap<T>::defaultComparator(T value1, T value2) {
-	return value1 > value2;
-}
+#endif
@@ -0,0 +1,221 @@
+#include "heap.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * A small deterministic generator, so that every run benchmarks the same sequence.
+ */
+static unsigned long long nextRandom(unsigned long long& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+/**
+ * Fill a heap with size random elements, then time size operations of which pushPercent are pushes and the rest pops.
+ * @return nanoseconds per operation
+ */
+template<int ARITY>
+static double timeMix(int size, int pushPercent)
+{
+	unsigned long long state = 88172645463325252ULL;
+	Heap<int, ARITY> heap(size * 2);
+	for (int i = 0; i < size; i++) {
+		heap.push((int) (nextRandom(state) >> 33));
+	}
+
+	long checksum = 0;
+	double start = now();
+	for (int i = 0; i < size; i++) {
+		unsigned long long r = nextRandom(state);
+		if ((int) (r % 100) < pushPercent) {
+			heap.push((int) (r >> 33));
+		} else {
+			checksum += heap.pop();
+		}
+	}
+	double elapsed = now() - start;
+
+	if (checksum == 42) {
+		printf("\n");
+	}
+	return elapsed * 1e9 / size;
+}
+
+template<int ARITY>
+static void benchArity(int size)
+{
+	printf("arity %-3d n=%-9d push-heavy %7.1f ns/op   pop-heavy %7.1f ns/op\n", ARITY, size,
+		timeMix<ARITY>(size, 75), timeMix<ARITY>(size, 25));
+}
+
+/**
+ * A record as large as a cache line, ordered by its key.
+ */
+struct Record
+{
+	int key;
+	char padding[60];
+
+	Record() {}
+	Record(int k) : key(k) {}
+
+	bool operator>(const Record& other) const { return key > other.key; }
+	operator int() const { return key; }
+};
+
+template<class R>
+static bool greaterFunction(R value1, R value2)
+{
+	return value1 > value2;
+}
+
+template<class R>
+struct GreaterFunctor
+{
+	bool operator()(const R& value1, const R& value2) const { return value1 > value2; }
+};
+
+/**
+ * Push n random elements, then pop them all.
+ */
+template<class R, class H>
+static void benchPushPop(const char* name, H& heap, int n)
+{
+	unsigned long long state = 88172645463325252ULL;
+	double start = now();
+	for (int i = 0; i < n; i++) {
+		heap.push(R((int) (nextRandom(state) >> 33)));
+	}
+	double pushed = now();
+	long checksum = 0;
+	for (int i = 0; i < n; i++) {
+		checksum += (int) heap.pop();
+	}
+	double popped = now();
+
+	if (checksum == 42) {
+		printf("\n");
+	}
+	printf("%-24s n=%-9d push %7.1f ns/op   pop %7.1f ns/op\n", name, n,
+		(pushed - start) * 1e9 / n, (popped - pushed) * 1e9 / n);
+}
+
+/**
+ * Compare a heap calling its comparison through a function pointer with ones that can inline it.
+ */
+template<class R>
+static void benchComparator(const char* type, int n)
+{
+	char name[64];
+	{
+		Heap<R, 2, Heap_FunctionComparator<R> > heap(n, greaterFunction<R>);
+		snprintf(name, sizeof(name), "%s, function", type);
+		benchPushPop<R>(name, heap, n);
+	}
+	{
+		Heap<R> heap(n);
+		snprintf(name, sizeof(name), "%s, default", type);
+		benchPushPop<R>(name, heap, n);
+	}
+	{
+		Heap<R, 2, GreaterFunctor<R> > heap(n);
+		snprintf(name, sizeof(name), "%s, functor", type);
+		benchPushPop<R>(name, heap, n);
+	}
+	{
+		auto greater = [](const R& value1, const R& value2) { return value1 > value2; };
+		Heap<R, 2, decltype(greater)> heap(n, greater);
+		snprintf(name, sizeof(name), "%s, lambda", type);
+		benchPushPop<R>(name, heap, n);
+	}
+}
+
+/**
+ * A composite key compared field by field, as in a scheduler ordering by deadline, then priority, then sequence number.
+ */
+struct CompositeKey
+{
+	int deadline;
+	int priority;
+	int sequence;
+};
+
+/**
+ * Gives priority to the earliest key, and counts every comparison it makes.
+ */
+struct CountingLess
+{
+	long* count;
+
+	bool operator()(const CompositeKey& key1, const CompositeKey& key2) const
+	{
+		(*count)++;
+		if (key1.deadline != key2.deadline) {
+			return key1.deadline < key2.deadline;
+		}
+		if (key1.priority != key2.priority) {
+			return key1.priority < key2.priority;
+		}
+		return key1.sequence < key2.sequence;
+	}
+};
+
+/**
+ * Count the comparisons per push and per pop of n composite keys, with few distinct deadlines so that most comparisons
+ * look at more than one field.
+ */
+template<int ARITY>
+static void benchComparisons(int n)
+{
+	long count = 0;
+	CountingLess less = {&count};
+	Heap<CompositeKey, ARITY, CountingLess> heap(n, less);
+
+	unsigned long long state = 88172645463325252ULL;
+	double start = now();
+	for (int i = 0; i < n; i++) {
+		unsigned long long r = nextRandom(state);
+		CompositeKey key = {(int) (r % 64), (int) ((r >> 8) % 8), i};
+		heap.push(key);
+	}
+	double pushed = now();
+	long pushCount = count;
+	count = 0;
+	for (int i = 0; i < n; i++) {
+		heap.pop();
+	}
+	double popped = now();
+
+	printf("composite, arity %-3d n=%-9d push %5.2f cmp %6.1f ns/op   pop %5.2f cmp %6.1f ns/op\n", ARITY, n,
+		(double) pushCount / n, (pushed - start) * 1e9 / n, (double) count / n, (popped - pushed) * 1e9 / n);
+}
+
+int main(int argc, char** argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	for (int size = 1000; size <= n * 10; size *= 10) {
+		benchArity<2>(size);
+		benchArity<4>(size);
+		benchArity<8>(size);
+		benchArity<16>(size);
+	}
+
+	benchComparator<int>("int", n);
+	benchComparator<Record>("record", n);
+
+	benchComparisons<2>(n);
+	benchComparisons<4>(n);
+	benchComparisons<8>(n);
+
+	return 0;
+}
@@ -1,4 +1,6 @@
 #include "heap.h"
+#include <memory>
+#include <string>
 #include "gtest/gtest.h"
 
 TEST(HeapTest, CreateEmptyHeap) {
@@ -114,12 +116,26 @@ TEST(HeapTest, PushBeyondCapacity) {
 	ASSERT_EQ(998, i) << "Expected 998 to be popped";
 }
 
+TEST(HeapTest, PushPeekIntoFullHeap) {
+	Heap<int> h(1);
+	h.push(7);
+	h.push(h.peek());
+	ASSERT_EQ(7, h.pop()) << "Expected the pushed copy of the top to survive the heap growing";
+	ASSERT_EQ(7, h.pop());
+
+	Heap<std::string> s(1);
+	s.push(std::string(40, 'x'));
+	s.push(s.peek());
+	ASSERT_EQ(std::string(40, 'x'), s.pop());
+	ASSERT_EQ(std::string(40, 'x'), s.pop());
+}
+
 bool minComparator(int value1, int value2) {
 	return value1 < value2;
 }
 
 TEST(HeapTest, MinComparator) {
-	Heap<int> h(minComparator);
+	Heap<int, 2, Heap_FunctionComparator<int> > h(minComparator);
 	h.push(5);
 	h.push(8);
 	h.push(3);
@@ -243,3 +259,221 @@ TEST(HeapTest, CopyConstructor) {
 	i = h2.pop();
 	ASSERT_EQ(1, i) << "Expected 1 to be popped";
 }
+
+TEST(HeapTest, CopyEmptyThenPush) {
+	Heap<int> h;
+	Heap<int> h2 = h;
+	h2.push(3);
+	h2.push(7);
+	ASSERT_EQ(7, h2.pop()) << "Expected 7 to be popped";
+	ASSERT_EQ(3, h2.pop()) << "Expected 3 to be popped";
+}
+
+template<int ARITY>
+static void pushAndPopShuffled() {
+	Heap<int, ARITY> h(1);
+	unsigned int state = 12345;
+	for (int i = 0; i < 1000; i++) {
+		state = state * 1103515245 + 12345;
+		h.push((state >> 8) % 500);
+	}
+	int previous = h.pop();
+	for (int i = 1; i < 1000; i++) {
+		int next = h.pop();
+		ASSERT_LE(next, previous) << "Expected elements to be popped in descending order with arity " << ARITY;
+		previous = next;
+	}
+	ASSERT_EQ(0, h.size());
+}
+
+TEST(HeapTest, Arity) {
+	pushAndPopShuffled<2>();
+	pushAndPopShuffled<3>();
+	pushAndPopShuffled<4>();
+	pushAndPopShuffled<8>();
+	pushAndPopShuffled<16>();
+}
+
+TEST(HeapTest, PopulateFourWayFromBigArray) {
+	int data[100];
+	for (int i = 0; i < 100; i++) {
+		data[i] = (i * 37) % 100;
+	}
+
+	Heap<int, 4> h(data, 100);
+	Heap<int, 4> h2;
+	h2 = h;
+
+	for (int i = 99; i >= 0; i--) {
+		ASSERT_EQ(i, h.pop()) << "Expected the elements to be popped in sequence";
+		ASSERT_EQ(i, h2.pop()) << "Expected the copy to pop the same sequence";
+	}
+}
+
+struct MinFunctor {
+	bool operator()(const int& value1, const int& value2) const {
+		return value1 < value2;
+	}
+};
+
+TEST(HeapTest, FunctorComparator) {
+	const int data[] = {5, 8, 3, 2, 15, 1};
+	Heap<int, 4, MinFunctor> h(data, 6);
+	ASSERT_EQ(sizeof(Heap<int, 4, MinFunctor>),
+		sizeof(Heap<int, 4, Heap_FunctionComparator<int> >) - sizeof(Heap_FunctionComparator<int>))
+		<< "Expected an empty functor to take no space";
+	ASSERT_EQ(sizeof(Heap<int, 4, MinFunctor>), sizeof(Heap<int, 4>))
+		<< "Expected the default comparator to take no space";
+
+	const int expected[] = {1, 2, 3, 5, 8, 15};
+	for (int i = 0; i < 6; i++) {
+		ASSERT_EQ(expected[i], h.pop());
+	}
+}
+
+struct Task {
+	int id;
+	int priority;
+};
+
+TEST(HeapTest, LambdaComparator) {
+	auto byPriority = [](const Task& task1, const Task& task2) { return task1.priority > task2.priority; };
+	Heap<Task, 2, decltype(byPriority)> h(byPriority);
+	for (int i = 0; i < 10; i++) {
+		Task task = {i, (i * 7) % 10};
+		h.push(task);
+	}
+	for (int priority = 9; priority >= 0; priority--) {
+		ASSERT_EQ(priority, h.pop().priority);
+	}
+}
+
+struct DistanceComparator {
+	const int* distances;
+
+	bool operator()(const int& node1, const int& node2) const {
+		return distances[node1] < distances[node2];
+	}
+};
+
+TEST(HeapTest, StatefulComparator) {
+	const int distances[] = {40, 10, 30, 0, 20};
+	DistanceComparator comparator = {distances};
+	Heap<int, 2, DistanceComparator> h(comparator);
+	for (int node = 0; node < 5; node++) {
+		h.push(node);
+	}
+	Heap<int, 2, DistanceComparator> h2 = h;
+
+	const int expected[] = {3, 1, 4, 2, 0};
+	for (int i = 0; i < 5; i++) {
+		ASSERT_EQ(expected[i], h.pop());
+		ASSERT_EQ(expected[i], h2.pop());
+	}
+}
+
+TEST(HeapTest, Strings) {
+	const std::string data[] = {"pear", "apple", "fig", "quince", "banana"};
+	Heap<std::string, 4> h(data, 5);
+	for (int i = 0; i < 200; i++) {
+		h.push(std::string(40, 'a' + i % 10));
+	}
+	Heap<std::string, 4> h2 = h;
+
+	ASSERT_EQ("quince", h.pop());
+	ASSERT_EQ("pear", h.pop());
+	ASSERT_EQ(std::string(40, 'j'), h.pop());
+	ASSERT_EQ(202, h.size());
+	ASSERT_EQ("quince", h2.peek());
+	ASSERT_EQ(205, h2.size());
+}
+
+struct PointerGreater {
+	bool operator()(const std::unique_ptr<int>& value1, const std::unique_ptr<int>& value2) const {
+		return *value1 > *value2;
+	}
+};
+
+TEST(HeapTest, MoveOnlyElements) {
+	Heap<std::unique_ptr<int>, 2, PointerGreater> h(1);
+	for (int i = 0; i < 100; i++) {
+		h.push(std::unique_ptr<int>(new int((i * 37) % 100)));
+	}
+	h.emplace(new int(500));
+
+	Heap<std::unique_ptr<int>, 2, PointerGreater> h2(std::move(h));
+	ASSERT_EQ(0, h.size()) << "Expected a moved-from heap to be empty";
+	ASSERT_EQ(500, *h2.pop());
+	for (int i = 99; i >= 0; i--) {
+		ASSERT_EQ(i, *h2.pop());
+	}
+
+	h.emplace(new int(7));
+	h2 = std::move(h);
+	ASSERT_EQ(7, *h2.pop());
+
+	ASSERT_TRUE((std::is_nothrow_move_constructible<Heap<std::unique_ptr<int>, 2, PointerGreater> >::value))
+		<< "Expected a growing std::vector to move its heaps rather than copy them";
+	ASSERT_TRUE((std::is_nothrow_move_assignable<Heap<std::unique_ptr<int>, 2, PointerGreater> >::value));
+}
+
+struct Counted {
+	static int live;
+	static int copies;
+	int value;
+
+	Counted(int v) : value(v) { live++; }
+	Counted(const Counted& other) : value(other.value) { live++; copies++; }
+	Counted(Counted&& other) : value(other.value) { live++; }
+	Counted& operator=(const Counted& other) { value = other.value; copies++; return *this; }
+	Counted& operator=(Counted&& other) { value = other.value; return *this; }
+	~Counted() { live--; }
+
+	bool operator>(const Counted& other) const { return value > other.value; }
+};
+
+int Counted::live = 0;
+int Counted::copies = 0;
+
+TEST(HeapTest, ElementLifetimes) {
+	{
+		Heap<Counted, 4> h(1);
+		for (int i = 0; i < 1000; i++) {
+			h.emplace((i * 7919) % 1000);
+		}
+		ASSERT_EQ(1000, Counted::live) << "Expected only pushed elements to be constructed";
+		for (int i = 999; i >= 500; i--) {
+			ASSERT_EQ(i, h.pop().value);
+		}
+		ASSERT_EQ(0, Counted::copies) << "Expected elements to be moved, not copied";
+
+		Heap<Counted, 4> h2;
+		h2 = h;
+		ASSERT_EQ(1000, Counted::live);
+		h2 = Heap<Counted, 4>();
+		ASSERT_EQ(500, Counted::live);
+		h2.emplace(1);
+		h2 = h;
+		ASSERT_EQ(1000, Counted::live) << "Expected the replaced elements to be destroyed when the storage grows";
+	}
+	ASSERT_EQ(0, Counted::live) << "Expected every element to be destroyed";
+}
+
+template<int ARITY>
+static void popEverySize() {
+	for (int size = 1; size <= 40; size++) {
+		Heap<int, ARITY> h;
+		for (int i = 0; i < size; i++) {
+			h.push((i * 41) % size);
+		}
+		for (int i = size - 1; i >= 0; i--) {
+			ASSERT_EQ(i, h.pop()) << "Expected the elements to be popped in sequence, arity " << ARITY << " size " << size;
+		}
+	}
+}
+
+TEST(HeapTest, PopEverySize) {
+	popEverySize<2>();
+	popEverySize<3>();
+	popEverySize<5>();
+}
@@ -0,0 +1,1103 @@
+#ifndef PAGED_BTREE_H
+#define PAGED_BTREE_H
+
+#include "btree.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#if !defined(PAGED_BTREE_NO_IO_URING) && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define PAGED_BTREE_IO_URING
+#include <linux/io_uring.h>
+#endif
+#endif
+
+/**
+ * Thrown by PagedBTree and its buffer pool when the page file cannot be read or written, or when every frame of the
+ * pool is pinned.
+ */
+class PagedBTreeException : public std::exception {
+	const char* message_;
+
+public:
+	PagedBTreeException(const char* message) : message_(message) {}
+
+	virtual const char* what() const throw() {
+		return message_;
+	}
+};
+
+/**
+ * Counters kept by a buffer pool. Every pin is either a hit or a miss, and every miss reads one page from the file.
+ */
+struct BufferPoolStats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	/**
+	 * The number of pages written back to the file.
+	 */
+	uint64_t pagesWritten;
+	/**
+	 * The number of system calls made to write pages back. Dirty pages are written back in batches, each batch with
+	 * one call where io_uring is available, so this is usually much lower than pagesWritten.
+	 */
+	uint64_t writeCalls;
+
+	BufferPoolStats() : hits(0), misses(0), evictions(0), pagesWritten(0), writeCalls(0) {}
+
+	double hitRate() const
+	{
+		return hits + misses == 0 ? 1.0 : (double) hits / (hits + misses);
+	}
+};
+
+namespace PagedBTree_private
+{
+	typedef uint64_t PageId;
+
+	/**
+	 * The size of every page in the file, and of every frame in the pool.
+	 */
+	const size_t PAGE_BYTES = 4096;
+
+	/**
+	 * The most dirty pages written back together when a dirty page has to be evicted.
+	 */
+	const size_t WRITE_BATCH = 64;
+
+#ifdef PAGED_BTREE_IO_URING
+	/**
+	 * Writes batches of pages through an io_uring: every page of a batch is queued before a single system call submits
+	 * them all and waits for them to complete, so the kernel can have them all in flight at once. Driven through the
+	 * raw system calls, so that liburing is not needed.
+	 */
+	class UringWriter
+	{
+	private:
+		int ring_;
+		unsigned entries_;
+		void* sqRing_;
+		size_t sqRingBytes_;
+		void* cqRing_;
+		size_t cqRingBytes_;
+		struct io_uring_sqe* sqes_;
+		size_t sqesBytes_;
+		unsigned* sqTail_;
+		unsigned sqMask_;
+		unsigned* sqArray_;
+		unsigned* cqHead_;
+		unsigned* cqTail_;
+		unsigned cqMask_;
+		struct io_uring_cqe* cqes_;
+
+		/**
+		 * What is left of each page of the current write, which the kernel reads when it takes up each entry.
+		 */
+		std::vector<struct iovec> iov_;
+		std::vector<uint64_t> offsets_;
+
+		UringWriter(const UringWriter&);
+		UringWriter& operator=(const UringWriter&);
+
+		template<class T>
+		static T* at(void* base, unsigned offset)
+		{
+			return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+		}
+
+		/**
+		 * Add the remainder of page i of the current write to the submission queue.
+		 */
+		void queue(int fd, unsigned i)
+		{
+			unsigned tail = *sqTail_;
+			unsigned index = tail & sqMask_;
+			struct io_uring_sqe* sqe = &sqes_[index];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_WRITEV;
+			sqe->fd = fd;
+			sqe->addr = (uint64_t) (uintptr_t) &iov_[i];
+			sqe->len = 1;
+			sqe->off = offsets_[i];
+			sqe->user_data = i;
+			sqArray_[index] = index;
+			__atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+		}
+
+		void unmap()
+		{
+			if (sqRing_ != MAP_FAILED) {
+				munmap(sqRing_, sqRingBytes_);
+			}
+			if (cqRing_ != MAP_FAILED) {
+				munmap(cqRing_, cqRingBytes_);
+			}
+			if (sqes_ != MAP_FAILED) {
+				munmap(sqes_, sqesBytes_);
+			}
+		}
+
+	public:
+		/**
+		 * Set up a ring. If the kernel does not allow it, the writer is left unavailable.
+		 */
+		UringWriter(unsigned entries)
+		{
+			sqRing_ = MAP_FAILED;
+			cqRing_ = MAP_FAILED;
+			sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+			struct io_uring_params params;
+			memset(&params, 0, sizeof(params));
+			ring_ = syscall(__NR_io_uring_setup, entries, &params);
+			if (ring_ < 0) {
+				return;
+			}
+			entries_ = params.sq_entries;
+			sqRingBytes_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			cqRingBytes_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+			sqesBytes_ = params.sq_entries * sizeof(struct io_uring_sqe);
+			sqRing_ = mmap(0, sqRingBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_,
+				IORING_OFF_SQ_RING);
+			cqRing_ = mmap(0, cqRingBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_,
+				IORING_OFF_CQ_RING);
+			sqes_ = static_cast<struct io_uring_sqe*>(mmap(0, sqesBytes_, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_SQES));
+			if (sqRing_ == MAP_FAILED || cqRing_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+				unmap();
+				close(ring_);
+				ring_ = -1;
+				return;
+			}
+			sqTail_ = at<unsigned>(sqRing_, params.sq_off.tail);
+			sqMask_ = *at<unsigned>(sqRing_, params.sq_off.ring_mask);
+			sqArray_ = at<unsigned>(sqRing_, params.sq_off.array);
+			cqHead_ = at<unsigned>(cqRing_, params.cq_off.head);
+			cqTail_ = at<unsigned>(cqRing_, params.cq_off.tail);
+			cqMask_ = *at<unsigned>(cqRing_, params.cq_off.ring_mask);
+			cqes_ = at<struct io_uring_cqe>(cqRing_, params.cq_off.cqes);
+			iov_.resize(entries_);
+			offsets_.resize(entries_);
+		}
+
+		~UringWriter()
+		{
+			if (ring_ >= 0) {
+				unmap();
+				close(ring_);
+			}
+		}
+
+		bool available() const
+		{
+			return ring_ >= 0;
+		}
+
+		/**
+		 * @return the most writes one call to write can take
+		 */
+		unsigned capacity() const
+		{
+			return entries_;
+		}
+
+		/**
+		 * Write whole pages, and wait for every write to complete. The rest of a page which the kernel only writes in
+		 * part is queued again.
+		 * @param iov the pages to write, one per entry
+		 * @param offsets where in the file each page goes
+		 * @param count the number of pages, no more than capacity()
+		 * @return false if any page could not be written in full
+		 */
+		bool write(int fd, const struct iovec* iov, const uint64_t* offsets, unsigned count)
+		{
+			for (unsigned i = 0; i < count; ++i) {
+				iov_[i] = iov[i];
+				offsets_[i] = offsets[i];
+				queue(fd, i);
+			}
+
+			bool ok = true;
+			unsigned unsubmitted = count;
+			unsigned pending = count;
+			while (pending > 0) {
+				// The kernel only waits for completions once it has submitted everything it was given, so asking for
+				// every pending write cannot wait for one which is still queued
+				int entered = syscall(__NR_io_uring_enter, ring_, unsubmitted, pending, IORING_ENTER_GETEVENTS, 0, 0);
+				if (entered < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					if ((errno != EAGAIN && errno != EBUSY) || pending == unsubmitted) {
+						return false;
+					}
+					// Out of resources until writes in flight complete, so wait for one before submitting again
+					if (syscall(__NR_io_uring_enter, ring_, 0, 1, IORING_ENTER_GETEVENTS, 0, 0) < 0 && errno != EINTR) {
+						return false;
+					}
+				} else {
+					unsubmitted -= entered;
+				}
+
+				unsigned head = *cqHead_;
+				unsigned cqTail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+				for (; head != cqTail; ++head) {
+					const struct io_uring_cqe* cqe = &cqes_[head & cqMask_];
+					unsigned i = (unsigned) cqe->user_data;
+					if (cqe->res > 0 && (size_t) cqe->res < iov_[i].iov_len) {
+						iov_[i].iov_base = static_cast<char*>(iov_[i].iov_base) + cqe->res;
+						iov_[i].iov_len -= cqe->res;
+						offsets_[i] += cqe->res;
+						queue(fd, i);
+						++unsubmitted;
+						continue;
+					}
+					if (cqe->res != (int) iov_[i].iov_len) {
+						ok = false;
+					}
+					--pending;
+				}
+				__atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+			}
+			return ok;
+		}
+	};
+#endif
+
+	/**
+	 * A fixed number of page-sized frames caching pages of one file. Pages are pinned while they are in use, and only
+	 * unpinned pages are evicted, chosen by the clock algorithm: a hand sweeps the frames, clearing the reference bit
+	 * that each pin sets, and takes the first unpinned frame whose bit is already clear.
+	 *
+	 * Evicting a dirty page writes back, along with it, up to WRITE_BATCH other dirty unpinned pages found ahead of the
+	 * hand, which the hand would otherwise reach soon. The batch is submitted to an io_uring in one system call where
+	 * the kernel allows it. Otherwise it is sorted by page, and runs of adjacent pages are written with one pwritev
+	 * call each.
+	 */
+	class BufferPool
+	{
+	private:
+		struct Frame
+		{
+			PageId page;
+			int pins;
+			bool dirty;
+			bool referenced;
+			bool used;
+		};
+
+		int fd_;
+		PageId pages_;
+		char* memory_;
+		std::vector<Frame> frames_;
+		std::unordered_map<PageId, size_t> table_;
+		size_t hand_;
+		BufferPoolStats stats_;
+#ifdef PAGED_BTREE_IO_URING
+		UringWriter uring_;
+#endif
+
+		BufferPool(const BufferPool&);
+		BufferPool& operator=(const BufferPool&);
+
+		char* data(size_t f) const
+		{
+			return memory_ + f * PAGE_BYTES;
+		}
+
+		struct ByPage
+		{
+			const std::vector<Frame>& frames;
+
+			ByPage(const std::vector<Frame>& f) : frames(f) {}
+
+			bool operator()(size_t a, size_t b) const
+			{
+				return frames[a].page < frames[b].page;
+			}
+		};
+
+		/**
+		 * Write the given frames to the file and mark them clean.
+		 */
+		void writeFrames(std::vector<size_t>& batch)
+		{
+			std::sort(batch.begin(), batch.end(), ByPage(frames_));
+#ifdef PAGED_BTREE_IO_URING
+			if (uring_.available()) {
+				struct iovec iov[WRITE_BATCH];
+				uint64_t offsets[WRITE_BATCH];
+				size_t chunk = uring_.capacity() < WRITE_BATCH ? uring_.capacity() : WRITE_BATCH;
+				for (size_t i = 0; i < batch.size(); i += chunk) {
+					unsigned count = batch.size() - i < chunk ? batch.size() - i : chunk;
+					for (unsigned j = 0; j < count; ++j) {
+						iov[j].iov_base = data(batch[i + j]);
+						iov[j].iov_len = PAGE_BYTES;
+						offsets[j] = frames_[batch[i + j]].page * PAGE_BYTES;
+					}
+					if (!uring_.write(fd_, iov, offsets, count)) {
+						throw PagedBTreeException("PagedBTree page file could not be written");
+					}
+					for (unsigned j = 0; j < count; ++j) {
+						frames_[batch[i + j]].dirty = false;
+					}
+					stats_.pagesWritten += count;
+					stats_.writeCalls++;
+				}
+				return;
+			}
+#endif
+			size_t i = 0;
+			while (i < batch.size()) {
+				struct iovec iov[IOV_MAX < 1024 ? IOV_MAX : 1024];
+				size_t maxRun = sizeof(iov) / sizeof(iov[0]);
+				size_t run = 0;
+				PageId first = frames_[batch[i]].page;
+				while (i + run < batch.size() && run < maxRun && frames_[batch[i + run]].page == first + run) {
+					iov[run].iov_base = data(batch[i + run]);
+					iov[run].iov_len = PAGE_BYTES;
+					++run;
+				}
+				ssize_t bytes = pwritev(fd_, iov, run, first * PAGE_BYTES);
+				if (bytes != (ssize_t) (run * PAGE_BYTES)) {
+					throw PagedBTreeException("PagedBTree page file could not be written");
+				}
+				for (size_t j = 0; j < run; ++j) {
+					frames_[batch[i + j]].dirty = false;
+				}
+				stats_.pagesWritten += run;
+				stats_.writeCalls++;
+				i += run;
+			}
+		}
+
+		/**
+		 * Write back a dirty frame which is about to be evicted, together with other dirty unpinned frames ahead of
+		 * the clock hand.
+		 */
+		void writeBack(size_t victim)
+		{
+			std::vector<size_t> batch;
+			batch.push_back(victim);
+			for (size_t n = 1; n < frames_.size() && batch.size() < WRITE_BATCH; ++n) {
+				size_t f = (victim + n) % frames_.size();
+				if (frames_[f].used && frames_[f].dirty && frames_[f].pins == 0) {
+					batch.push_back(f);
+				}
+			}
+			writeFrames(batch);
+		}
+
+		/**
+		 * Find a frame to hold another page, evicting the page it holds if there is one.
+		 * @throws PagedBTreeException if every frame is pinned
+		 */
+		size_t takeFrame()
+		{
+			// Two sweeps clear every reference bit, so a third finding nothing means every frame is pinned
+			for (size_t n = 0; n < 3 * frames_.size(); ++n) {
+				size_t f = hand_;
+				hand_ = (hand_ + 1) % frames_.size();
+				Frame& frame = frames_[f];
+				if (!frame.used) {
+					return f;
+				}
+				if (frame.pins > 0) {
+					continue;
+				}
+				if (frame.referenced) {
+					frame.referenced = false;
+					continue;
+				}
+				if (frame.dirty) {
+					writeBack(f);
+				}
+				table_.erase(frame.page);
+				frame.used = false;
+				stats_.evictions++;
+				return f;
+			}
+			throw PagedBTreeException("PagedBTree buffer pool has no unpinned frame to evict");
+		}
+
+		char* install(size_t f, PageId page, bool dirty)
+		{
+			Frame& frame = frames_[f];
+			frame.page = page;
+			frame.pins = 1;
+			frame.dirty = dirty;
+			frame.referenced = true;
+			frame.used = true;
+			table_[page] = f;
+			return data(f);
+		}
+
+	public:
+		/**
+		 * Open a page file, creating it if it does not exist.
+		 * @param path the file
+		 * @param frames the number of pages to keep in memory
+		 */
+		BufferPool(const char* path, size_t frames) : frames_(frames)
+#ifdef PAGED_BTREE_IO_URING
+			, uring_(WRITE_BATCH)
+#endif
+		{
+			assert(frames > 0);
+			fd_ = ::open(path, O_RDWR | O_CREAT, 0644);
+			if (fd_ < 0) {
+				throw PagedBTreeException("PagedBTree page file could not be opened");
+			}
+			struct stat st;
+			if (fstat(fd_, &st) != 0) {
+				close(fd_);
+				throw PagedBTreeException("PagedBTree page file could not be opened");
+			}
+			pages_ = st.st_size / PAGE_BYTES;
+
+			void* memory;
+			if (posix_memalign(&memory, PAGE_BYTES, frames * PAGE_BYTES) != 0) {
+				close(fd_);
+				throw std::bad_alloc();
+			}
+			memory_ = static_cast<char*>(memory);
+			for (size_t f = 0; f < frames; ++f) {
+				frames_[f].used = false;
+				frames_[f].pins = 0;
+				frames_[f].dirty = false;
+				frames_[f].referenced = false;
+			}
+			table_.reserve(frames);
+			hand_ = 0;
+		}
+
+		/**
+		 * Writes back every dirty page. No page may be pinned.
+		 */
+		~BufferPool()
+		{
+			try {
+				flush();
+			} catch (const PagedBTreeException&) {
+				// Nothing can be done about it here
+			}
+			free(memory_);
+			close(fd_);
+		}
+
+		/**
+		 * Bring a page into memory, if it is not there already, and keep it there until it is unpinned.
+		 * @return the contents of the page
+		 */
+		char* pin(PageId page)
+		{
+			std::unordered_map<PageId, size_t>::iterator i = table_.find(page);
+			if (i != table_.end()) {
+				Frame& frame = frames_[i->second];
+				frame.pins++;
+				frame.referenced = true;
+				stats_.hits++;
+				return data(i->second);
+			}
+
+			stats_.misses++;
+			size_t f = takeFrame();
+			ssize_t bytes = pread(fd_, data(f), PAGE_BYTES, page * PAGE_BYTES);
+			if (bytes < 0) {
+				throw PagedBTreeException("PagedBTree page file could not be read");
+			}
+			memset(data(f) + bytes, 0, PAGE_BYTES - bytes);
+			return install(f, page, false);
+		}
+
+		/**
+		 * Add a page to the end of the file and pin it. The page starts zeroed, and dirty.
+		 * @param page receives the number of the new page
+		 * @return the contents of the page
+		 */
+		char* pinNew(PageId& page)
+		{
+			size_t f = takeFrame();
+			page = pages_++;
+			memset(data(f), 0, PAGE_BYTES);
+			return install(f, page, true);
+		}
+
+		/**
+		 * Release a pin taken by pin or pinNew.
+		 * @param dirty whether the page was changed while pinned
+		 */
+		void unpin(PageId page, bool dirty)
+		{
+			std::unordered_map<PageId, size_t>::iterator i = table_.find(page);
+			assert(i != table_.end());
+			Frame& frame = frames_[i->second];
+			assert(frame.pins > 0);
+			frame.pins--;
+			frame.dirty = frame.dirty || dirty;
+		}
+
+		/**
+		 * Write every dirty page back to the file.
+		 */
+		void flush()
+		{
+			std::vector<size_t> batch;
+			for (size_t f = 0; f < frames_.size(); ++f) {
+				if (frames_[f].used && frames_[f].dirty) {
+					batch.push_back(f);
+				}
+			}
+			writeFrames(batch);
+		}
+
+		/**
+		 * @return the number of pages in the file, including any not yet written back
+		 */
+		PageId pages() const
+		{
+			return pages_;
+		}
+
+		size_t frames() const
+		{
+			return frames_.size();
+		}
+
+		const BufferPoolStats& stats() const
+		{
+			return stats_;
+		}
+
+		void resetStats()
+		{
+			stats_ = BufferPoolStats();
+		}
+	};
+
+	/**
+	 * A pin on a page, released when it goes out of scope.
+	 */
+	class PinnedPage
+	{
+	private:
+		BufferPool* pool_;
+		PageId page_;
+		char* data_;
+		bool dirty_;
+
+		PinnedPage(const PinnedPage&);
+		PinnedPage& operator=(const PinnedPage&);
+
+		void release()
+		{
+			if (data_ != 0) {
+				pool_->unpin(page_, dirty_);
+				data_ = 0;
+			}
+		}
+
+	public:
+		PinnedPage(BufferPool& pool, PageId page) : pool_(&pool), page_(page), dirty_(false)
+		{
+			data_ = pool.pin(page);
+		}
+
+		/**
+		 * Pin a new page at the end of the file.
+		 */
+		explicit PinnedPage(BufferPool& pool) : pool_(&pool), dirty_(true)
+		{
+			data_ = pool.pinNew(page_);
+		}
+
+		~PinnedPage()
+		{
+			release();
+		}
+
+		/**
+		 * Release this pin and take over the other one.
+		 */
+		void takeFrom(PinnedPage& other)
+		{
+			release();
+			pool_ = other.pool_;
+			page_ = other.page_;
+			data_ = other.data_;
+			dirty_ = other.dirty_;
+			other.data_ = 0;
+		}
+
+		PageId page() const
+		{
+			return page_;
+		}
+
+		template<class T>
+		T* as() const
+		{
+			return reinterpret_cast<T*>(data_);
+		}
+
+		void markDirty()
+		{
+			dirty_ = true;
+		}
+	};
+
+	/**
+	 * The first page of the file.
+	 */
+	struct Meta
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t keyBytes;
+		uint32_t valueBytes;
+		uint32_t reserved;
+		PageId root;
+		uint64_t size;
+	};
+
+	const char META_MAGIC[8] = { 'P', 'B', 'T', 'R', 'E', 'E', '\r', '\n' };
+
+	const uint32_t META_VERSION = 1;
+
+	/**
+	 * The fields at the start of every node page.
+	 */
+	struct NodeHeader
+	{
+		uint32_t leaf;
+		uint32_t count;
+	};
+
+	template<class K, class V>
+	struct Leaf
+	{
+		static const int CAPACITY = (PAGE_BYTES - 16 - alignof(V)) / (sizeof(K) + sizeof(V));
+
+		NodeHeader header;
+		/**
+		 * The page of the leaf holding the next higher keys, or 0 if this is the last leaf.
+		 */
+		PageId next;
+		K keys[CAPACITY];
+		V values[CAPACITY];
+
+		bool full() const
+		{
+			return header.count == CAPACITY;
+		}
+
+		/**
+		 * @return the index of the first key greater than the given key
+		 */
+		int upperBound(const K& key) const
+		{
+			return BTree_private::BTree_KeySearch<K>::upperBound(keys, header.count, key);
+		}
+
+		/**
+		 * @return the index of the given key, or -1 if it is absent
+		 */
+		int find(const K& key) const
+		{
+			int i = upperBound(key) - 1;
+			return i >= 0 && keys[i] == key ? i : -1;
+		}
+
+		void insertAt(int i, const K& key, const V& value)
+		{
+			memmove(&keys[i + 1], &keys[i], (header.count - i) * sizeof(K));
+			memmove(&values[i + 1], &values[i], (header.count - i) * sizeof(V));
+			keys[i] = key;
+			values[i] = value;
+			header.count++;
+		}
+
+		void removeAt(int i)
+		{
+			memmove(&keys[i], &keys[i + 1], (header.count - i - 1) * sizeof(K));
+			memmove(&values[i], &values[i + 1], (header.count - i - 1) * sizeof(V));
+			header.count--;
+		}
+
+		/**
+		 * Move the upper half of the keys into the given empty leaf, which is on the given page.
+		 * @return the lowest key of the new leaf
+		 */
+		K split(Leaf* newLeaf, PageId newPage)
+		{
+			int keep = header.count / 2;
+			newLeaf->header.leaf = 1;
+			newLeaf->header.count = header.count - keep;
+			memcpy(newLeaf->keys, &keys[keep], newLeaf->header.count * sizeof(K));
+			memcpy(newLeaf->values, &values[keep], newLeaf->header.count * sizeof(V));
+			newLeaf->next = next;
+			next = newPage;
+			header.count = keep;
+			return newLeaf->keys[0];
+		}
+	};
+
+	/**
+	 * An index node. keys[i] separates children[i], which holds lower keys, from children[i + 1], which holds keys
+	 * greater than or equal to it.
+	 */
+	template<class K>
+	struct Index
+	{
+		static const int CAPACITY = (PAGE_BYTES - 16 - alignof(K)) / (sizeof(K) + sizeof(PageId)) - 1;
+
+		NodeHeader header;
+		PageId children[CAPACITY + 1];
+		K keys[CAPACITY];
+
+		bool full() const
+		{
+			return header.count == CAPACITY;
+		}
+
+		int upperBound(const K& key) const
+		{
+			return BTree_private::BTree_KeySearch<K>::upperBound(keys, header.count, key);
+		}
+
+		/**
+		 * Insert a separator, and the child holding the keys from it upwards, at the given index.
+		 */
+		void insertAt(int i, const K& key, PageId child)
+		{
+			memmove(&keys[i + 1], &keys[i], (header.count - i) * sizeof(K));
+			memmove(&children[i + 2], &children[i + 1], (header.count - i) * sizeof(PageId));
+			keys[i] = key;
+			children[i + 1] = child;
+			header.count++;
+		}
+
+		/**
+		 * Move the upper half of the separators and children into the given empty index.
+		 * @return the separator between this index and the new one, which is removed from both
+		 */
+		K split(Index* newIndex)
+		{
+			int keep = header.count / 2;
+			K separator = keys[keep];
+			newIndex->header.leaf = 0;
+			newIndex->header.count = header.count - keep - 1;
+			memcpy(newIndex->keys, &keys[keep + 1], newIndex->header.count * sizeof(K));
+			memcpy(newIndex->children, &children[keep + 1], (newIndex->header.count + 1) * sizeof(PageId));
+			header.count = keep;
+			return separator;
+		}
+	};
+}; // namespace PagedBTree_private
+
+/**
+ * A B+tree whose nodes are pages of a file, reached through a buffer pool of bounded size, for trees larger than the
+ * memory they may use. Each node fills one 4KB page, so a node holds a few hundred small keys and the tree stays
+ * shallow. Only the pages on the current path are pinned; everything else may be evicted and written back.
+ *
+ * Keys and values are copied into and out of pages, and must be trivially copyable. Full nodes are split on the way
+ * down, so an insertion never revisits a node. Nodes left underfull by remove are not merged; the space is reused by
+ * later insertions.
+ *
+ * The file holds the whole tree: a tree opened on an existing file carries on where it left off, once it has been
+ * flushed (or destroyed).
+ * @tparam K the type of the keys
+ * @tparam V the type of the values
+ */
+template<class K, class V>
+class PagedBTree
+{
+	static_assert(std::is_trivially_copyable<K>::value, "PagedBTree keys must be trivially copyable");
+	static_assert(std::is_trivially_copyable<V>::value, "PagedBTree values must be trivially copyable");
+
+	typedef PagedBTree_private::PageId PageId;
+	typedef PagedBTree_private::PinnedPage PinnedPage;
+	typedef PagedBTree_private::NodeHeader NodeHeader;
+	typedef PagedBTree_private::Meta Meta;
+	typedef PagedBTree_private::Leaf<K, V> Leaf;
+	typedef PagedBTree_private::Index<K> Index;
+
+	static_assert(sizeof(Leaf) <= PagedBTree_private::PAGE_BYTES, "PagedBTree leaves must fit in a page");
+	static_assert(sizeof(Index) <= PagedBTree_private::PAGE_BYTES, "PagedBTree indexes must fit in a page");
+	static_assert(Leaf::CAPACITY >= 4 && Index::CAPACITY >= 4, "PagedBTree keys and values must be small");
+
+	static const PageId META_PAGE = 0;
+
+	PagedBTree_private::BufferPool pool_;
+	PageId root_;
+	uint64_t size_;
+
+	PagedBTree(const PagedBTree&);
+	PagedBTree& operator=(const PagedBTree&);
+
+	static bool isLeaf(const PinnedPage& page)
+	{
+		return page.as<NodeHeader>()->leaf != 0;
+	}
+
+	static bool isFull(const PinnedPage& page)
+	{
+		return isLeaf(page) ? page.as<Leaf>()->full() : page.as<Index>()->full();
+	}
+
+	/**
+	 * Split a full child of an index. The index must not be full.
+	 * @param i the index of the child in the parent
+	 * @param child the child, which on return holds whichever half the given key belongs in
+	 */
+	void splitChild(PinnedPage& parent, int i, PinnedPage& child, const K& key)
+	{
+		PinnedPage sibling(pool_);
+		K separator = isLeaf(child) ? child.as<Leaf>()->split(sibling.as<Leaf>(), sibling.page())
+			: child.as<Index>()->split(sibling.as<Index>());
+		parent.as<Index>()->insertAt(i, separator, sibling.page());
+		parent.markDirty();
+		child.markDirty();
+		if (!(key < separator)) {
+			child.takeFrom(sibling);
+		}
+	}
+
+	/**
+	 * Pin the leaf in which the given key is, or would be, stored.
+	 */
+	void findLeaf(const K& key, PinnedPage& node)
+	{
+		while (!isLeaf(node)) {
+			const Index* index = node.as<Index>();
+			PinnedPage child(pool_, index->children[index->upperBound(key)]);
+			node.takeFrom(child);
+		}
+	}
+
+	void writeMeta()
+	{
+		PinnedPage page(pool_, META_PAGE);
+		Meta* meta = page.as<Meta>();
+		memcpy(meta->magic, PagedBTree_private::META_MAGIC, sizeof(meta->magic));
+		meta->version = PagedBTree_private::META_VERSION;
+		meta->keyBytes = sizeof(K);
+		meta->valueBytes = sizeof(V);
+		meta->root = root_;
+		meta->size = size_;
+		page.markDirty();
+	}
+
+public:
+	/**
+	 * Open a tree stored in a page file, or start a new one if the file does not exist or is empty.
+	 * @param path the page file
+	 * @param frames the number of pages to keep in memory, at least 4
+	 * @throws PagedBTreeException if the file cannot be opened, or holds something other than a tree of this type
+	 */
+	PagedBTree(const char* path, size_t frames) : pool_(path, frames < 4 ? 4 : frames)
+	{
+		if (pool_.pages() == 0) {
+			PinnedPage meta(pool_);
+			PinnedPage root(pool_);
+			root.as<Leaf>()->header.leaf = 1;
+			root_ = root.page();
+			size_ = 0;
+			meta.markDirty();
+		} else {
+			PinnedPage page(pool_, META_PAGE);
+			const Meta* meta = page.as<Meta>();
+			if (memcmp(meta->magic, PagedBTree_private::META_MAGIC, sizeof(meta->magic)) != 0
+					|| meta->version != PagedBTree_private::META_VERSION || meta->keyBytes != sizeof(K)
+					|| meta->valueBytes != sizeof(V)) {
+				throw PagedBTreeException("PagedBTree page file does not hold a tree of this type");
+			}
+			root_ = meta->root;
+			size_ = meta->size;
+		}
+		writeMeta();
+	}
+
+	/**
+	 * Writes back every change.
+	 */
+	~PagedBTree()
+	{
+		try {
+			writeMeta();
+		} catch (const PagedBTreeException&) {
+			// The pool still tries to write back the rest
+		}
+	}
+
+	/**
+	 * Look up a key.
+	 * @param value receives the value associated with the key, if there is one
+	 * @return true if the key was found
+	 */
+	bool find(const K& key, V& value)
+	{
+		PinnedPage node(pool_, root_);
+		findLeaf(key, node);
+		const Leaf* leaf = node.as<Leaf>();
+		int i = leaf->find(key);
+		if (i < 0) {
+			return false;
+		}
+		value = leaf->values[i];
+		return true;
+	}
+
+	bool contains(const K& key)
+	{
+		PinnedPage node(pool_, root_);
+		findLeaf(key, node);
+		return node.as<Leaf>()->find(key) >= 0;
+	}
+
+	/**
+	 * Associate a value with a key, replacing any value already associated with it.
+	 */
+	void insert(const K& key, const V& value)
+	{
+		PinnedPage node(pool_, root_);
+		if (isFull(node)) {
+			PinnedPage newRoot(pool_);
+			Index* index = newRoot.as<Index>();
+			index->header.leaf = 0;
+			index->header.count = 0;
+			index->children[0] = root_;
+			root_ = newRoot.page();
+			splitChild(newRoot, 0, node, key);
+			node.takeFrom(newRoot);
+		}
+
+		while (!isLeaf(node)) {
+			Index* index = node.as<Index>();
+			int i = index->upperBound(key);
+			PinnedPage child(pool_, index->children[i]);
+			if (isFull(child)) {
+				splitChild(node, i, child, key);
+			}
+			node.takeFrom(child);
+		}
+
+		Leaf* leaf = node.as<Leaf>();
+		int i = leaf->upperBound(key);
+		if (i > 0 && leaf->keys[i - 1] == key) {
+			leaf->values[i - 1] = value;
+		} else {
+			leaf->insertAt(i, key, value);
+			++size_;
+		}
+		node.markDirty();
+	}
+
+	/**
+	 * Remove a key, if it is present.
+	 * @return true if the key was removed
+	 */
+	bool remove(const K& key)
+	{
+		PinnedPage node(pool_, root_);
+		findLeaf(key, node);
+		Leaf* leaf = node.as<Leaf>();
+		int i = leaf->find(key);
+		if (i < 0) {
+			return false;
+		}
+		leaf->removeAt(i);
+		node.markDirty();
+		--size_;
+		return true;
+	}
+
+	/**
+	 * Call visit(key, value) for every element with a key in [lo, hi), in order of increasing key. Only one leaf is
+	 * pinned at a time.
+	 * @return the visitor, after it has seen every element in the range
+	 */
+	template<class Visitor>
+	Visitor scan(const K& lo, const K& hi, Visitor visit)
+	{
+		PinnedPage node(pool_, root_);
+		findLeaf(lo, node);
+		const Leaf* leaf = node.as<Leaf>();
+		int i = leaf->upperBound(lo);
+		if (i > 0 && leaf->keys[i - 1] == lo) {
+			--i;
+		}
+		for (;;) {
+			for (; i < (int) leaf->header.count; ++i) {
+				if (!(leaf->keys[i] < hi)) {
+					return visit;
+				}
+				visit(leaf->keys[i], leaf->values[i]);
+			}
+			if (leaf->next == 0) {
+				return visit;
+			}
+			PinnedPage next(pool_, leaf->next);
+			node.takeFrom(next);
+			leaf = node.as<Leaf>();
+			i = 0;
+		}
+	}
+
+	/**
+	 * Write every change back to the page file.
+	 */
+	void flush()
+	{
+		writeMeta();
+		pool_.flush();
+	}
+
+	uint64_t size() const
+	{
+		return size_;
+	}
+
+	int depth()
+	{
+		int depth = 1;
+		PinnedPage node(pool_, root_);
+		while (!isLeaf(node)) {
+			PinnedPage child(pool_, node.as<Index>()->children[0]);
+			node.takeFrom(child);
+			++depth;
+		}
+		return depth;
+	}
+
+	/**
+	 * @return the number of pages in the file
+	 */
+	uint64_t pages() const
+	{
+		return pool_.pages();
+	}
+
+	const BufferPoolStats& stats() const
+	{
+		return pool_.stats();
+	}
+
+	void resetStats()
+	{
+		pool_.resetStats();
+	}
+};
+
+#endif
@@ -0,0 +1,92 @@
+#include "paged_btree.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static unsigned long long nextRandom(unsigned long long& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+static std::vector<int> shuffledKeys(int n)
+{
+	std::vector<int> keys(n);
+	for (int i = 0; i < n; i++) {
+		keys[i] = i;
+	}
+	unsigned long long state = 88172645463325252ULL;
+	for (int i = n - 1; i > 0; i--) {
+		int j = nextRandom(state) % (i + 1);
+		int t = keys[i];
+		keys[i] = keys[j];
+		keys[j] = t;
+	}
+	return keys;
+}
+
+static void report(const char* phase, int n, double seconds, const BufferPoolStats& stats)
+{
+	printf("  %-7s %7.1f us/op   hit rate %5.1f%%   reads %9llu   pages written %9llu   write calls %8llu\n", phase,
+		seconds * 1e6 / n, stats.hitRate() * 100, (unsigned long long) stats.misses,
+		(unsigned long long) stats.pagesWritten, (unsigned long long) stats.writeCalls);
+}
+
+/**
+ * Insert n random keys into a paged tree whose pool holds the given number of frames, flush it, then look up n random
+ * keys.
+ */
+static void benchPaged(int n, size_t frames)
+{
+	const char* path = "paged_btree_bench.tmp";
+	remove(path);
+	std::vector<int> keys = shuffledKeys(n);
+	{
+		PagedBTree<int, int> tree(path, frames);
+
+		double start = now();
+		for (int i = 0; i < n; i++) {
+			tree.insert(keys[i], i);
+		}
+		tree.flush();
+		double inserted = now();
+		double megabytes = tree.pages() * PagedBTree_private::PAGE_BYTES / 1e6;
+		printf("n=%d, tree %.1f MB, pool %.1f MB (%.0f%%)\n", n, megabytes,
+			frames * PagedBTree_private::PAGE_BYTES / 1e6, frames * PagedBTree_private::PAGE_BYTES / 1e6 / megabytes * 100);
+		report("insert", n, inserted - start, tree.stats());
+
+		tree.resetStats();
+		std::vector<int> probes = shuffledKeys(n);
+		long found = 0;
+		for (int i = 0; i < n; i++) {
+			found += tree.contains(probes[i]);
+		}
+		double looked = now();
+		if (found != n) {
+			printf("expected %d keys but found %ld\n", n, found);
+		}
+		report("lookup", n, looked - inserted, tree.stats());
+	}
+	remove(path);
+}
+
+int main(int argc, char** argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : 4000000;
+
+	// About 8 bytes per element at two thirds full, so the budgets are about 1/4, 1/16 and 1/64 of the tree
+	size_t pages = (size_t) n * 12 / PagedBTree_private::PAGE_BYTES;
+	benchPaged(n, pages / 4);
+	benchPaged(n, pages / 16);
+	benchPaged(n, pages / 64);
+
+	return 0;
+}
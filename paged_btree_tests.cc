@@ -0,0 +1,94 @@
+#include "paged_btree.h"
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <vector>
+
+static const char* TEST_FILE = "paged_btree_tests.tmp";
+
+struct CollectVisitor
+{
+	std::vector<int> keys;
+
+	void operator()(int key, int)
+	{
+		keys.push_back(key);
+	}
+};
+
+TEST(PagedBTreeTest, InsertFindRemoveWithinSmallPool)
+{
+	remove(TEST_FILE);
+	{
+		const int ITERATIONS = 100000;
+		PagedBTree<int, int> b(TEST_FILE, 8);
+		for (int i = 0; i < ITERATIONS; i++) {
+			int key = (i * 7919) % ITERATIONS;
+			b.insert(key, key * 2);
+		}
+		ASSERT_EQ((uint64_t) ITERATIONS, b.size());
+		ASSERT_GT(b.pages(), 100u) << "Expected the tree to be much larger than the pool";
+		ASSERT_EQ(2, b.depth()) << "Expected a few hundred leaves of 4KB under one index";
+
+		for (int i = 0; i < ITERATIONS; i++) {
+			int value;
+			ASSERT_TRUE(b.find(i, value)) << "Expected " << i << " to be found";
+			ASSERT_EQ(i * 2, value);
+		}
+		ASSERT_FALSE(b.contains(ITERATIONS));
+
+		for (int i = 0; i < ITERATIONS; i += 2) {
+			ASSERT_TRUE(b.remove(i));
+		}
+		ASSERT_FALSE(b.remove(0));
+		ASSERT_EQ((uint64_t) ITERATIONS / 2, b.size());
+		for (int i = 0; i < ITERATIONS; i++) {
+			ASSERT_EQ(i % 2 == 1, b.contains(i));
+		}
+
+		const BufferPoolStats& stats = b.stats();
+		ASSERT_GT(stats.misses, 0u);
+		ASSERT_GT(stats.evictions, 0u);
+		ASSERT_LT(stats.writeCalls, stats.pagesWritten) << "Expected dirty pages to be written back in batches";
+	}
+	remove(TEST_FILE);
+}
+
+TEST(PagedBTreeTest, RangeScan)
+{
+	remove(TEST_FILE);
+	{
+		PagedBTree<int, int> b(TEST_FILE, 4);
+		for (int i = 0; i < 10000; i++) {
+			b.insert(i * 3, i);
+		}
+		CollectVisitor visited = b.scan(10, 3001, CollectVisitor());
+		ASSERT_EQ(997u, visited.keys.size());
+		ASSERT_EQ(12, visited.keys.front());
+		ASSERT_EQ(3000, visited.keys.back());
+		ASSERT_TRUE(b.scan(40000, 50000, CollectVisitor()).keys.empty());
+	}
+	remove(TEST_FILE);
+}
+
+TEST(PagedBTreeTest, ReopenFile)
+{
+	remove(TEST_FILE);
+	{
+		PagedBTree<int, double> b(TEST_FILE, 16);
+		for (int i = 0; i < 20000; i++) {
+			b.insert(i, i / 4.0);
+		}
+	}
+	{
+		PagedBTree<int, double> b(TEST_FILE, 16);
+		ASSERT_EQ(20000u, b.size()) << "Expected the tree to carry on from the file";
+		for (int i = 0; i < 20000; i++) {
+			double value;
+			ASSERT_TRUE(b.find(i, value));
+			ASSERT_EQ(i / 4.0, value);
+		}
+	}
+	ASSERT_THROW((PagedBTree<int, int>(TEST_FILE, 16)), PagedBTreeException)
+		<< "Expected a file of other value types to be rejected";
+	remove(TEST_FILE);
+}